@@ -1,4 +1,6 @@
 #include <cassert>
+#include <set>
+#include <sstream>
 
 #include "cereal/messaging/msgq_to_zmq.h"
 #include "cereal/services.h"
@@ -19,8 +21,36 @@ static std::vector<std::string> get_services(const std::string &whitelist_str, b
   return service_list;
 }
 
-void msgq_to_zmq(const std::vector<std::string> &endpoints, const std::string &ip) {
-  MsgqToZmq bridge;
+static std::set<std::string> split_services(const std::string &list) {
+  std::set<std::string> ret;
+  std::stringstream ss(list);
+  for (std::string name; std::getline(ss, name, ',');) {
+    if (!name.empty()) ret.insert(name);
+  }
+  return ret;
+}
+
+// BRIDGE_SHARD: comma-separated services that get a dedicated connection in multiplexed mode,
+// defaults to the video streams. Both sides of the bridge must agree on it.
+static std::set<std::string> get_sharded_services() {
+  const char *sharded = getenv("BRIDGE_SHARD");
+  if (sharded) return split_services(sharded);
+
+  std::set<std::string> ret;
+  for (const auto &it : services) {
+    if (util::ends_with(it.first, "EncodeData")) ret.insert(it.first);
+  }
+  return ret;
+}
+
+void msgq_to_zmq(const std::vector<std::string> &endpoints, const std::string &ip, bool multiplexed) {
+  // BRIDGE_BATCH_MS: latency budget for batching messages into one ZMQ frame per service, 0 disables it.
+  // Only the bridge's own zmq_to_msgq side understands batched frames.
+  // BRIDGE_CONFLATE: comma-separated services of which only the latest message is forwarded.
+  float batch_ms = util::getenv("BRIDGE_BATCH_MS", 0.0f);
+  std::set<std::string> conflate = split_services(util::getenv("BRIDGE_CONFLATE"));
+
+  MsgqToZmq bridge(batch_ms, conflate, multiplexed, get_sharded_services());
   bridge.run(endpoints, ip);
 }
 
@@ -45,7 +75,11 @@ void zmq_to_msgq(const std::vector<std::string> &endpoints, const std::string &i
     for (auto sub_sock : poller->poll(100)) {
       std::unique_ptr<Message> msg(sub_sock->receive(true));
       if (msg) {
-        sub2pub[sub_sock]->sendMessage(msg.get());
+        PubSocket *pub_sock = sub2pub[sub_sock];
+        bool ok = bridge_zmq_unbatch(msg->getData(), msg->getSize(), [=](char *data, size_t size) {
+          pub_sock->send(data, size);
+        });
+        if (!ok) printf("dropped truncated batch\n");
       }
     }
   }
@@ -57,16 +91,66 @@ void zmq_to_msgq(const std::vector<std::string> &endpoints, const std::string &i
   }
 }
 
+void zmq_to_msgq_multiplexed(const std::vector<std::string> &endpoints, const std::string &ip) {
+  auto poller = std::make_unique<BridgeZmqPoller>();
+  auto pub_context = std::make_unique<Context>();
+  auto sub_context = std::make_unique<BridgeZmqContext>();
+  std::map<uint32_t, std::unique_ptr<PubSocket>> id2pub;
+  std::map<int, std::vector<uint32_t>> port_ids;
+  std::set<std::string> sharded = get_sharded_services();
+
+  for (auto endpoint : endpoints) {
+    uint32_t id = bridge_service_id(endpoint);
+    auto &pub_sock = id2pub[id] = std::make_unique<PubSocket>();
+    size_t queue_size = services.at(endpoint).queue_size;
+    pub_sock->connect(pub_context.get(), endpoint, true, queue_size);
+    port_ids[bridge_mux_port(id, sharded.count(endpoint) > 0)].push_back(id);
+  }
+  std::vector<std::unique_ptr<BridgeZmqSubSocket>> sub_socks;
+  for (const auto &[port, ids] : port_ids) {
+    auto &sub_sock = sub_socks.emplace_back(std::make_unique<BridgeZmqSubSocket>());
+    sub_sock->connectMultiplexed(sub_context.get(), ip, port, ids);
+    poller->registerSocket(sub_sock.get());
+  }
+
+  std::set<uint32_t> unknown_ids;
+  while (!do_exit) {
+    for (auto sub_sock : poller->poll(100)) {
+      uint32_t id = 0;
+      std::unique_ptr<Message> msg(sub_sock->receiveMultiplexed(&id, true));
+      if (!msg) continue;
+
+      auto it = id2pub.find(id);
+      if (it == id2pub.end()) {
+        if (unknown_ids.insert(id).second) printf("dropping messages of unknown service id %u\n", id);
+      } else {
+        PubSocket *pub_sock = it->second.get();
+        bool ok = bridge_zmq_unbatch(msg->getData(), msg->getSize(), [=](char *data, size_t size) {
+          pub_sock->send(data, size);
+        });
+        if (!ok) printf("dropped truncated batch\n");
+      }
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   bool is_zmq_to_msgq = argc > 2;
   std::string ip = is_zmq_to_msgq ? argv[1] : "127.0.0.1";
   std::string whitelist_str = is_zmq_to_msgq ? std::string(argv[2]) : "";
   std::vector<std::string> endpoints = get_services(whitelist_str, is_zmq_to_msgq);
 
+  // BRIDGE_MUX=1: all services share one connection, see BRIDGE_MUX_PORT. Both sides must enable it.
+  bool multiplexed = util::getenv("BRIDGE_MUX", 0) != 0;
+
   if (is_zmq_to_msgq) {
-    zmq_to_msgq(endpoints, ip);
+    if (multiplexed) {
+      zmq_to_msgq_multiplexed(endpoints, ip);
+    } else {
+      zmq_to_msgq(endpoints, ip);
+    }
   } else {
-    msgq_to_zmq(endpoints, ip);
+    msgq_to_zmq(endpoints, ip, multiplexed);
   }
   return 0;
 }
@@ -1,9 +1,15 @@
 #include "cereal/messaging/bridge_zmq.h"
 
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <unordered_map>
 #include <unistd.h>
 
+#include "cereal/services.h"
+
 static size_t fnv1a_hash(const std::string &str) {
   const size_t fnv_prime = 0x100000001b3;
   size_t hash_value = 0xcbf29ce484222325;
@@ -22,6 +28,36 @@ static int get_port(std::string endpoint) {
   return start_port + (hash_value % (max_port - start_port));
 }
 
+// 32-bit FNV-1a of the name, without the sign bit
+static int service_name_hash(const std::string &name) {
+  uint32_t hash_value = 0x811c9dc5;
+  for (char c : name) {
+    hash_value ^= (unsigned char)c;
+    hash_value *= 0x01000193;
+  }
+  return hash_value & 0x7fffffff;
+}
+
+int bridge_service_id(const std::string &name) {
+  static const std::unordered_map<std::string, int> ids = []() {
+    std::unordered_map<std::string, int> ret;
+    std::unordered_map<int, std::string> names;
+    for (const auto &it : services) {
+      int id = service_name_hash(it.first);
+      auto [other, inserted] = names.try_emplace(id, it.first);
+      if (!inserted) {
+        // services.py has to rename one of them, the ids are part of the wire format
+        fprintf(stderr, "bridge service ids of %s and %s collide\n", it.first.c_str(), other->second.c_str());
+        abort();
+      }
+      ret[it.first] = id;
+    }
+    return ret;
+  }();
+  auto it = ids.find(name);
+  return it == ids.end() ? -1 : it->second;
+}
+
 BridgeZmqContext::BridgeZmqContext() {
   context = zmq_ctx_new();
 }
@@ -81,6 +117,23 @@ int BridgeZmqSubSocket::connect(BridgeZmqContext *context, std::string endpoint,
   return zmq_connect(sock, full_endpoint.c_str());
 }
 
+int BridgeZmqSubSocket::connectMultiplexed(BridgeZmqContext *context, std::string address, int port, const std::vector<uint32_t> &service_ids) {
+  sock = zmq_socket(context->getRawContext(), ZMQ_SUB);
+  if (sock == nullptr) {
+    return -1;
+  }
+
+  for (uint32_t id : service_ids) {
+    zmq_setsockopt(sock, ZMQ_SUBSCRIBE, &id, sizeof(id));
+  }
+
+  int reconnect_ivl = 500;
+  zmq_setsockopt(sock, ZMQ_RECONNECT_IVL_MAX, &reconnect_ivl, sizeof(reconnect_ivl));
+
+  full_endpoint = "tcp://" + address + ":" + std::to_string(port);
+  return zmq_connect(sock, full_endpoint.c_str());
+}
+
 void BridgeZmqSubSocket::setTimeout(int timeout) {
   zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(int));
 }
@@ -102,6 +155,31 @@ Message *BridgeZmqSubSocket::receive(bool non_blocking) {
   return ret;
 }
 
+Message *BridgeZmqSubSocket::receiveMultiplexed(uint32_t *service_id, bool non_blocking) {
+  zmq_msg_t msg;
+  assert(zmq_msg_init(&msg) == 0);
+
+  int flags = non_blocking ? ZMQ_DONTWAIT : 0;
+  int rc = zmq_msg_recv(&msg, sock, flags);
+  bool valid = rc == sizeof(uint32_t) && zmq_msg_more(&msg);
+  if (valid) {
+    memcpy(service_id, zmq_msg_data(&msg), sizeof(uint32_t));
+  }
+
+  // always consume the remaining frames of the message
+  Message *ret = nullptr;
+  while (rc >= 0 && zmq_msg_more(&msg)) {
+    rc = zmq_msg_recv(&msg, sock, 0);
+    if (rc >= 0 && valid && !zmq_msg_more(&msg)) {
+      ret = new BridgeZmqMessage;
+      ret->init((char *)zmq_msg_data(&msg), zmq_msg_size(&msg));
+    }
+  }
+
+  zmq_msg_close(&msg);
+  return ret;
+}
+
 BridgeZmqSubSocket::~BridgeZmqSubSocket() {
   if (sock != nullptr) {
     zmq_close(sock);
@@ -127,6 +205,17 @@ int BridgeZmqPubSocket::connect(BridgeZmqContext *context, std::string endpoint,
   return zmq_bind(sock, full_endpoint.c_str());
 }
 
+int BridgeZmqPubSocket::connectMultiplexed(BridgeZmqContext *context, int port) {
+  sock = zmq_socket(context->getRawContext(), ZMQ_XPUB);
+  if (sock == nullptr) {
+    return -1;
+  }
+
+  full_endpoint = "tcp://*:" + std::to_string(port);
+  pid = getpid();
+  return zmq_bind(sock, full_endpoint.c_str());
+}
+
 int BridgeZmqPubSocket::sendMessage(Message *message) {
   assert(pid == getpid());
   return zmq_send(sock, message->getData(), message->getSize(), ZMQ_DONTWAIT);
@@ -137,6 +226,35 @@ int BridgeZmqPubSocket::send(char *data, size_t size) {
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+int BridgeZmqPubSocket::sendMultiplexed(uint32_t service_id, char *data, size_t size) {
+  assert(pid == getpid());
+  // ZMQ sends multipart messages atomically, so the payload can't be separated from its id
+  if (zmq_send(sock, &service_id, sizeof(service_id), ZMQ_DONTWAIT | ZMQ_SNDMORE) == -1) {
+    return -1;
+  }
+  int rc;
+  do {
+    rc = zmq_send(sock, data, size, ZMQ_DONTWAIT);
+  } while (rc == -1 && errno == EINTR);
+  return rc;
+}
+
+bool BridgeZmqPubSocket::receiveSubscription(bool *subscribe, std::string *topic) {
+  zmq_msg_t msg;
+  assert(zmq_msg_init(&msg) == 0);
+
+  int rc = zmq_msg_recv(&msg, sock, ZMQ_DONTWAIT);
+  bool ret = rc > 0;
+  if (ret) {
+    const char *data = (const char *)zmq_msg_data(&msg);
+    *subscribe = data[0] == 1;
+    topic->assign(data + 1, rc - 1);
+  }
+
+  zmq_msg_close(&msg);
+  return ret;
+}
+
 BridgeZmqPubSocket::~BridgeZmqPubSocket() {
   if (sock != nullptr) {
     zmq_close(sock);
@@ -168,3 +286,37 @@ std::vector<BridgeZmqSubSocket *> BridgeZmqPoller::poll(int timeout) {
 
   return ret;
 }
+
+void BridgeZmqBatch::add(const char *data, size_t size) {
+  if (buf.empty()) {
+    buf.resize(2 * sizeof(uint32_t));
+    memcpy(buf.data(), &BRIDGE_BATCH_MAGIC, sizeof(uint32_t));
+  }
+  uint32_t sz = size;
+  buf.insert(buf.end(), (const char *)&sz, (const char *)&sz + sizeof(sz));
+  buf.insert(buf.end(), data, data + size);
+  ++count;
+  memcpy(buf.data() + sizeof(uint32_t), &count, sizeof(uint32_t));
+}
+
+bool bridge_zmq_unbatch(char *data, size_t size, const std::function<void(char *data, size_t size)> &f) {
+  uint32_t magic = 0, count = 0;
+  if (size >= 2 * sizeof(uint32_t)) memcpy(&magic, data, sizeof(uint32_t));
+  if (magic != BRIDGE_BATCH_MAGIC) {
+    f(data, size);
+    return true;
+  }
+
+  memcpy(&count, data + sizeof(uint32_t), sizeof(uint32_t));
+  size_t pos = 2 * sizeof(uint32_t);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t sz = 0;
+    if (pos + sizeof(sz) > size) return false;
+    memcpy(&sz, data + pos, sizeof(sz));
+    pos += sizeof(sz);
+    if (pos + sz > size) return false;
+    f(data + pos, sz);
+    pos += sz;
+  }
+  return true;
+}
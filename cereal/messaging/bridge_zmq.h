@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -32,11 +34,27 @@ private:
   size_t size = 0;
 };
 
+// Multiplexed mode: instead of one hashed port per service, all services share BRIDGE_MUX_PORT and each
+// message is sent as two frames, the uint32 service id followed by the payload. Service ids are a hash of the
+// service name only, so both ends agree on them even if their service lists differ, and the receiver drops ids
+// it doesn't know. Heavy services can be sharded onto one of BRIDGE_MUX_SHARD_PORTS dedicated ports after
+// BRIDGE_MUX_PORT, so one big stream can't head-of-line block the small ones.
+constexpr int BRIDGE_MUX_PORT = 7800;
+constexpr int BRIDGE_MUX_SHARD_PORTS = 16;
+
+int bridge_service_id(const std::string &name);  // -1 for unknown services
+inline int bridge_mux_port(uint32_t service_id, bool sharded) {
+  return sharded ? BRIDGE_MUX_PORT + 1 + service_id % BRIDGE_MUX_SHARD_PORTS : BRIDGE_MUX_PORT;
+}
+
 class BridgeZmqSubSocket {
 public:
   int connect(BridgeZmqContext *context, std::string endpoint, std::string address, bool conflate = false, bool check_endpoint = true);
+  // subscribes to the given service ids on a multiplexed endpoint
+  int connectMultiplexed(BridgeZmqContext *context, std::string address, int port, const std::vector<uint32_t> &service_ids);
   void setTimeout(int timeout);
   Message *receive(bool non_blocking = false);
+  Message *receiveMultiplexed(uint32_t *service_id, bool non_blocking = false);
   void *getRawSocket() { return sock; }
   ~BridgeZmqSubSocket();
 
@@ -48,8 +66,13 @@ private:
 class BridgeZmqPubSocket {
 public:
   int connect(BridgeZmqContext *context, std::string endpoint, bool check_endpoint = true);
+  // binds an XPUB socket, which reports the service ids subscribers ask for through receiveSubscription()
+  int connectMultiplexed(BridgeZmqContext *context, int port);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int sendMultiplexed(uint32_t service_id, char *data, size_t size);
+  // returns false if no subscription message is pending. an empty topic subscribes to everything.
+  bool receiveSubscription(bool *subscribe, std::string *topic);
   void *getRawSocket() { return sock; }
   ~BridgeZmqPubSocket();
 
@@ -59,6 +82,27 @@ private:
   int pid = -1;
 };
 
+// Batched framing packs several messages into one ZMQ frame: [BRIDGE_BATCH_MAGIC][count] followed by
+// [size][data] for each message, all integers uint32. The magic is never a valid capnp segment count,
+// so receivers can tell batched and plain frames apart without any configuration.
+constexpr uint32_t BRIDGE_BATCH_MAGIC = 0xba7c4ed0;
+
+class BridgeZmqBatch {
+public:
+  void add(const char *data, size_t size);
+  void clear() { buf.clear(); count = 0; }
+  bool empty() const { return count == 0; }
+  size_t size() const { return buf.size(); }
+  char *data() { return buf.data(); }
+
+private:
+  std::vector<char> buf;
+  uint32_t count = 0;
+};
+
+// Calls f for every message in a received frame, batched or not. Returns false if a batch is truncated.
+bool bridge_zmq_unbatch(char *data, size_t size, const std::function<void(char *data, size_t size)> &f);
+
 class BridgeZmqPoller {
 public:
   void registerSocket(BridgeZmqSubSocket *socket);
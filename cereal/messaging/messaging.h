@@ -1,8 +1,14 @@
 #pragma once
 
+#include <bitset>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <map>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
@@ -14,6 +20,15 @@
 
 class SubMaster {
 public:
+  static constexpr size_t MAX_SERVICES = 256;
+  // dense index of a service within this SubMaster. resolve it once with handle() and use it on hot paths
+  // instead of the name, which costs a map lookup on every call.
+  struct Handle { uint16_t idx; };
+  class Mask {
+    std::bitset<MAX_SERVICES> bits_;
+    friend class SubMaster;
+  };
+
   SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll = {},
             const char *address = nullptr, const std::vector<const char *> &ignore_alive = {});
   void update(int timeout = 1000);
@@ -21,28 +36,52 @@ public:
   inline bool allAlive(const std::vector<const char *> &service_list = {}) { return all_(service_list, false, true); }
   inline bool allValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, false); }
   inline bool allAliveAndValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, true); }
+  inline bool allAlive(const Mask &mask) const { return all_(mask.bits_, false, true); }
+  inline bool allValid(const Mask &mask) const { return all_(mask.bits_, true, false); }
+  inline bool allAliveAndValid(const Mask &mask) const { return all_(mask.bits_, true, true); }
   void drain();
   ~SubMaster();
 
   uint64_t frame = 0;
-  bool updated(const char *name) const;
-  bool alive(const char *name) const;
-  bool valid(const char *name) const;
-  uint64_t rcv_frame(const char *name) const;
-  uint64_t rcv_time(const char *name) const;
-  cereal::Event::Reader &operator[](const char *name) const;
+  Handle handle(const char *name) const;
+  Mask mask(std::initializer_list<Handle> handles) const;
+
+  inline bool updated(Handle h) const { return updated_[h.idx]; }
+  inline bool alive(Handle h) const { return alive_[h.idx]; }
+  inline bool valid(Handle h) const { return valid_[h.idx]; }
+  uint64_t rcv_frame(Handle h) const;
+  uint64_t rcv_time(Handle h) const;
+  cereal::Event::Reader &operator[](Handle h) const;
+
+  inline bool updated(const char *name) const { return updated(handle(name)); }
+  inline bool alive(const char *name) const { return alive(handle(name)); }
+  inline bool valid(const char *name) const { return valid(handle(name)); }
+  inline uint64_t rcv_frame(const char *name) const { return rcv_frame(handle(name)); }
+  inline uint64_t rcv_time(const char *name) const { return rcv_time(handle(name)); }
+  inline cereal::Event::Reader &operator[](const char *name) const { return (*this)[handle(name)]; }
 
 private:
-  bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
+  bool all_(const std::vector<const char *> &service_list, bool valid, bool alive) const;
+  inline bool all_(const std::bitset<MAX_SERVICES> &mask, bool valid, bool alive) const {
+    std::bitset<MAX_SERVICES> ok = mask;
+    if (valid) ok &= valid_;
+    if (alive) ok &= (alive_ | ignore_alive_);
+    return ok == mask;
+  }
   Poller *poller_ = nullptr;
   struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  std::vector<SubMessage> messages_;
+  std::unordered_map<SubSocket *, uint16_t> sockets_;
+  std::unordered_map<std::string_view, uint16_t> services_;  // views the names in messages_, which never reallocates
+  std::bitset<MAX_SERVICES> all_services_, updated_, alive_, valid_, ignore_alive_;
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // build into a caller-owned, zero-initialized first segment instead of a malloc'd one.
+  // capnp zeroes the used space again on destruction, so the same segment can back the next builder.
+  explicit MessageBuilder(kj::ArrayPtr<capnp::word> first_segment) : capnp::MallocMessageBuilder(first_segment) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -72,15 +111,69 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// MessageBuilder for high-rate publishers that is reused across messages instead of constructed per message.
+// reset() hands out an empty builder whose first segment is an arena that grows to the largest message built
+// so far, and toBytes() serializes into a reused buffer, so neither allocates once the high-water mark is reached.
+class ReusableMessageBuilder {
+public:
+  ReusableMessageBuilder(size_t initial_words = 1024) { resizeArena(initial_words); }
+
+  // invalidates any builders/readers obtained from the previous message
+  MessageBuilder &reset() {
+    if (msg_) {
+      size_t high_water = msg_->allocated_words;
+      msg_.reset();  // zeroes the used part of the arena for the next message
+      if (high_water > arena_.size()) resizeArena(high_water);
+    }
+    return msg_.emplace(arena_);
+  }
+
+  kj::ArrayPtr<capnp::byte> toBytes() {
+    assert(msg_);
+    size_t words = capnp::computeSerializedSizeInWords(*msg_);
+    if (bytes_.size() < words) bytes_ = kj::heapArray<capnp::word>(words);
+    auto bytes = bytes_.slice(0, words).asBytes();
+    kj::ArrayOutputStream out(bytes);
+    capnp::writeMessage(out, *msg_);
+    return bytes;
+  }
+
+  // segments of the current message that didn't fit the arena and were malloc'd
+  inline size_t heapSegments() const { return msg_ && msg_->allocated_segments > 1 ? msg_->allocated_segments - 1 : 0; }
+
+private:
+  // counts the words capnp asks for, so referenced external data doesn't grow the arena
+  struct CountingBuilder : public MessageBuilder {
+    using MessageBuilder::MessageBuilder;
+    kj::ArrayPtr<capnp::word> allocateSegment(unsigned int minimum_size) override {
+      auto segment = MessageBuilder::allocateSegment(minimum_size);
+      allocated_words += segment.size();
+      ++allocated_segments;  // the first one is the arena
+      return segment;
+    }
+    size_t allocated_words = 0, allocated_segments = 0;
+  };
+
+  void resizeArena(size_t words) {
+    arena_ = kj::heapArray<capnp::word>(words);
+    memset(arena_.begin(), 0, arena_.asBytes().size());
+  }
+
+  kj::Array<capnp::word> arena_, bytes_;
+  std::optional<CountingBuilder> msg_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
   inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
+  // serializes into a scratch buffer owned by this PubMaster, so it must not be called concurrently
   int send(const char *name, MessageBuilder &msg);
   ~PubMaster();
 
 private:
   std::map<std::string, PubSocket *> sockets_;
+  kj::Array<capnp::word> send_buf_;
 };
 
 class AlignedBuffer {
@@ -96,6 +189,17 @@ public:
   inline kj::ArrayPtr<const capnp::word> align(Message *m) {
     return align(m->getData(), m->getSize());
   }
+  // zero-copy: returns a view over data if it's already word-aligned, otherwise falls back to align().
+  // the returned array is only valid as long as data is.
+  kj::ArrayPtr<const capnp::word> view(const char *data, const size_t size) {
+    if (reinterpret_cast<uintptr_t>(data) % alignof(capnp::word) == 0 && size % sizeof(capnp::word) == 0) {
+      return kj::ArrayPtr<const capnp::word>(reinterpret_cast<const capnp::word *>(data), size / sizeof(capnp::word));
+    }
+    return align(data, size);
+  }
+  inline kj::ArrayPtr<const capnp::word> view(Message *m) {
+    return view(m->getData(), m->getSize());
+  }
 private:
   kj::Array<capnp::word> aligned_buf;
   size_t words_size;
@@ -1,14 +1,20 @@
 #include "cereal/messaging/msgq_to_zmq.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #include "cereal/services.h"
+#include "common/timing.h"
 #include "common/util.h"
 
 extern ExitHandler do_exit;
 
 // Max messages to process per socket per poll
 constexpr int MAX_MESSAGES_PER_SOCKET = 50;
+// Batches are sent early once they reach this size
+constexpr size_t MAX_BATCH_SIZE = 1024 * 1024;
+constexpr int MAX_POLL_TIMEOUT = 100;
 
 static std::string recv_zmq_msg(void *sock) {
   zmq_msg_t msg;
@@ -26,44 +32,79 @@ void MsgqToZmq::run(const std::vector<std::string> &endpoints, const std::string
   msgq_context = std::make_unique<Context>();
 
   // Create ZMQPubSockets for each endpoint
+  std::map<int, BridgeZmqPubSocket *> mux_socks;  // by port
   for (const auto &endpoint : endpoints) {
     auto &socket_pair = socket_pairs.emplace_back();
     socket_pair.endpoint = endpoint;
-    socket_pair.pub_sock = std::make_unique<BridgeZmqPubSocket>();
-    int ret = socket_pair.pub_sock->connect(zmq_context.get(), endpoint);
-    if (ret != 0) {
-      printf("Failed to create ZMQ publisher for [%s]: %s\n", endpoint.c_str(), zmq_strerror(zmq_errno()));
-      return;
+    socket_pair.service_id = bridge_service_id(endpoint);
+    socket_pair.conflate = conflate_services.count(endpoint) > 0;
+    if (multiplexed) {
+      int port = bridge_mux_port(socket_pair.service_id, sharded_services.count(endpoint) > 0);
+      auto &sock = mux_socks[port];
+      if (!sock) sock = createPubSocket(endpoint, port);
+      socket_pair.pub_sock = sock;
+    } else {
+      socket_pair.pub_sock = createPubSocket(endpoint, -1);
     }
+    if (!socket_pair.pub_sock) return;
   }
 
-  // Start ZMQ monitoring thread to monitor socket events
-  std::thread thread(&MsgqToZmq::zmqMonitorThread, this);
+  msgq_poller = std::make_unique<MSGQPoller>();
+
+  // Start ZMQ monitoring thread to monitor socket events. Multiplexed sockets report subscriptions instead.
+  std::thread thread;
+  if (!multiplexed) {
+    thread = std::thread(&MsgqToZmq::zmqMonitorThread, this);
+  }
 
   // Main loop for processing messages
   while (!do_exit) {
-    {
-      std::unique_lock lk(mutex);
-      cv.wait(lk, [this]() { return do_exit || !sub2pub.empty(); });
-      if (do_exit) break;
-
-      for (auto sub_sock : msgq_poller->poll(100)) {
-        // Process messages for each socket
-        BridgeZmqPubSocket *pub_sock = sub2pub.at(sub_sock);
-        for (int i = 0; i < MAX_MESSAGES_PER_SOCKET; ++i) {
-          auto msg = std::unique_ptr<Message>(sub_sock->receive(true));
-          if (!msg) break;
-
-          while (pub_sock->sendMessage(msg.get()) == -1) {
-            if (errno != EINTR) break;
-          }
+    if (multiplexed) {
+      pollSubscriptions(sub2pair.empty() ? MAX_POLL_TIMEOUT : 0);
+    }
+    if (subscribers_changed.exchange(false)) {
+      updateSubscribers();
+    }
+
+    if (sub2pair.empty()) {
+      if (!multiplexed) {
+        std::unique_lock lk(mutex);
+        cv.wait(lk, [this]() { return do_exit || subscribers_changed; });
+      }
+      continue;
+    }
+
+    for (auto sub_sock : msgq_poller->poll(pollTimeout(nanos_since_boot()))) {
+      // Process messages for each socket
+      SocketPair *pair = sub2pair.at(sub_sock);
+      std::unique_ptr<Message> latest;
+      for (int i = 0; i < MAX_MESSAGES_PER_SOCKET; ++i) {
+        auto msg = std::unique_ptr<Message>(sub_sock->receive(true));
+        if (!msg) break;
+
+        if (pair->conflate) {
+          latest = std::move(msg);
+        } else {
+          forward(*pair, msg.get());
         }
       }
+      if (latest) forward(*pair, latest.get());
     }
-    util::sleep_for(1);  // Give zmqMonitorThread a chance to acquire the mutex
+    flushBatches(nanos_since_boot());
   }
 
-  thread.join();
+  if (thread.joinable()) thread.join();
+}
+
+BridgeZmqPubSocket *MsgqToZmq::createPubSocket(const std::string &endpoint, int mux_port) {
+  auto &sock = pub_socks.emplace_back(std::make_unique<BridgeZmqPubSocket>());
+  int ret = multiplexed ? sock->connectMultiplexed(zmq_context.get(), mux_port)
+                        : sock->connect(zmq_context.get(), endpoint);
+  if (ret != 0) {
+    printf("Failed to create ZMQ publisher for [%s]: %s\n", endpoint.c_str(), zmq_strerror(zmq_errno()));
+    return nullptr;
+  }
+  return sock.get();
 }
 
 void MsgqToZmq::zmqMonitorThread() {
@@ -102,26 +143,17 @@ void MsgqToZmq::zmqMonitorThread() {
         frame = recv_zmq_msg(pollitems[i].socket);
         if (frame.empty()) continue;
 
-        std::unique_lock lk(mutex);
         auto &pair = socket_pairs[i];
         if (event_type & ZMQ_EVENT_ACCEPTED) {
           printf("socket [%s] connected\n", pair.endpoint.c_str());
-          if (++pair.connected_clients == 1) {
-            // Create new MSGQ subscriber socket and map to ZMQ publisher
-            pair.sub_sock = std::make_unique<MSGQSubSocket>();
-            size_t queue_size = services.at(pair.endpoint).queue_size;
-            pair.sub_sock->connect(msgq_context.get(), pair.endpoint, "127.0.0.1", false, true, queue_size);
-            sub2pub[pair.sub_sock.get()] = pair.pub_sock.get();
-            registerSockets();
-          }
+          ++pair.connected_clients;
         } else if (event_type & ZMQ_EVENT_DISCONNECTED) {
           printf("socket [%s] disconnected\n", pair.endpoint.c_str());
-          if (pair.connected_clients == 0 || --pair.connected_clients == 0) {
-            // Remove MSGQ subscriber socket from mapping and reset it
-            sub2pub.erase(pair.sub_sock.get());
-            pair.sub_sock.reset(nullptr);
-            registerSockets();
-          }
+          if (pair.connected_clients > 0) --pair.connected_clients;
+        }
+        {
+          std::lock_guard lk(mutex);
+          subscribers_changed = true;
         }
         cv.notify_one();
       }
@@ -136,6 +168,61 @@ void MsgqToZmq::zmqMonitorThread() {
   cv.notify_one();
 }
 
+void MsgqToZmq::pollSubscriptions(int timeout) {
+  auto &pollitems = subscription_pollitems;
+  if (pollitems.size() != pub_socks.size()) {
+    pollitems.clear();
+    for (auto &sock : pub_socks) {
+      pollitems.push_back(zmq_pollitem_t{.socket = sock->getRawSocket(), .events = ZMQ_POLLIN});
+    }
+  }
+  if (zmq_poll(pollitems.data(), pollitems.size(), timeout) <= 0) return;
+
+  bool subscribe;
+  std::string topic;
+  for (int i = 0; i < pollitems.size(); ++i) {
+    if (!(pollitems[i].revents & ZMQ_POLLIN)) continue;
+
+    BridgeZmqPubSocket *sock = pub_socks[i].get();
+    while (sock->receiveSubscription(&subscribe, &topic)) {
+      // XPUB only reports the first subscription and the last unsubscription of a topic
+      for (auto &pair : socket_pairs) {
+        if (pair.pub_sock != sock) continue;
+        uint32_t id = pair.service_id;
+        if (topic.empty() || (topic.size() == sizeof(id) && memcmp(topic.data(), &id, sizeof(id)) == 0)) {
+          printf("service [%s] %s\n", pair.endpoint.c_str(), subscribe ? "subscribed" : "unsubscribed");
+          pair.connected_clients = subscribe ? 1 : 0;
+          subscribers_changed = true;
+        }
+      }
+    }
+  }
+}
+
+void MsgqToZmq::updateSubscribers() {
+  bool removed = false;
+  for (auto &pair : socket_pairs) {
+    bool active = pair.connected_clients > 0;
+    if (active && !pair.sub_sock) {
+      // Create new MSGQ subscriber socket and map to ZMQ publisher
+      pair.sub_sock = std::make_unique<MSGQSubSocket>();
+      size_t queue_size = services.at(pair.endpoint).queue_size;
+      pair.sub_sock->connect(msgq_context.get(), pair.endpoint, "127.0.0.1", false, true, queue_size);
+      sub2pair[pair.sub_sock.get()] = &pair;
+      msgq_poller->registerSocket(pair.sub_sock.get());
+    } else if (!active && pair.sub_sock) {
+      // Remove MSGQ subscriber socket from mapping and reset it
+      sub2pair.erase(pair.sub_sock.get());
+      pair.sub_sock.reset(nullptr);
+      pair.batch.clear();
+      removed = true;
+    }
+  }
+
+  // MSGQPoller can't unregister sockets, so only rebuild it when one went away
+  if (removed) registerSockets();
+}
+
 void MsgqToZmq::registerSockets() {
   msgq_poller = std::make_unique<MSGQPoller>();
   for (const auto &socket_pair : socket_pairs) {
@@ -144,3 +231,51 @@ void MsgqToZmq::registerSockets() {
     }
   }
 }
+
+void MsgqToZmq::send(SocketPair &pair, char *data, size_t size) {
+  if (multiplexed) {
+    pair.pub_sock->sendMultiplexed(pair.service_id, data, size);
+    return;
+  }
+  while (pair.pub_sock->send(data, size) == -1) {
+    if (errno != EINTR) break;
+  }
+}
+
+void MsgqToZmq::forward(SocketPair &pair, Message *msg) {
+  if (batch_budget_ns == 0) {
+    send(pair, msg->getData(), msg->getSize());
+    return;
+  }
+
+  // a conflated batch only keeps the latest message, but it's still due when its first one came in
+  if (pair.batch.empty()) pair.batch_start = nanos_since_boot();
+  if (pair.conflate) pair.batch.clear();
+  pair.batch.add(msg->getData(), msg->getSize());
+  if (pair.batch.size() >= MAX_BATCH_SIZE) {
+    send(pair, pair.batch.data(), pair.batch.size());
+    pair.batch.clear();
+  }
+}
+
+void MsgqToZmq::flushBatches(uint64_t current_time) {
+  for (auto &pair : socket_pairs) {
+    if (!pair.batch.empty() && current_time - pair.batch_start >= batch_budget_ns) {
+      send(pair, pair.batch.data(), pair.batch.size());
+      pair.batch.clear();
+    }
+  }
+}
+
+int MsgqToZmq::pollTimeout(uint64_t current_time) {
+  // wake up in time to send the oldest pending batch within its latency budget
+  int timeout = MAX_POLL_TIMEOUT;
+  for (const auto &pair : socket_pairs) {
+    if (!pair.batch.empty()) {
+      uint64_t deadline = pair.batch_start + batch_budget_ns;
+      int remaining = deadline > current_time ? (deadline - current_time + 999999) / 1000000 : 0;
+      timeout = std::min(timeout, remaining);
+    }
+  }
+  return timeout;
+}
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -12,25 +15,52 @@
 
 class MsgqToZmq {
 public:
-  MsgqToZmq() {}
+  // batch_ms > 0 packs the messages of each service into one ZMQ frame per batch_ms, see BridgeZmqBatch.
+  // services in conflate only forward the latest message available when they're read.
+  // multiplexed publishes all services on BRIDGE_MUX_PORT, except the sharded ones which go on a shard port.
+  MsgqToZmq(float batch_ms = 0, const std::set<std::string> &conflate = {},
+            bool multiplexed = false, const std::set<std::string> &sharded = {})
+      : batch_budget_ns(batch_ms * 1e6), conflate_services(conflate), multiplexed(multiplexed), sharded_services(sharded) {}
   void run(const std::vector<std::string> &endpoints, const std::string &ip);
 
 protected:
+  struct SocketPair;
+  BridgeZmqPubSocket *createPubSocket(const std::string &endpoint, int mux_port);
   void registerSockets();
+  void updateSubscribers();
   void zmqMonitorThread();
+  void pollSubscriptions(int timeout);
+  void forward(SocketPair &pair, Message *msg);
+  void send(SocketPair &pair, char *data, size_t size);
+  void flushBatches(uint64_t current_time);
+  int pollTimeout(uint64_t current_time);
 
   struct SocketPair {
     std::string endpoint;
-    std::unique_ptr<BridgeZmqPubSocket> pub_sock;
+    uint32_t service_id = 0;
+    BridgeZmqPubSocket *pub_sock = nullptr;  // shared by all services on the same port in multiplexed mode
     std::unique_ptr<MSGQSubSocket> sub_sock;
-    int connected_clients = 0;
+    std::atomic<int> connected_clients = 0;  // written by the monitor thread only
+    bool conflate = false;
+    BridgeZmqBatch batch;
+    uint64_t batch_start = 0;
   };
 
+  const uint64_t batch_budget_ns;
+  const std::set<std::string> conflate_services;
+  const bool multiplexed;
+  const std::set<std::string> sharded_services;
+
   std::unique_ptr<Context> msgq_context;
   std::unique_ptr<BridgeZmqContext> zmq_context;
+  // the monitor thread only updates connected_clients and raises subscribers_changed, the main loop applies
+  // the changes between polls. mutex/cv are only used to sleep while no client is connected.
+  std::atomic<bool> subscribers_changed = false;
   std::mutex mutex;
   std::condition_variable cv;
   std::unique_ptr<MSGQPoller> msgq_poller;
-  std::map<SubSocket *, BridgeZmqPubSocket *> sub2pub;
-  std::vector<SocketPair> socket_pairs;
+  std::map<SubSocket *, SocketPair *> sub2pair;
+  std::deque<SocketPair> socket_pairs;
+  std::vector<std::unique_ptr<BridgeZmqPubSocket>> pub_socks;
+  std::vector<zmq_pollitem_t> subscription_pollitems;
 };
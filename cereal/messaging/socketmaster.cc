@@ -1,7 +1,9 @@
 #include <assert.h>
 #include <stdlib.h>
-#include <string>
+#include <algorithm>
 #include <mutex>
+#include <stdexcept>
+#include <string>
 
 #include "cereal/services.h"
 #include "cereal/messaging/messaging.h"
@@ -34,18 +36,20 @@ struct SubMaster::SubMessage {
   std::string name;
   SubSocket *socket = nullptr;
   float freq = 0.0f;
-  bool updated = false, alive = false, valid = false, ignore_alive;
   uint64_t rcv_time = 0, rcv_frame = 0;
   void *allocated_msg_reader = nullptr;
   bool is_polled = false;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
+  Message *msg = nullptr;  // backs msg_reader when received data is word-aligned
   AlignedBuffer aligned_buf;
-  cereal::Event::Reader event;
+  mutable cereal::Event::Reader event;
 };
 
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll,
                      const char *address, const std::vector<const char *> &ignore_alive) {
+  assert(service_list.size() <= MAX_SERVICES);
   poller_ = Poller::create();
+  messages_.reserve(service_list.size());
   for (auto name : service_list) {
     assert(services.count(std::string(name)) > 0);
 
@@ -54,29 +58,29 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
     assert(socket != 0);
     bool is_polled = inList(poll, name) || poll.empty();
     if (is_polled) poller_->registerSocket(socket);
-    SubMessage *m = new SubMessage{
+    uint16_t idx = messages_.size();
+    SubMessage &m = messages_.emplace_back(SubMessage{
       .name = name,
       .socket = socket,
       .freq = serv.frequency,
-      .ignore_alive = inList(ignore_alive, name),
       .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader)),
-      .is_polled = is_polled};
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
-    services_[name] = m;
+      .is_polled = is_polled});
+    m.msg_reader = new (m.allocated_msg_reader) capnp::FlatArrayMessageReader({});
+    sockets_[socket] = idx;
+    services_[m.name] = idx;
+    all_services_.set(idx);
+    ignore_alive_.set(idx, inList(ignore_alive, name));
   }
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  updated_.reset();
 
   auto sockets = poller_->poll(timeout);
 
   // add non-polled sockets for non-blocking receive
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    SubSocket *s = kv.first;
-    if (!m->is_polled) sockets.push_back(s);
+  for (auto &m : messages_) {
+    if (!m.is_polled) sockets.push_back(m.socket);
   }
 
   uint64_t current_time = nanos_since_boot();
@@ -87,13 +91,15 @@ void SubMaster::update(int timeout) {
     Message *msg = s->receive(true);
     if (msg == nullptr) continue;
 
-    SubMessage *m = messages_.at(s);
+    SubMessage *m = &messages_[sockets_.at(s)];
 
     m->msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
+    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.view(msg), options);
+    // keep the message alive until the next one arrives, the reader may point into it
+    delete m->msg;
+    m->msg = msg;
     messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
   }
 
@@ -108,32 +114,34 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
     if (m_find == services_.end()){
       continue;
     }
-    SubMessage *m = m_find->second;
+    uint16_t idx = m_find->second;
+    SubMessage *m = &messages_[idx];
     m->event = kv.second;
-    m->updated = true;
     m->rcv_time = current_time;
     m->rcv_frame = frame;
-    m->valid = m->event.getValid();
-    if (SIMULATION) m->alive = true;
+    updated_.set(idx);
+    valid_.set(idx, m->event.getValid());
+    if (SIMULATION) alive_.set(idx);
   }
 
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
-      m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
+    for (size_t i = 0; i < messages_.size(); ++i) {
+      const SubMessage &m = messages_[i];
+      alive_.set(i, m.freq <= (1e-5) || ((current_time - m.rcv_time) * (1e-9)) < (10.0 / m.freq));
     }
   }
 }
 
-bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
-  int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
-      found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
-    }
+bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) const {
+  if (service_list.empty()) return all_(all_services_, valid, alive);
+
+  Mask m;
+  for (auto name : service_list) {
+    auto it = services_.find(name);
+    if (it == services_.end()) return false;
+    m.bits_.set(it->second);
   }
-  return service_list.size() == 0 ? found == messages_.size() : found == service_list.size();
+  return all_(m.bits_, valid, alive);
 }
 
 void SubMaster::drain() {
@@ -149,38 +157,37 @@ void SubMaster::drain() {
   }
 }
 
-bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
+SubMaster::Handle SubMaster::handle(const char *name) const {
+  auto it = services_.find(name);
+  if (it == services_.end()) throw std::out_of_range(std::string("SubMaster: unknown service ") + name);
+  return {it->second};
 }
 
-bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
+SubMaster::Mask SubMaster::mask(std::initializer_list<Handle> handles) const {
+  Mask m;
+  for (auto h : handles) m.bits_.set(h.idx);
+  return m;
 }
 
-bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
+uint64_t SubMaster::rcv_frame(Handle h) const {
+  return messages_[h.idx].rcv_frame;
 }
 
-uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
+uint64_t SubMaster::rcv_time(Handle h) const {
+  return messages_[h.idx].rcv_time;
 }
 
-uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
-}
-
-cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
+cereal::Event::Reader &SubMaster::operator[](Handle h) const {
+  return messages_[h.idx].event;
 }
 
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    m->msg_reader->~FlatArrayMessageReader();
-    free(m->allocated_msg_reader);
-    delete m->socket;
-    delete m;
+  for (auto &m : messages_) {
+    m.msg_reader->~FlatArrayMessageReader();
+    free(m.allocated_msg_reader);
+    delete m.msg;
+    delete m.socket;
   }
 }
 
@@ -195,7 +202,13 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
 }
 
 int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
+  size_t words = capnp::computeSerializedSizeInWords(msg);
+  if (send_buf_.size() < words) {
+    send_buf_ = kj::heapArray<capnp::word>(std::max<size_t>(words, 512));
+  }
+  auto bytes = send_buf_.slice(0, words).asBytes();
+  kj::ArrayOutputStream output_stream(bytes);
+  capnp::writeMessage(output_stream, msg);
   return send(name, bytes.begin(), bytes.size());
 }
 
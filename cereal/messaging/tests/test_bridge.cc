@@ -0,0 +1,199 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+#include <unistd.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/bridge_zmq.h"
+#include "cereal/messaging/msgq_to_zmq.h"
+#include "cereal/services.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+ExitHandler do_exit;
+
+// ports of this process, so parallel test runs don't collide
+static int test_port(int n) {
+  return 20000 + getpid() % 10000 * 4 + n;
+}
+
+TEST_CASE("BridgeZmqBatch") {
+  std::vector<std::string> msgs = {std::string(8, 'a'), std::string(1024, 'b'), std::string(16, 'c')};
+  BridgeZmqBatch batch;
+  for (auto &m : msgs) batch.add(m.data(), m.size());
+
+  SECTION("unbatch returns every message in order") {
+    std::vector<std::string> out;
+    REQUIRE(bridge_zmq_unbatch(batch.data(), batch.size(), [&](char *data, size_t size) { out.emplace_back(data, size); }));
+    REQUIRE(out == msgs);
+  }
+  SECTION("plain frames pass through") {
+    std::vector<std::string> out;
+    REQUIRE(bridge_zmq_unbatch(msgs[1].data(), msgs[1].size(), [&](char *data, size_t size) { out.emplace_back(data, size); }));
+    REQUIRE(out == std::vector<std::string>{msgs[1]});
+  }
+  SECTION("truncated batches are rejected") {
+    int count = 0;
+    REQUIRE(!bridge_zmq_unbatch(batch.data(), batch.size() - 1, [&](char *, size_t) { ++count; }));
+    REQUIRE(count == 2);
+  }
+}
+
+static int receive_all(BridgeZmqSubSocket &sub, int count) {
+  int received = 0;
+  while (received < count) {
+    std::unique_ptr<Message> msg(sub.receive());
+    if (!msg) break;
+    bridge_zmq_unbatch(msg->getData(), msg->getSize(), [&](char *, size_t) { ++received; });
+  }
+  return received;
+}
+
+TEST_CASE("bridge loopback", "[.benchmark]") {
+  const int count = 200;
+  const int batch_size = 50;
+  auto size = GENERATE(64, 1024, 16 * 1024);
+  std::vector<char> payload(size, 'x');
+
+  BridgeZmqContext context;
+  BridgeZmqPubSocket pub;
+  BridgeZmqSubSocket sub;
+  const std::string port = std::to_string(test_port(0));
+  REQUIRE(pub.connect(&context, port, false) == 0);
+  REQUIRE(sub.connect(&context, port, "127.0.0.1", false, false) == 0);
+  sub.setTimeout(1000);
+
+  // wait for the subscription to reach the publisher
+  bool connected = false;
+  for (int i = 0; i < 100 && !connected; ++i) {
+    pub.send(payload.data(), payload.size());
+    util::sleep_for(10);
+    connected = std::unique_ptr<Message>(sub.receive(true)) != nullptr;
+  }
+  REQUIRE(connected);
+  while (std::unique_ptr<Message>(sub.receive(true))) {}
+
+  BENCHMARK("latency " + std::to_string(size) + " bytes") {
+    pub.send(payload.data(), payload.size());
+    return receive_all(sub, 1);
+  };
+  BENCHMARK("unbatched " + std::to_string(count) + "x" + std::to_string(size) + " bytes") {
+    for (int i = 0; i < count; ++i) {
+      pub.send(payload.data(), payload.size());
+    }
+    return receive_all(sub, count);
+  };
+  BENCHMARK("batched " + std::to_string(count) + "x" + std::to_string(size) + " bytes") {
+    BridgeZmqBatch batch;
+    for (int i = 0; i < count; ++i) {
+      batch.add(payload.data(), payload.size());
+      if ((i + 1) % batch_size == 0) {
+        pub.send(batch.data(), batch.size());
+        batch.clear();
+      }
+    }
+    return receive_all(sub, count);
+  };
+}
+
+TEST_CASE("bridge_service_id") {
+  std::set<int> ids;
+  for (const auto &it : services) {
+    int id = bridge_service_id(it.first);
+    REQUIRE(id >= 0);
+    ids.insert(id);
+  }
+  REQUIRE(ids.size() == services.size());
+  REQUIRE(bridge_service_id("notAService") == -1);
+
+  // ids only depend on the name, so they stay the same across builds with different service lists
+  REQUIRE(bridge_service_id("carState") == 1205365618);
+  REQUIRE(bridge_service_id("roadEncodeData") == 1136737769);
+  REQUIRE(bridge_mux_port(bridge_service_id("roadEncodeData"), true) == BRIDGE_MUX_PORT + 1 + 9);
+  REQUIRE(bridge_mux_port(bridge_service_id("roadEncodeData"), false) == BRIDGE_MUX_PORT);
+}
+
+TEST_CASE("multiplexed endpoint") {
+  BridgeZmqContext context;
+  BridgeZmqPubSocket pub;
+  BridgeZmqSubSocket sub;
+  REQUIRE(pub.connectMultiplexed(&context, test_port(1)) == 0);
+  REQUIRE(sub.connectMultiplexed(&context, "127.0.0.1", test_port(1), {1, 3}) == 0);
+  sub.setTimeout(1000);
+
+  // the publisher sees which services are subscribed
+  std::set<std::string> topics;
+  bool subscribe = false;
+  std::string topic;
+  for (int i = 0; i < 100 && topics.size() < 2; ++i) {
+    while (pub.receiveSubscription(&subscribe, &topic)) {
+      if (subscribe) topics.insert(topic);
+    }
+    util::sleep_for(10);
+  }
+  REQUIRE(topics.size() == 2);
+
+  // only subscribed services are delivered, with their id
+  std::vector<std::string> payloads = {"one", "two", "three"};
+  for (uint32_t id = 1; id <= payloads.size(); ++id) {
+    REQUIRE(pub.sendMultiplexed(id, payloads[id - 1].data(), payloads[id - 1].size()) >= 0);
+  }
+  for (uint32_t expected : {1, 3}) {
+    uint32_t id = 0;
+    std::unique_ptr<Message> msg(sub.receiveMultiplexed(&id));
+    REQUIRE(msg);
+    REQUIRE(id == expected);
+    REQUIRE(std::string(msg->getData(), msg->getSize()) == payloads[id - 1]);
+  }
+  uint32_t id = 0;
+  REQUIRE(std::unique_ptr<Message>(sub.receiveMultiplexed(&id, true)) == nullptr);
+}
+
+class TestMsgqToZmq : public MsgqToZmq {
+public:
+  using MsgqToZmq::MsgqToZmq;
+  using MsgqToZmq::forward;
+  using MsgqToZmq::flushBatches;
+  using MsgqToZmq::socket_pairs;
+};
+
+TEST_CASE("conflated batches") {
+  BridgeZmqContext context;
+  BridgeZmqPubSocket pub;
+  BridgeZmqSubSocket sub;
+  const std::string port = std::to_string(test_port(2));
+  REQUIRE(pub.connect(&context, port, false) == 0);
+  REQUIRE(sub.connect(&context, port, "127.0.0.1", false, false) == 0);
+  sub.setTimeout(1000);
+  util::sleep_for(100);  // for the subscription to reach the publisher
+
+  // a conflated service that publishes every 2ms, with a 10ms budget
+  TestMsgqToZmq bridge(10, {"carState"});
+  auto &pair = bridge.socket_pairs.emplace_back();
+  pair.conflate = true;
+  pair.pub_sock = &pub;
+  for (int i = 0; i < 50; ++i) {
+    const std::string data = std::to_string(i);
+    BridgeZmqMessage msg;
+    msg.init((char *)data.data(), data.size());
+    bridge.forward(pair, &msg);
+    bridge.flushBatches(nanos_since_boot());
+    util::sleep_for(2);
+  }
+
+  // batches went out within their budget, each with only the latest message
+  util::sleep_for(100);
+  int batches = 0;
+  while (std::unique_ptr<Message> msg{sub.receive(true)}) {
+    std::vector<std::string> out;
+    REQUIRE(bridge_zmq_unbatch(msg->getData(), msg->getSize(), [&](char *data, size_t size) { out.emplace_back(data, size); }));
+    REQUIRE(out.size() == 1);
+    ++batches;
+  }
+  REQUIRE(batches > 0);
+}
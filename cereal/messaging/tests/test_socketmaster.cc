@@ -0,0 +1,195 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+
+static void build_can(MessageBuilder &msg, int frames) {
+  auto can = msg.initEvent().initCan(frames);
+  uint8_t dat[8] = {0xde, 0xad, 0xbe, 0xef, 0x01, 0x02, 0x03, 0x04};
+  for (int i = 0; i < frames; ++i) {
+    can[i].setAddress(i);
+    can[i].setSrc(i % 3);
+    can[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+  }
+}
+
+// serialize a can event with n frames into a heap buffer, like msgq hands it to SubSocket::receive
+struct EventData {
+  std::unique_ptr<char[]> buf;
+  size_t size;
+};
+
+static EventData can_event(int n) {
+  MessageBuilder msg;
+  build_can(msg, n);
+  auto bytes = msg.toBytes();
+  auto buf = std::make_unique<char[]>(bytes.size() + sizeof(capnp::word));
+  memcpy(buf.get(), bytes.begin(), bytes.size());
+  return {std::move(buf), bytes.size()};
+}
+
+static uint64_t read_event(kj::ArrayPtr<const capnp::word> words) {
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+  capnp::FlatArrayMessageReader reader(words, options);
+  auto can = reader.getRoot<cereal::Event>().getCan();
+  return can.size() > 0 ? can[can.size() - 1].getAddress() : 0;
+}
+
+TEST_CASE("AlignedBuffer::view") {
+  auto [buf, size] = can_event(10);
+  AlignedBuffer aligned_buf;
+
+  SECTION("aligned data is not copied") {
+    auto words = aligned_buf.view(buf.get(), size);
+    REQUIRE((const char *)words.begin() == buf.get());
+    REQUIRE(words.size() * sizeof(capnp::word) == size);
+    REQUIRE(read_event(words) == 9);
+  }
+  SECTION("misaligned data falls back to a copy") {
+    char *misaligned = buf.get() + 1;
+    memmove(misaligned, buf.get(), size);
+    auto words = aligned_buf.view(misaligned, size);
+    REQUIRE((const char *)words.begin() != misaligned);
+    REQUIRE(read_event(words) == 9);
+  }
+}
+
+TEST_CASE("SubMaster receive path", "[.benchmark]") {
+  auto frames = GENERATE(10, 100, 1000, 10000);
+  EventData event = can_event(frames);
+  const char *data = event.buf.get();
+  const size_t size = event.size;
+  AlignedBuffer aligned_buf;
+
+  BENCHMARK("copy " + std::to_string(size) + " bytes") {
+    return read_event(aligned_buf.align(data, size));
+  };
+  BENCHMARK("zero-copy " + std::to_string(size) + " bytes") {
+    return read_event(aligned_buf.view(data, size));
+  };
+}
+
+TEST_CASE("SubMaster handles") {
+  SubMaster sm({"carState", "controlsState", "liveParameters"}, {}, nullptr, {"liveParameters"});
+  auto car_state = sm.handle("carState");
+  auto controls_state = sm.handle("controlsState");
+  auto all = sm.mask({car_state, controls_state});
+  REQUIRE_THROWS_AS(sm.handle("modelV2"), std::out_of_range);
+
+  MessageBuilder msg;
+  msg.initEvent(true).initCarState().setVEgo(10.0f);
+  auto bytes = msg.toBytes();
+  capnp::FlatArrayMessageReader reader(kj::ArrayPtr<const capnp::word>((const capnp::word *)bytes.begin(), bytes.size() / sizeof(capnp::word)));
+  sm.update_msgs(nanos_since_boot(), {{"carState", reader.getRoot<cereal::Event>()}});
+
+  REQUIRE(sm.updated(car_state) == sm.updated("carState"));
+  REQUIRE(sm.updated(car_state));
+  REQUIRE(!sm.updated(controls_state));
+  REQUIRE(sm.valid(car_state));
+  REQUIRE(sm[car_state].getCarState().getVEgo() == 10.0f);
+  REQUIRE(sm.rcv_frame(car_state) == sm.frame);
+  REQUIRE(sm.allAliveAndValid(sm.mask({car_state})) == sm.allAliveAndValid({"carState"}));
+  REQUIRE(sm.allAliveAndValid(all) == sm.allAliveAndValid({"carState", "controlsState"}));
+  REQUIRE(!sm.allValid(all));
+  REQUIRE(!sm.allValid({"carState", "modelV2"}));
+}
+
+TEST_CASE("SubMaster lookups", "[.benchmark]") {
+  SubMaster sm({"carState", "controlsState", "liveParameters"}, {}, nullptr, {"liveParameters"});
+  auto car_state = sm.handle("carState");
+  auto all = sm.mask({car_state, sm.handle("controlsState")});
+
+  BENCHMARK("string lookups") {
+    return sm.updated("carState") && sm.allAliveAndValid({"carState", "controlsState"}) && sm["carState"].getValid();
+  };
+  BENCHMARK("handle lookups") {
+    return sm.updated(car_state) && sm.allAliveAndValid(all) && sm[car_state].getValid();
+  };
+}
+
+TEST_CASE("MessageBuilder reuses its first segment") {
+  auto segment = kj::heapArray<capnp::word>(1024);
+  memset(segment.begin(), 0, segment.asBytes().size());
+
+  for (int frames : {100, 10, 1000}) {
+    MessageBuilder msg(segment);
+    build_can(msg, frames);
+    std::vector<unsigned char> buf(msg.getSerializedSize());
+    REQUIRE(msg.serializeToBuffer(buf.data(), buf.size()) == buf.size());
+    REQUIRE(read_event(kj::ArrayPtr<const capnp::word>((const capnp::word *)buf.data(), buf.size() / sizeof(capnp::word))) == frames - 1);
+  }
+  auto bytes = segment.asBytes();
+  REQUIRE(std::all_of(bytes.begin(), bytes.end(), [](auto b) { return b == 0; }));
+}
+
+TEST_CASE("ReusableMessageBuilder") {
+  ReusableMessageBuilder builder(16);
+
+  SECTION("messages stay intact across resets") {
+    for (int frames : {1, 500, 10, 2000, 100}) {
+      build_can(builder.reset(), frames);
+      auto bytes = builder.toBytes();
+      REQUIRE(read_event(kj::ArrayPtr<const capnp::word>((const capnp::word *)bytes.begin(), bytes.size() / sizeof(capnp::word))) == frames - 1);
+    }
+  }
+  SECTION("arena grows to the high-water mark") {
+    MessageBuilder &first = builder.reset();
+    build_can(first, 2000);
+    REQUIRE(first.getSegmentsForOutput().size() > 1);
+    for (int i = 0; i < 3; ++i) {
+      MessageBuilder &msg = builder.reset();
+      build_can(msg, 2000);
+      REQUIRE(msg.getSegmentsForOutput().size() == 1);
+    }
+  }
+}
+
+// a MessageBuilder that counts the segments it mallocs
+struct SegmentCountingBuilder : public MessageBuilder {
+  kj::ArrayPtr<capnp::word> allocateSegment(unsigned int minimum_size) override {
+    ++segments;
+    return MessageBuilder::allocateSegment(minimum_size);
+  }
+  size_t segments = 0;
+};
+
+TEST_CASE("ReusableMessageBuilder per message", "[.benchmark]") {
+  auto frames = GENERATE(10, 100, 1000);
+  constexpr int n = 10000;
+  ReusableMessageBuilder builder(16);
+  std::vector<uint64_t> fresh_ns(n), reused_ns(n);
+  size_t fresh_mallocs = 0, reused_mallocs = 0;
+  for (int i = 0; i < n; ++i) {
+    uint64_t start = nanos_since_boot();
+    {
+      SegmentCountingBuilder msg;
+      build_can(msg, frames);
+      msg.toBytes();
+      fresh_mallocs += msg.segments + 1;  // and the array toBytes() returns
+    }
+    fresh_ns[i] = nanos_since_boot() - start;
+
+    start = nanos_since_boot();
+    build_can(builder.reset(), frames);
+    builder.toBytes();  // into a buffer that only grows with the high-water mark
+    reused_ns[i] = nanos_since_boot() - start;
+    reused_mallocs += builder.heapSegments();
+  }
+
+  auto percentile = [](std::vector<uint64_t> &ns, double p) {
+    std::sort(ns.begin(), ns.end());
+    return ns[size_t(p * (ns.size() - 1))] / 1e3;
+  };
+  printf("%d frames, %d messages\n", frames, n);
+  printf("  %-24s %10s %10s %10s\n", "", "mallocs", "p50 us", "p99 us");
+  printf("  %-24s %10.2f %10.2f %10.2f\n", "MessageBuilder", fresh_mallocs / double(n), percentile(fresh_ns, 0.5), percentile(fresh_ns, 0.99));
+  printf("  %-24s %10.2f %10.2f %10.2f\n", "ReusableMessageBuilder", reused_mallocs / double(n), percentile(reused_ns, 0.5), percentile(reused_ns, 0.99));
+  REQUIRE(reused_mallocs < fresh_mallocs);
+}
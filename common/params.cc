@@ -225,18 +225,40 @@ void Params::clearAll(ParamKeyFlag key_flag) {
 }
 
 void Params::putNonBlocking(const std::string &key, const std::string &val) {
-   queue.push(std::make_pair(key, val));
   // start thread on demand
-  if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
-    future = std::async(std::launch::async, &Params::asyncWriteThread, this);
+  auto start_writer = [this]() {
+    if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+      future = std::async(std::launch::async, &Params::asyncWriteThread, this);
+    }
+  };
+  // never waits for room in the queue, a burst of writes is coalesced by key instead
+  if (overflowed || !queue.try_push(std::make_pair(key, val))) {
+    std::lock_guard lk(overflow_lock);
+    overflow[key] = val;
+    overflowed = true;
   }
+  start_writer();
 }
 
 void Params::asyncWriteThread() {
   // TODO: write the latest one if a key has multiple values in the queue.
   std::pair<std::string, std::string> p;
-  while (queue.try_pop(p, 0)) {
-    // Params::put is Thread-Safe
-    put(p.first, p.second);
+  while (true) {
+    while (queue.try_pop(p, 0)) {
+      // Params::put is Thread-Safe
+      put(p.first, p.second);
+    }
+
+    // the overflow only has writes that came after the ones in the queue
+    std::map<std::string, std::string> writes;
+    {
+      std::lock_guard lk(overflow_lock);
+      writes.swap(overflow);
+      overflowed = false;
+    }
+    if (writes.empty()) break;
+    for (const auto &[key, val] : writes) {
+      put(key, val);
+    }
   }
 }
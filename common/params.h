@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <future>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <tuple>
@@ -86,5 +88,10 @@ private:
 
   // for nonblocking write
   std::future<void> future;
-  SafeQueue<std::pair<std::string, std::string>> queue;
+  MPSCQueue<std::pair<std::string, std::string>, 32> queue;
+  // writes that didn't fit in the queue, only the latest value of each key. once it's used, writes go here
+  // until the writer thread took them, so they're written in order.
+  std::mutex overflow_lock;
+  std::map<std::string, std::string> overflow;
+  std::atomic<bool> overflowed = false;
 };
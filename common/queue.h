@@ -1,52 +1,288 @@
 #pragma once
 
-#include <condition_variable>
-#include <mutex>
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Bounded lock-free queues with move-only elements. push() and pop() only make a syscall when
+// they have to sleep, on a full or an empty queue, or when there's a thread sleeping to wake.
+//   SPSCQueue<T, Capacity>: one producer and one consumer thread
+//   MPSCQueue<T, Capacity>: any number of producer threads and one consumer thread
+// Both have the same interface, Capacity has to be a power of two.
+
+namespace queue_detail {
+
+// sleeps until word changes from expected or it's woken, timeout_ms < 0 waits without a timeout
+inline void wait(std::atomic<uint32_t> &word, uint32_t expected, int timeout_ms) {
+#ifdef __linux__
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, expected, timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+#else
+  // no futex, poll instead
+  if (word.load(std::memory_order_acquire) == expected && timeout_ms != 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+#endif
+}
+
+inline void wake_all(std::atomic<uint32_t> &word) {
+#ifdef __linux__
+  syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+// Sleeping side of a queue. The other side only makes the wake syscall when a thread announced it's
+// going to sleep, and once per sleep, so a consumer that's slow to get scheduled costs one syscall.
+// word is only ever changed after the state the sleepers check for.
+class Waiters {
+public:
+  // waits until ready() or the timeout, timeout_ms < 0 waits forever
+  template <class Ready>
+  bool waitUntil(std::atomic<uint32_t> &word, int timeout_ms, Ready ready) {
+    if (ready()) return true;
+    if (timeout_ms == 0) return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+      const uint32_t expected = word.load(std::memory_order_seq_cst);
+      sleeping_.store(true, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the one in wake()
+      if (ready()) return true;
+
+      int remaining_ms = -1;
+      if (timeout_ms > 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        remaining_ms = std::max<int>(0, remaining.count());
+      }
+      wait(word, expected, remaining_ms);
+      if (ready()) return true;
+      if (timeout_ms > 0 && std::chrono::steady_clock::now() >= deadline) return false;
+    }
+  }
+
+  // called after changing word
+  void wake(std::atomic<uint32_t> &word) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false, std::memory_order_seq_cst)) {
+      wake_all(word);
+    }
+  }
+
+private:
+  std::atomic<bool> sleeping_ = false;
+};
 
 template <class T>
-class SafeQueue {
+struct Slot {
+  T *get() { return std::launder(reinterpret_cast<T *>(&storage)); }
+  std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+};
+
+constexpr size_t CACHE_LINE = 64;
+
+}  // namespace queue_detail
+
+template <class T, size_t Capacity>
+class SPSCQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0 && Capacity <= (1u << 31), "Capacity has to be a power of two");
+
 public:
-  SafeQueue() = default;
+  SPSCQueue() = default;
+  SPSCQueue(const SPSCQueue &) = delete;
+  SPSCQueue &operator=(const SPSCQueue &) = delete;
+  ~SPSCQueue() {
+    for (uint32_t i = head_.load(); i != tail_.load(); ++i) {
+      slots_[i & MASK].get()->~T();
+    }
+  }
 
-  void push(const T& v) {
-    {
-      std::unique_lock lk(m);
-      q.push(v);
+  // producer
+  template <class... Args>
+  bool try_emplace(Args &&...args) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == Capacity) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == Capacity) return false;
+    }
+    new (&slots_[tail & MASK].storage) T(std::forward<Args>(args)...);
+    tail_.store(tail + 1, std::memory_order_release);
+    pop_waiters_.wake(tail_);
+    return true;
+  }
+  bool try_push(T &&v) { return try_emplace(std::move(v)); }
+  bool try_push(const T &v) { return try_emplace(v); }
+  // waits for room while the queue is full
+  void push(T v) {
+    while (!try_push(std::move(v))) {
+      push_waiters_.waitUntil(head_, -1, [this]() { return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) < Capacity; });
     }
-    cv.notify_one();
   }
 
+  // consumer
+  bool try_pop(T &v, int timeout_ms = 0) {
+    if (!pop_waiters_.waitUntil(tail_, timeout_ms, [this]() { return !empty(); })) return false;
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    T *slot = slots_[head & MASK].get();
+    v = std::move(*slot);
+    slot->~T();
+    head_.store(head + 1, std::memory_order_release);
+    push_waiters_.wake(head_);
+    return true;
+  }
   T pop() {
-    std::unique_lock lk(m);
-    cv.wait(lk, [this] { return !q.empty(); });
-    T v = q.front();
-    q.pop();
+    T v;
+    try_pop(v, -1);
     return v;
   }
+  // moves up to max elements to out without waiting, returns how many
+  template <class OutputIt>
+  size_t pop_batch(OutputIt out, size_t max) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    const size_t n = std::min<size_t>(max, tail_.load(std::memory_order_acquire) - head);
+    for (uint32_t i = head; i != head + n; ++i) {
+      T *slot = slots_[i & MASK].get();
+      *out++ = std::move(*slot);
+      slot->~T();
+    }
+    if (n > 0) {
+      head_.store(head + n, std::memory_order_release);
+      push_waiters_.wake(head_);
+    }
+    return n;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+
+private:
+  static constexpr uint32_t MASK = Capacity - 1;
+
+  // the consumer's and the producer's positions are on their own cache lines
+  alignas(queue_detail::CACHE_LINE) std::atomic<uint32_t> head_ = 0;
+  queue_detail::Waiters push_waiters_;
+  alignas(queue_detail::CACHE_LINE) std::atomic<uint32_t> tail_ = 0;
+  uint32_t head_cache_ = 0;  // producer's view of head_
+  queue_detail::Waiters pop_waiters_;
+  alignas(queue_detail::CACHE_LINE) queue_detail::Slot<T> slots_[Capacity];
+};
 
-  bool try_pop(T& v, int timeout_ms = 0) {
-    std::unique_lock lk(m);
-    if (!cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [this] { return !q.empty(); })) {
-      return false;
+// Each slot has a sequence number that says whether it's free for the producer at position pos (== pos)
+// or holds the element pushed at pos (== pos + 1), so producers only contend on claiming a position.
+template <class T, size_t Capacity>
+class MPSCQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0 && Capacity <= (1u << 30), "Capacity has to be a power of two");
+
+public:
+  MPSCQueue() {
+    for (uint32_t i = 0; i < Capacity; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+  ~MPSCQueue() {
+    for (uint32_t i = head_.load(); ready(i); ++i) {
+      slots_[i & MASK].value.get()->~T();
     }
-    v = q.front();
-    q.pop();
-    return true;
   }
 
-  bool empty() const {
-    std::scoped_lock lk(m);
-    return q.empty();
+  // producers
+  template <class... Args>
+  bool try_emplace(Args &&...args) {
+    uint32_t pos = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & MASK];
+      const int32_t diff = (int32_t)(slot->seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&slot->value.storage) T(std::forward<Args>(args)...);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    pushed_.fetch_add(1, std::memory_order_release);
+    pop_waiters_.wake(pushed_);
+    return true;
+  }
+  bool try_push(T &&v) { return try_emplace(std::move(v)); }
+  bool try_push(const T &v) { return try_emplace(v); }
+  // waits for room while the queue is full
+  void push(T v) {
+    while (!try_push(std::move(v))) {
+      push_waiters_.waitUntil(head_, -1, [this]() { return size() < Capacity; });
+    }
   }
 
-  size_t size() const {
-    std::scoped_lock lk(m);
-    return q.size();
+  // consumer
+  bool try_pop(T &v, int timeout_ms = 0) {
+    if (!pop_waiters_.waitUntil(pushed_, timeout_ms, [this]() { return ready(head_.load(std::memory_order_relaxed)); })) return false;
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    take(head, v);
+    head_.store(head + 1, std::memory_order_release);
+    push_waiters_.wake(head_);
+    return true;
+  }
+  T pop() {
+    T v;
+    try_pop(v, -1);
+    return v;
+  }
+  // moves up to max elements to out without waiting, returns how many
+  template <class OutputIt>
+  size_t pop_batch(OutputIt out, size_t max) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t pos = head;
+    for (; pos - head < max && ready(pos); ++pos) {
+      take(pos, *out++);
+    }
+    if (pos != head) {
+      head_.store(pos, std::memory_order_release);
+      push_waiters_.wake(head_);
+    }
+    return pos - head;
   }
 
+  bool empty() const { return size() == 0; }
+  // includes the elements that are still being pushed
+  size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+
 private:
-  mutable std::mutex m;
-  std::condition_variable cv;
-  std::queue<T> q;
+  static constexpr uint32_t MASK = Capacity - 1;
+
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    queue_detail::Slot<T> value;
+  };
+
+  bool ready(uint32_t pos) const { return slots_[pos & MASK].seq.load(std::memory_order_acquire) == pos + 1; }
+  template <class Out>
+  void take(uint32_t pos, Out &&out) {
+    Slot &slot = slots_[pos & MASK];
+    out = std::move(*slot.value.get());
+    slot.value.get()->~T();
+    slot.seq.store(pos + Capacity, std::memory_order_release);
+  }
+
+  alignas(queue_detail::CACHE_LINE) std::atomic<uint32_t> head_ = 0;
+  queue_detail::Waiters push_waiters_;
+  alignas(queue_detail::CACHE_LINE) std::atomic<uint32_t> tail_ = 0;
+  alignas(queue_detail::CACHE_LINE) std::atomic<uint32_t> pushed_ = 0;  // bumped once an element is in, for waking the consumer
+  queue_detail::Waiters pop_waiters_;
+  alignas(queue_detail::CACHE_LINE) Slot slots_[Capacity];
 };
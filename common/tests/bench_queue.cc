@@ -0,0 +1,98 @@
+// Pushes messages through the queues from 1..N producer threads into one consumer, and reports
+// the throughput of SPSCQueue, MPSCQueue and the mutex + condition variable queue they replaced.
+// usage: common/tests/bench_queue [messages per producer]
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "common/queue.h"
+#include "common/timing.h"
+
+// the old SafeQueue, as a baseline
+template <class T>
+class LockedQueue {
+public:
+  void push(T v) {
+    {
+      std::lock_guard lk(m);
+      q.push(std::move(v));
+    }
+    cv.notify_one();
+  }
+  T pop() {
+    std::unique_lock lk(m);
+    cv.wait(lk, [this] { return !q.empty(); });
+    T v = std::move(q.front());
+    q.pop();
+    return v;
+  }
+
+private:
+  std::mutex m;
+  std::condition_variable cv;
+  std::queue<T> q;
+};
+
+template <class Queue>
+double run(int producers, int messages, bool batch) {
+  Queue q;
+  std::vector<std::thread> threads;
+  double start = millis_since_boot();
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&q, messages]() {
+      for (int i = 0; i < messages; ++i) q.push(i);
+    });
+  }
+
+  uint64_t sum = 0;
+  const int total = producers * messages;
+  if constexpr (!std::is_same_v<Queue, LockedQueue<int>>) {
+    int buf[64];
+    for (int received = 0; received < total;) {
+      size_t n = batch ? q.pop_batch(buf, 64) : 0;
+      if (n == 0) {
+        buf[0] = q.pop();
+        n = 1;
+      }
+      for (size_t i = 0; i < n; ++i) sum += buf[i];
+      received += n;
+    }
+  } else {
+    for (int received = 0; received < total; ++received) sum += q.pop();
+  }
+  double elapsed = millis_since_boot() - start;
+  for (auto &t : threads) t.join();
+
+  if (sum != uint64_t(producers) * messages * (messages - 1) / 2) {
+    fprintf(stderr, "lost messages\n");
+    exit(1);
+  }
+  return total / elapsed / 1e3;
+}
+
+int main(int argc, char *argv[]) {
+  const int messages = argc > 1 ? atoi(argv[1]) : 1000000;
+  const int max_producers = std::max(2u, std::thread::hardware_concurrency() - 1);
+
+  printf("%d messages per producer, million messages/s\n", messages);
+  printf("%-10s %12s %12s %12s %12s\n", "producers", "locked", "spsc", "mpsc", "mpsc batch");
+  for (int producers = 1; producers <= max_producers; producers *= 2) {
+    printf("%-10d %12.2f", producers, run<LockedQueue<int>>(producers, messages, false));
+    if (producers == 1) {
+      printf(" %12.2f", run<SPSCQueue<int, 1024>>(producers, messages, false));
+    } else {
+      printf(" %12s", "-");
+    }
+    printf(" %12.2f %12.2f\n", run<MPSCQueue<int, 1024>>(producers, messages, false),
+           run<MPSCQueue<int, 1024>>(producers, messages, true));
+  }
+  return 0;
+}
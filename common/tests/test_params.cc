@@ -25,3 +25,22 @@ TEST_CASE("params_nonblocking_put") {
     REQUIRE(p.get(name) == "1");
   }
 }
+
+TEST_CASE("params_nonblocking_put_overflow") {
+  char tmp_path[] = "/tmp/asyncWriter_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  auto param_names = {"CarParams", "IsMetric", "LanguageSetting"};
+  {
+    Params params(param_path);
+    // many more writes than the queue holds, the ones that don't fit are coalesced
+    for (int i = 0; i < 1000; ++i) {
+      for (const auto &name : param_names) {
+        params.putNonBlocking(name, std::to_string(i));
+      }
+    }
+  }
+  Params p(param_path);
+  for (const auto &name : param_names) {
+    REQUIRE(p.get(name) == "999");
+  }
+}
@@ -0,0 +1,86 @@
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/queue.h"
+
+TEMPLATE_TEST_CASE("queue push and pop", "", (SPSCQueue<std::unique_ptr<int>, 4>), (MPSCQueue<std::unique_ptr<int>, 4>)) {
+  TestType q;
+  REQUIRE(q.empty());
+
+  std::unique_ptr<int> v;
+  REQUIRE(!q.try_pop(v));
+  REQUIRE(!q.try_pop(v, 10));
+
+  for (int i = 0; i < 4; ++i) {
+    REQUIRE(q.try_push(std::make_unique<int>(i)));
+  }
+  REQUIRE(q.size() == 4);
+  auto extra = std::make_unique<int>(4);
+  REQUIRE(!q.try_push(std::move(extra)));
+  REQUIRE(extra);  // not moved from when the queue is full
+
+  REQUIRE(q.try_pop(v));
+  REQUIRE(*v == 0);
+  REQUIRE(q.try_push(std::move(extra)));
+
+  std::vector<std::unique_ptr<int>> batch;
+  REQUIRE(q.pop_batch(std::back_inserter(batch), 3) == 3);
+  REQUIRE(q.pop_batch(std::back_inserter(batch), 3) == 1);
+  REQUIRE(q.pop_batch(std::back_inserter(batch), 3) == 0);
+  for (int i = 0; i < 4; ++i) {
+    REQUIRE(*batch[i] == i + 1);
+  }
+  REQUIRE(q.empty());
+}
+
+TEMPLATE_TEST_CASE("queue destroys the elements left in it", "", (SPSCQueue<std::shared_ptr<int>, 4>), (MPSCQueue<std::shared_ptr<int>, 4>)) {
+  auto v = std::make_shared<int>(0);
+  {
+    TestType q;
+    q.push(v);
+    q.push(v);
+    REQUIRE(v.use_count() == 3);
+  }
+  REQUIRE(v.use_count() == 1);
+}
+
+TEMPLATE_TEST_CASE("queue wakes a sleeping consumer and producer", "", (SPSCQueue<int, 2>), (MPSCQueue<int, 2>)) {
+  TestType q;
+  std::thread producer([&]() {
+    for (int i = 0; i < 1000; ++i) q.push(i);
+  });
+  for (int i = 0; i < 1000; ++i) {
+    REQUIRE(q.pop() == i);
+  }
+  producer.join();
+}
+
+TEST_CASE("MPSCQueue keeps the order of each producer") {
+  const int producers = 4, count = 100000;
+  MPSCQueue<std::pair<int, int>, 64> q;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&q, p]() {
+      for (int i = 0; i < count; ++i) q.push({p, i});
+    });
+  }
+
+  std::vector<int> next(producers, 0);
+  std::vector<std::pair<int, int>> batch;
+  for (int received = 0; received < producers * count;) {
+    batch.clear();
+    if (q.pop_batch(std::back_inserter(batch), 16) == 0) {
+      batch.push_back(q.pop());
+    }
+    for (auto [p, i] : batch) {
+      REQUIRE(i == next[p]++);
+      ++received;
+    }
+  }
+  for (auto &t : threads) t.join();
+  REQUIRE(q.empty());
+}
@@ -88,11 +88,12 @@ void can_send_thread(Panda *panda, bool fake_send) {
 
 void can_recv(Panda *panda, PubMaster *pm) {
   static std::vector<can_frame> raw_can_data;
+  static ReusableMessageBuilder msg_builder;
   {
     raw_can_data.clear();
     bool comms_healthy = panda->can_receive(raw_can_data);
 
-    MessageBuilder msg;
+    MessageBuilder &msg = msg_builder.reset();
     auto evt = msg.initEvent();
     evt.setValid(comms_healthy);
     auto canData = evt.initCan(raw_can_data.size());
@@ -377,6 +378,8 @@ void pandad_run(Panda *panda) {
   Params params;
   RateKeeper rk("pandad", 100);
   SubMaster sm({"selfdriveState"});
+  const auto selfdrive_state = sm.handle("selfdriveState");
+  const auto selfdrive_mask = sm.mask({selfdrive_state});
   PubMaster pm({"can", "pandaStates", "peripheralState"});
   PandaSafety panda_safety(panda);
   bool engaged = false;
@@ -394,7 +397,7 @@ void pandad_run(Panda *panda) {
     // Process panda state at 10 Hz
     if (rk.frame() % 10 == 0) {
       sm.update(0);
-      engaged = sm.allAliveAndValid({"selfdriveState"}) && sm["selfdriveState"].getSelfdriveState().getEnabled();
+      engaged = sm.allAliveAndValid(selfdrive_mask) && sm[selfdrive_state].getSelfdriveState().getEnabled();
       is_onroad = params.getBool("IsOnroad");
       process_panda_state(panda, &pm, engaged, is_onroad, spoofing_started);
       panda_safety.configureSafetyMode(is_onroad);
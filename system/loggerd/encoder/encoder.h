@@ -38,5 +38,5 @@ private:
   // total frames encoded
   int cnt = 0;
   std::unique_ptr<PubMaster> pm;
-  std::vector<capnp::byte> msg_cache;
+  ReusableMessageBuilder msg_builder;
 };
@@ -5,6 +5,7 @@
 
 #define BUF_IN_COUNT 7
 #define BUF_OUT_COUNT 6
+static_assert(BUF_IN_COUNT <= 8, "free_buf_in has to hold all the input buffers");
 
 class V4LEncoder : public VideoEncoder {
 public:
@@ -21,11 +22,13 @@ private:
   int segment_num = -1;
   int counter = 0;
 
-  SafeQueue<VisionIpcBufExtra> extras;
+  // frames in the encoder, pushed by encode_frame() and popped by the dequeue handler
+  SPSCQueue<VisionIpcBufExtra, 8> extras;
 
   static void dequeue_handler(V4LEncoder *e);
   std::thread dequeue_handler_thread;
 
   VisionBuf buf_out[BUF_OUT_COUNT];
-  SafeQueue<unsigned int> free_buf_in;
+  // pushed by the dequeue handler and by encoder_close()
+  MPSCQueue<unsigned int, 8> free_buf_in;
 };
@@ -161,7 +161,7 @@ static void log_sentinel(LoggerState *log, SentinelType type, int exit_signal =
   log->write(msg.toBytes(), true);
 }
 
-LoggerState::LoggerState(const std::string &log_root) {
+LoggerState::LoggerState(const std::string &log_root, const ZstdCompressionConfig &compression) : compression(compression) {
   route_name = logger_get_identifier("RouteCount");
   route_path = log_root + "/" + route_name;
   init_data = logger_build_init_data();
@@ -187,8 +187,8 @@ bool LoggerState::next() {
   lock_file = segment_path + "/rlog.lock";
   std::ofstream{lock_file};
 
-  rlog.reset(new ZstdFileWriter(segment_path + "/rlog.zst", LOG_COMPRESSION_LEVEL));
-  qlog.reset(new ZstdFileWriter(segment_path + "/qlog.zst", LOG_COMPRESSION_LEVEL));
+  rlog.reset(new ZstdFileWriter(segment_path + "/rlog.zst", compression, true));
+  qlog.reset(new ZstdFileWriter(segment_path + "/qlog.zst", compression, true));
 
   // log init data & sentinel type.
   write(init_data.asBytes(), true);
@@ -197,6 +197,27 @@ bool LoggerState::next() {
 }
 
 void LoggerState::write(uint8_t* data, size_t size, bool in_qlog) {
+  if (compression.seekable) newFrameIfDue(rlog.get(), rlog_frame_start, data, size);
   rlog->write(data, size);
-  if (in_qlog) qlog->write(data, size);
+  if (in_qlog) {
+    if (compression.seekable) newFrameIfDue(qlog.get(), qlog_frame_start, data, size);
+    qlog->write(data, size);
+  }
+}
+
+void LoggerState::newFrameIfDue(ZstdFileWriter *log, double &frame_start, uint8_t *data, size_t size) {
+  double now = millis_since_boot();
+  if (log->frameSize() > 0 && log->frameSize() < LOG_FRAME_SIZE && now - frame_start < LOG_FRAME_SECONDS * 1000) {
+    return;
+  }
+
+  uint64_t mono_time = 0;
+  try {
+    capnp::FlatArrayMessageReader reader(aligned_buf.view((const char *)data, size));
+    mono_time = reader.getRoot<cereal::Event>().getLogMonoTime();
+  } catch (const kj::Exception &e) {
+    LOGW("failed to read logMonoTime for the frame index: %s", e.getDescription().cStr());
+  }
+  log->newFrame(mono_time);
+  frame_start = now;
 }
@@ -10,12 +10,16 @@
 #include "system/loggerd/zstd_writer.h"
 
 constexpr int LOG_COMPRESSION_LEVEL = 10;
+// with ZstdCompressionConfig::seekable, rlog and qlog start a new seekable zstd frame every LOG_FRAME_SIZE bytes or LOG_FRAME_SECONDS
+constexpr size_t LOG_FRAME_SIZE = 8 * 1024 * 1024;
+constexpr double LOG_FRAME_SECONDS = 5.0;
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
 class LoggerState {
 public:
-  LoggerState(const std::string& log_root = Path::log_root());
+  LoggerState(const std::string& log_root = Path::log_root(),
+              const ZstdCompressionConfig &compression = {.level = LOG_COMPRESSION_LEVEL});
   ~LoggerState();
   bool next();
   void write(uint8_t* data, size_t size, bool in_qlog);
@@ -26,10 +30,15 @@ public:
   inline void setExitSignal(int signal) { exit_signal = signal; }
 
 protected:
+  void newFrameIfDue(ZstdFileWriter *log, double &frame_start, uint8_t *data, size_t size);
+
   int part = -1, exit_signal = 0;
   std::string route_path, route_name, segment_path, lock_file;
   kj::Array<capnp::word> init_data;
+  ZstdCompressionConfig compression;
   std::unique_ptr<ZstdFileWriter> rlog, qlog;
+  double rlog_frame_start = 0, qlog_frame_start = 0;
+  AlignedBuffer aligned_buf;
 };
 
 kj::Array<capnp::word> logger_build_init_data();
@@ -1,5 +1,6 @@
 #include <sys/xattr.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <string>
@@ -13,8 +14,23 @@
 
 ExitHandler do_exit;
 
+// rlog/qlog compression, the defaults unless overridden by the environment:
+//   LOGGERD_ZSTD_WORKERS=<n>    compress on n zstd worker threads
+//   LOGGERD_ZSTD_LDM=1          long distance matching, readers need a 128MB window
+//   LOGGERD_ZSTD_MIN_LEVEL=<n>  lower the level towards n while the workers can't keep up
+//   LOGGERD_ZSTD_SEEKABLE=1     seekable frames with a logMonoTime index, readers must read across frames
+static ZstdCompressionConfig log_compression_config() {
+  ZstdCompressionConfig config = {.level = LOG_COMPRESSION_LEVEL};
+  config.workers = util::getenv("LOGGERD_ZSTD_WORKERS", 0);
+  config.long_distance = util::getenv("LOGGERD_ZSTD_LDM", 0) != 0;
+  config.min_level = std::max(1, util::getenv("LOGGERD_ZSTD_MIN_LEVEL", config.level));
+  config.adaptive = config.min_level < config.level;
+  config.seekable = util::getenv("LOGGERD_ZSTD_SEEKABLE", 0) != 0;
+  return config;
+}
+
 struct LoggerdState {
-  LoggerState logger;
+  LoggerState logger{Path::log_root(), log_compression_config()};
   std::atomic<double> last_camera_seen_tms{0.0};
   std::atomic<int> ready_to_rotate{0};  // count of encoders ready to rotate
   int max_waiting = 0;
@@ -103,11 +119,12 @@ size_t write_encode_data(LoggerdState *s, cereal::Event::Reader event, RemoteEnc
   }
 
   // put it in log stream as the idx packet
-  MessageBuilder bmsg;
+  static ReusableMessageBuilder bmsg_builder;
+  MessageBuilder &bmsg = bmsg_builder.reset();
   auto evt = bmsg.initEvent(event.getValid());
   evt.setLogMonoTime(event.getLogMonoTime());
   (evt.*(encoder_info.set_encode_idx_func))(idx);
-  auto new_msg = bmsg.toBytes();
+  auto new_msg = bmsg_builder.toBytes();
   s->logger.write((uint8_t *)new_msg.begin(), new_msg.size(), true);  // always in qlog?
   return new_msg.size();
 }
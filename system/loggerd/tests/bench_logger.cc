@@ -0,0 +1,150 @@
+// Replays an rlog through LoggerState::write and reports throughput, cpu time and
+// compression ratio for each zstd configuration, then how long ZstdFileWriter::write
+// blocks the caller with and without the compress thread.
+// usage: tests/bench_logger <rlog or rlog.zst> [speed]
+//   speed: replay at this multiple of realtime, 0 (default) writes as fast as possible
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <capnp/schema.h>
+
+#include "cereal/services.h"
+#include "common/timing.h"
+#include "system/loggerd/logger.h"
+
+struct ReplayEvent {
+  kj::ArrayPtr<const capnp::byte> bytes;
+  uint64_t mono_time;
+  bool in_qlog;
+};
+
+static double cpu_seconds() {
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <rlog or rlog.zst> [speed]\n", argv[0]);
+    return 1;
+  }
+  const double speed = argc > 2 ? atof(argv[2]) : 0;
+
+  std::string log = util::read_file(argv[1]);
+  if (util::ends_with(argv[1], ".zst")) {
+    log = zstd_decompress(log);
+  }
+  AlignedBuffer aligned_buf;
+  kj::ArrayPtr<const capnp::word> words = aligned_buf.align(log.data(), log.size());
+
+  // decimate into the qlog the way loggerd does
+  std::unordered_map<uint16_t, std::pair<int, int>> decimation;  // which -> (decimation, counter)
+  for (auto field : capnp::Schema::from<cereal::Event>().getUnionFields()) {
+    auto it = services.find(field.getProto().getName().cStr());
+    if (it != services.end()) {
+      decimation[field.getProto().getDiscriminantValue()] = {it->second.decimation, 0};
+    }
+  }
+
+  std::vector<ReplayEvent> events;
+  size_t rlog_bytes = 0, qlog_bytes = 0;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    auto bytes = kj::arrayPtr(words.begin(), reader.getEnd()).asBytes();
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+
+    auto it = decimation.find((uint16_t)event.which());
+    bool in_qlog = it != decimation.end() && it->second.first != -1 && (it->second.second++ % it->second.first == 0);
+    events.push_back({bytes, event.getLogMonoTime(), in_qlog});
+    rlog_bytes += bytes.size();
+    qlog_bytes += in_qlog ? bytes.size() : 0;
+  }
+  if (events.empty()) {
+    fprintf(stderr, "no events in %s\n", argv[1]);
+    return 1;
+  }
+
+  const std::vector<std::pair<std::string, ZstdCompressionConfig>> configs = {
+    {"level 10", {.level = LOG_COMPRESSION_LEVEL}},
+    {"level 10, 2 workers", {.level = LOG_COMPRESSION_LEVEL, .workers = 2}},
+    {"level 10, ldm", {.level = LOG_COMPRESSION_LEVEL, .long_distance = true}},
+    {"level 10, 2 workers, ldm", {.level = LOG_COMPRESSION_LEVEL, .workers = 2, .long_distance = true}},
+    {"adaptive 10..3, 2 workers", {.level = LOG_COMPRESSION_LEVEL, .workers = 2, .adaptive = true, .min_level = 3}},
+    {"level 3", {.level = 3}},
+  };
+
+  const std::string log_root = "/tmp/bench_logger";
+  printf("%zu events, rlog %.2f MB, qlog %.2f MB\n", events.size(), rlog_bytes / 1e6, qlog_bytes / 1e6);
+  printf("%-28s %10s %10s %12s %12s\n", "config", "MB/s", "cpu s", "rlog ratio", "qlog ratio");
+  for (const auto &[name, config] : configs) {
+    if (system(("rm " + log_root + " -rf").c_str()) != 0) return 1;
+
+    std::string segment_path;
+    double start = millis_since_boot(), cpu_start = cpu_seconds();
+    {
+      LoggerState logger(log_root, config);
+      logger.next();
+      segment_path = logger.segmentPath();
+      for (const auto &e : events) {
+        if (speed > 0) {
+          double target = start + (e.mono_time - events[0].mono_time) / 1e6 / speed;
+          double now = millis_since_boot();
+          if (target > now) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(target - now));
+          }
+        }
+        logger.write((uint8_t *)e.bytes.begin(), e.bytes.size(), e.in_qlog);
+      }
+    }
+    double elapsed = (millis_since_boot() - start) / 1000.0, cpu = cpu_seconds() - cpu_start;
+
+    size_t rlog_size = util::read_file(segment_path + "/rlog.zst").size();
+    size_t qlog_size = util::read_file(segment_path + "/qlog.zst").size();
+    printf("%-28s %10.2f %10.2f %12.2f %12.2f\n", name.c_str(), rlog_bytes / 1e6 / elapsed, cpu,
+           (double)rlog_bytes / rlog_size, (double)qlog_bytes / qlog_size);
+  }
+
+  const std::vector<std::tuple<std::string, ZstdCompressionConfig, bool>> writers = {
+    {"sync, level 10", {.level = LOG_COMPRESSION_LEVEL}, false},
+    {"async, level 10", {.level = LOG_COMPRESSION_LEVEL}, true},
+    {"async, adaptive 19..3", {.level = 19, .workers = 1, .adaptive = true, .min_level = 3}, true},
+  };
+  printf("\n%-28s %12s %12s %12s\n", "write() stall", "p99 ms", "max ms", "final level");
+  for (const auto &[name, config, async] : writers) {
+    std::vector<double> stalls;
+    stalls.reserve(events.size());
+    int level = 0;
+    double start = millis_since_boot();
+    {
+      ZstdFileWriter writer(log_root + ".zst", config, async);
+      for (const auto &e : events) {
+        if (speed > 0) {
+          double target = start + (e.mono_time - events[0].mono_time) / 1e6 / speed;
+          double now = millis_since_boot();
+          if (target > now) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(target - now));
+          }
+        }
+        double write_start = millis_since_boot();
+        writer.write((void *)e.bytes.begin(), e.bytes.size());
+        stalls.push_back(millis_since_boot() - write_start);
+      }
+      level = writer.level();
+    }
+    std::sort(stalls.begin(), stalls.end());
+    printf("%-28s %12.3f %12.3f %12d\n", name.c_str(), stalls[(stalls.size() - 1) * 99 / 100], stalls.back(), level);
+  }
+  std::remove((log_root + ".zst").c_str());
+  return system(("rm " + log_root + " -rf").c_str()) == 0 ? 0 : 1;
+}
@@ -13,6 +13,8 @@ void verify_segment(const std::string &route_path, int segment, int max_segment,
     const std::string log_file = segment_path + fn;
     std::string log = util::read_file(log_file);
     REQUIRE(!log.empty());
+    // without ZstdCompressionConfig::seekable, readers that stop after the first frame still get the whole log
+    REQUIRE(ZSTD_findFrameCompressedSize(log.data(), log.size()) == log.size());
     std::string decompressed_log = zstd_decompress(log);
     int event_cnt = 0, i = 0;
     kj::ArrayPtr<const capnp::word> words((capnp::word *)decompressed_log.data(), decompressed_log.size() / sizeof(capnp::word));
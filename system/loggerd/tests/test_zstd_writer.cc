@@ -1,7 +1,15 @@
 #include <zstd.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <catch2/catch.hpp>
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <future>
+#include <thread>
 #include <vector>
 
 #include "common/util.h"
@@ -9,6 +17,7 @@
 #include "system/loggerd/zstd_writer.h"
 
 TEST_CASE("ZstdFileWriter writes and compresses data correctly in loops", "[ZstdFileWriter]") {
+  const bool async = GENERATE(false, true);
   const std::string filename = "test_zstd_file.zst";
   const int iterations = 100;
   const size_t dataSize = 1024;
@@ -17,7 +26,7 @@ TEST_CASE("ZstdFileWriter writes and compresses data correctly in loops", "[Zstd
 
   // Step 1: Write compressed data to file in a loop
   {
-    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL);
+    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL, async);
     // Write various data sizes including edge cases
     std::vector<size_t> testSizes = {dataSize, 1, 0, dataSize * 2};  // Normal, minimal, empty, large
     for (int i = 0; i < iterations; ++i) {
@@ -42,3 +51,135 @@ TEST_CASE("ZstdFileWriter writes and compresses data correctly in loops", "[Zstd
   // Clean up the test file
   std::remove(filename.c_str());
 }
+
+TEST_CASE("ZstdFileWriter async write() doesn't wait for the compress thread", "[ZstdFileWriter]") {
+  // nothing reads the fifo until the end, so the compress thread is stuck writing the first chunk
+  const std::string filename = "/tmp/test_zstd_fifo";
+  std::remove(filename.c_str());
+  REQUIRE(mkfifo(filename.c_str(), 0600) == 0);
+  int fd = open(filename.c_str(), O_RDONLY | O_NONBLOCK);
+  REQUIRE(fd >= 0);
+
+  std::string totalTestData, content;
+  std::thread reader;
+  bool returned = false;
+  {
+    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL, true);
+    // three chunks of incompressible data, more than the pipe buffer holds but fewer than
+    // the chunks write() queues before it waits
+    auto writes = std::async(std::launch::async, [&]() {
+      while (totalTestData.size() < 3 * ZSTD_CStreamInSize()) {
+        std::string testData = util::random_string(4096);
+        totalTestData.append(testData);
+        writer.write((void *)testData.c_str(), testData.size());
+      }
+    });
+    returned = writes.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+
+    // unblock the compress thread, and read everything until the writer closes the fifo
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    reader = std::thread([&]() {
+      char buf[64 * 1024];
+      for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;) content.append(buf, n);
+    });
+  }
+  reader.join();
+  REQUIRE(returned);
+  REQUIRE(zstd_decompress(content) == totalTestData);
+  close(fd);
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("ZstdFileWriter with workers and long distance matching", "[ZstdFileWriter]") {
+  const std::string filename = "test_zstd_workers.zst";
+  ZstdCompressionConfig config = GENERATE(ZstdCompressionConfig{.level = LOG_COMPRESSION_LEVEL, .workers = 2},
+                                          ZstdCompressionConfig{.level = LOG_COMPRESSION_LEVEL, .long_distance = true},
+                                          ZstdCompressionConfig{.level = LOG_COMPRESSION_LEVEL, .adaptive = true});
+  std::string totalTestData;
+  {
+    ZstdFileWriter writer(filename, config, true);
+    for (int i = 0; i < 1000; ++i) {
+      // repeat earlier data far back in the stream, so long distance matching has something to find
+      std::string testData = i < 500 ? util::random_string(4096) : totalTestData.substr((i - 500) * 4096, 4096);
+      totalTestData.append(testData);
+      writer.write((void *)testData.c_str(), testData.size());
+    }
+  }
+
+  std::string decompressedData = zstd_decompress(util::read_file(filename));
+  REQUIRE(decompressedData.size() == totalTestData.size());
+  REQUIRE(decompressedData == totalTestData);
+  std::remove(filename.c_str());
+}
+
+// whether the level actually drops depends on how fast the machine is, see bench_logger for that
+TEST_CASE("ZstdFileWriter adaptive level stays within its range", "[ZstdFileWriter]") {
+  const std::string filename = "test_zstd_adaptive.zst";
+  ZstdCompressionConfig config = {.level = 19, .workers = 1, .adaptive = true, .min_level = 3};
+  std::string totalTestData;
+  int level = 0;
+  {
+    ZstdFileWriter writer(filename, config);
+    for (int i = 0; i < 4 * 1024; ++i) {
+      std::string testData = util::random_string(4096);
+      totalTestData.append(testData);
+      writer.write((void *)testData.c_str(), testData.size());
+    }
+    level = writer.level();
+  }
+  CHECK(level <= config.level);
+  CHECK(level >= config.min_level);
+  REQUIRE(zstd_decompress(util::read_file(filename)) == totalTestData);
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("ZstdFileWriter writes seekable frames", "[ZstdFileWriter]") {
+  const bool async = GENERATE(false, true);
+  const std::string filename = "test_zstd_seekable.zst";
+  const int frame_cnt = 5;
+  std::vector<std::string> frames;
+  std::string totalTestData;
+  {
+    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL, async);
+    for (int i = 0; i < frame_cnt; ++i) {
+      writer.newFrame(1000000000ull * (i + 1));
+      std::string testData = util::random_string(300 * 1024);
+      frames.push_back(testData);
+      totalTestData.append(testData);
+      writer.write((void *)testData.c_str(), testData.size());
+    }
+  }
+
+  // the whole file still decompresses as one stream
+  std::string content = util::read_file(filename);
+  REQUIRE(zstd_decompress(content) == totalTestData);
+
+  auto read_u32 = [&](size_t pos) { uint32_t v; memcpy(&v, content.data() + pos, sizeof(v)); return v; };
+  REQUIRE(read_u32(content.size() - 4) == ZSTD_SEEKABLE_MAGIC);
+  // the frames and the logMonoTime index
+  const size_t entries = read_u32(content.size() - 9);
+  REQUIRE(entries == frame_cnt + 1);
+  size_t table_pos = content.size() - 17 - entries * 8;
+  REQUIRE(read_u32(table_pos) == ZSTD_SEEK_TABLE_MAGIC);
+
+  size_t offset = 0;
+  for (int i = 0; i < frame_cnt; ++i) {
+    size_t compressed = read_u32(table_pos + 8 + i * 8), decompressed = read_u32(table_pos + 12 + i * 8);
+    std::string out(decompressed, '\0');
+    REQUIRE(ZSTD_decompress(out.data(), out.size(), content.data() + offset, compressed) == decompressed);
+    REQUIRE(out == frames[i]);
+    offset += compressed;
+  }
+
+  REQUIRE(read_u32(table_pos + 8 + frame_cnt * 8) == 8 + frame_cnt * sizeof(uint64_t));
+  REQUIRE(read_u32(table_pos + 12 + frame_cnt * 8) == 0);
+  REQUIRE(read_u32(offset) == ZSTD_MONO_TIME_INDEX_MAGIC);
+  REQUIRE(read_u32(offset + 4) == frame_cnt * sizeof(uint64_t));
+  for (int i = 0; i < frame_cnt; ++i) {
+    uint64_t mono_time;
+    memcpy(&mono_time, content.data() + offset + 8 + i * 8, sizeof(mono_time));
+    REQUIRE(mono_time == 1000000000ull * (i + 1));
+  }
+  REQUIRE(offset + 8 + frame_cnt * 8 == table_pos);
+  std::remove(filename.c_str());
+}
@@ -1,18 +1,41 @@
-
+#define ZSTD_STATIC_LINKING_ONLY  // ZSTD_getFrameProgression
 #include "system/loggerd/zstd_writer.h"
 
+#include <algorithm>
 #include <cassert>
 
+#include "common/swaglog.h"
 #include "common/util.h"
 
 // Constructor: Initializes compression stream and opens file
-ZstdFileWriter::ZstdFileWriter(const std::string& filename, int compression_level) {
+ZstdFileWriter::ZstdFileWriter(const std::string& filename, const ZstdCompressionConfig &config, bool async)
+    : config_(config), level_(config.level) {
   // Create the compression stream
   cstream_ = ZSTD_createCStream();
   assert(cstream_);
 
-  size_t initResult = ZSTD_initCStream(cstream_, compression_level);
-  assert(!ZSTD_isError(initResult));
+  size_t ret = ZSTD_CCtx_setParameter(cstream_, ZSTD_c_compressionLevel, config_.level);
+  assert(!ZSTD_isError(ret));
+
+  workers_ = config_.adaptive ? std::max(config_.workers, 1) : config_.workers;
+  if (workers_ > 0) {
+    ret = ZSTD_CCtx_setParameter(cstream_, ZSTD_c_nbWorkers, workers_);
+    if (ZSTD_isError(ret)) {
+      // libzstd built without ZSTD_MULTITHREAD
+      LOGW("zstd workers unavailable: %s", ZSTD_getErrorName(ret));
+      workers_ = 0;
+      config_.adaptive = false;
+    }
+  }
+  if (config_.adaptive) {
+    // small jobs, so a level change applies soon after it's made
+    ret = ZSTD_CCtx_setParameter(cstream_, ZSTD_c_jobSize, ADAPT_JOB_SIZE);
+    assert(!ZSTD_isError(ret));
+  }
+  if (config_.long_distance) {
+    ret = ZSTD_CCtx_setParameter(cstream_, ZSTD_c_enableLongDistanceMatching, 1);
+    assert(!ZSTD_isError(ret));
+  }
 
   input_cache_capacity_ = ZSTD_CStreamInSize();
   input_cache_.reserve(input_cache_capacity_);
@@ -20,11 +43,21 @@ ZstdFileWriter::ZstdFileWriter(const std::string& filename, int compression_leve
 
   file_ = util::safe_fopen(filename.c_str(), "wb");
   assert(file_ != nullptr);
+
+  if (async) {
+    thread_ = std::thread(&ZstdFileWriter::compressThread, this);
+  }
 }
 
 // Destructor: Finalizes compression and closes file
 ZstdFileWriter::~ZstdFileWriter() {
-  flushCache(true);
+  flushCache(true, true);
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (!frame_mono_times_.empty()) {
+    writeSeekTable();
+  }
   util::safe_fflush(file_);
 
   int err = fclose(file_);
@@ -37,6 +70,7 @@ ZstdFileWriter::~ZstdFileWriter() {
 void ZstdFileWriter::write(void* data, size_t size) {
   // Add data to the input cache
   input_cache_.insert(input_cache_.end(), (uint8_t*)data, (uint8_t*)data + size);
+  frame_size_ += size;
 
   // If the cache is full, compress and write to the file
   if (input_cache_.size() >= input_cache_capacity_) {
@@ -44,10 +78,46 @@ void ZstdFileWriter::write(void* data, size_t size) {
   }
 }
 
-// Compress and flush the input cache to the file
-void ZstdFileWriter::flushCache(bool last_chunk) {
-  ZSTD_inBuffer input = {input_cache_.data(), input_cache_.size(), 0};
-  ZSTD_EndDirective mode = !last_chunk ? ZSTD_e_continue : ZSTD_e_end;
+void ZstdFileWriter::newFrame(uint64_t mono_time) {
+  if (frame_size_ > 0) {
+    flushCache(true);
+    frame_size_ = 0;
+    ++frame_count_;
+  }
+  // frames written before the first newFrame() are indexed at time 0
+  frame_mono_times_.resize(frame_count_ + 1, 0);
+  frame_mono_times_[frame_count_] = mono_time;
+}
+
+// Compress and flush the input cache to the file, or hand it to the compress thread
+void ZstdFileWriter::flushCache(bool end_frame, bool last_chunk) {
+  if (!thread_.joinable()) {
+    compress(input_cache_, end_frame);
+    input_cache_.clear();  // Clear cache after compression
+    return;
+  }
+
+  std::unique_lock lk(lock_);
+  // backpressure: wait for the compress thread to catch up
+  cv_.wait(lk, [this]() { return pending_chunks_.size() < MAX_PENDING_CHUNKS; });
+  pending_chunks_.push_back({std::move(input_cache_), end_frame});
+  closing_ = last_chunk;
+
+  // reuse a chunk the compress thread is done with
+  if (!free_chunks_.empty()) {
+    input_cache_ = std::move(free_chunks_.front());
+    free_chunks_.pop_front();
+  } else {
+    input_cache_ = std::vector<char>();
+    input_cache_.reserve(input_cache_capacity_);
+  }
+  lk.unlock();
+  cv_.notify_all();
+}
+
+void ZstdFileWriter::compress(const std::vector<char> &chunk, bool end_frame) {
+  ZSTD_inBuffer input = {chunk.data(), chunk.size(), 0};
+  ZSTD_EndDirective mode = !end_frame ? ZSTD_e_continue : ZSTD_e_end;
   int finished = 0;
 
   do {
@@ -57,9 +127,93 @@ void ZstdFileWriter::flushCache(bool last_chunk) {
 
     size_t written = util::safe_fwrite(output_buffer_.data(), 1, output.pos, file_);
     assert(written == output.pos);
+    frame_compressed_ += output.pos;
 
-    finished = last_chunk ? (remaining == 0) : (input.pos == input.size);
+    finished = end_frame ? (remaining == 0) : (input.pos == input.size);
   } while (!finished);
 
-  input_cache_.clear();  // Clear cache after compression
+  frame_decompressed_ += chunk.size();
+  if (end_frame) {
+    seek_table_.push_back({frame_compressed_, frame_decompressed_});
+    frame_compressed_ = frame_decompressed_ = 0;
+  }
+
+  if (config_.adaptive && !end_frame && ++chunks_since_adapt_ == ADAPT_INTERVAL_CHUNKS) {
+    adaptLevel();
+    chunks_since_adapt_ = 0;
+  }
+}
+
+// Input handed to zstd that its workers haven't consumed yet. It grows while the
+// workers can't keep up at the current level, and stays within the job being filled when idle.
+void ZstdFileWriter::adaptLevel() {
+  ZSTD_frameProgression progress = ZSTD_getFrameProgression(cstream_);
+  size_t backlog = progress.ingested - progress.consumed;
+
+  int level = level_;
+  if (backlog > ADAPT_JOB_SIZE * (workers_ + 1) && backlog > prev_backlog_ && level > config_.min_level) {
+    --level;
+  } else if (backlog <= ADAPT_JOB_SIZE && level < config_.level) {
+    ++level;
+  }
+  if (level != level_) {
+    size_t ret = ZSTD_CCtx_setParameter(cstream_, ZSTD_c_compressionLevel, level);
+    assert(!ZSTD_isError(ret));
+    level_ = level;
+  }
+  prev_backlog_ = backlog;
+}
+
+void ZstdFileWriter::compressThread() {
+  util::set_thread_name("zstd_writer");
+
+  std::unique_lock lk(lock_);
+  while (true) {
+    cv_.wait(lk, [this]() { return !pending_chunks_.empty(); });
+    Chunk chunk = std::move(pending_chunks_.front());
+    pending_chunks_.pop_front();
+    bool last_chunk = closing_ && pending_chunks_.empty();
+
+    lk.unlock();
+    compress(chunk.data, chunk.end_frame);
+    chunk.data.clear();
+    lk.lock();
+
+    free_chunks_.push_back(std::move(chunk.data));
+    cv_.notify_all();
+    if (last_chunk) break;
+  }
+}
+
+template <typename T>
+static void append_le(std::vector<char> &buf, T value) {
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+  buf.insert(buf.end(), (const char *)&value, (const char *)&value + sizeof(value));
+}
+
+void ZstdFileWriter::writeSeekTable() {
+  assert(frame_mono_times_.size() == seek_table_.size());
+
+  std::vector<char> buf;
+  append_le<uint32_t>(buf, ZSTD_MONO_TIME_INDEX_MAGIC);
+  append_le<uint32_t>(buf, frame_mono_times_.size() * sizeof(uint64_t));
+  for (uint64_t mono_time : frame_mono_times_) {
+    append_le<uint64_t>(buf, mono_time);
+  }
+  seek_table_.push_back({buf.size(), 0});
+
+  const size_t table_start = buf.size();
+  append_le<uint32_t>(buf, ZSTD_SEEK_TABLE_MAGIC);
+  append_le<uint32_t>(buf, seek_table_.size() * 8 + 9);
+  for (const auto &[compressed, decompressed] : seek_table_) {
+    append_le<uint32_t>(buf, compressed);
+    append_le<uint32_t>(buf, decompressed);
+  }
+  append_le<uint32_t>(buf, seek_table_.size());
+  append_le<uint8_t>(buf, 0);  // descriptor: no checksums
+  append_le<uint32_t>(buf, ZSTD_SEEKABLE_MAGIC);
+  assert(buf.size() - table_start == seek_table_.size() * 8 + 17);
+
+  size_t written = util::safe_fwrite(buf.data(), 1, buf.size(), file_);
+  assert(written == buf.size());
 }
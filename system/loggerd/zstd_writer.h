@@ -2,23 +2,96 @@
 
 #include <zstd.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <capnp/common.h>
 
+struct ZstdCompressionConfig {
+  int level = 10;
+  int workers = 0;              // ZSTD_c_nbWorkers, 0 compresses on the writing thread
+  bool long_distance = false;   // ZSTD_c_enableLongDistanceMatching, needs a 128MB window to decompress
+  // lower the level towards min_level while the workers can't keep up with the input,
+  // and raise it back to level when idle. zstd only applies a new level to the next job
+  // of its worker pool, so this implies workers >= 1.
+  bool adaptive = false;
+  int min_level = 1;
+  // LoggerState starts seekable frames (see below). off until all log readers read across frames.
+  bool seekable = false;
+};
+
+// Files written with newFrame() follow the zstd seekable format
+// (https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md):
+// independent frames, then a skippable frame with the logMonoTime of each frame (one uint64 each), then the
+// seek table in a skippable frame, which lists the index as a frame with no decompressed data. zstd decoders
+// that read across frames skip both and get the same stream as before, but readers that stop at the end of
+// the first frame don't.
+constexpr uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+constexpr uint32_t ZSTD_SEEK_TABLE_MAGIC = 0x184D2A5E;       // skippable frame
+constexpr uint32_t ZSTD_MONO_TIME_INDEX_MAGIC = 0x184D2A5D;  // skippable frame
+
 class ZstdFileWriter {
 public:
-  ZstdFileWriter(const std::string &filename, int compression_level);
+  // with async, compression and file writes run on a worker thread and write() only copies into a chunk.
+  // write() blocks only when MAX_PENDING_CHUNKS chunks are waiting to be compressed.
+  ZstdFileWriter(const std::string &filename, const ZstdCompressionConfig &config, bool async = false);
+  ZstdFileWriter(const std::string &filename, int compression_level, bool async = false)
+      : ZstdFileWriter(filename, ZstdCompressionConfig{.level = compression_level}, async) {}
   ~ZstdFileWriter();
   void write(void* data, size_t size);
   inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  inline int level() const { return level_; }
+  // end the current frame, the next write() starts a frame that decompresses on its own.
+  // mono_time is the logMonoTime of its first event.
+  void newFrame(uint64_t mono_time);
+  // uncompressed bytes written to the current frame
+  inline size_t frameSize() const { return frame_size_; }
 
 private:
-  void flushCache(bool last_chunk);
+  static constexpr int MAX_PENDING_CHUNKS = 4;
+  static constexpr int ADAPT_INTERVAL_CHUNKS = 8;
+  static constexpr int ADAPT_JOB_SIZE = 1024 * 1024;
+
+  struct Chunk {
+    std::vector<char> data;
+    bool end_frame = false;
+  };
+
+  void flushCache(bool end_frame, bool last_chunk = false);
+  void compress(const std::vector<char> &chunk, bool end_frame);
+  void compressThread();
+  void adaptLevel();
+  void writeSeekTable();
 
   size_t input_cache_capacity_ = 0;
   std::vector<char> input_cache_;
   std::vector<char> output_buffer_;
   ZSTD_CStream *cstream_;
   FILE* file_ = nullptr;
+
+  // seekable frames. frame_mono_times_ is only touched by the writing thread, seek_table_ by whichever thread compresses.
+  size_t frame_size_ = 0, frame_count_ = 0;
+  std::vector<uint64_t> frame_mono_times_;
+  size_t frame_compressed_ = 0, frame_decompressed_ = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> seek_table_;  // (compressed, decompressed) size of each frame
+
+  // adaptive level
+  ZstdCompressionConfig config_;
+  int workers_ = 0;
+  std::atomic<int> level_;
+  size_t prev_backlog_ = 0;
+  int chunks_since_adapt_ = 0;
+
+  // async mode
+  std::thread thread_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<Chunk> pending_chunks_;
+  std::deque<std::vector<char>> free_chunks_;
+  bool closing_ = false;
 };
@@ -302,6 +302,7 @@ void BinaryViewModel::updateState() {
     endInsertRows();
   }
 
+  const auto &colors = last_msg.colors(can->currentSec(), can->getSpeed());
   auto &bit_flips = heatmap_live_mode ? last_msg.bit_flip_counts : getBitFlipChanges(binary.size());
   // Find the maximum bit flip count across the message
   uint32_t max_bit_flip_count = 1;  // Default to 1 to avoid division by zero
@@ -334,7 +335,7 @@ void BinaryViewModel::updateState() {
       color.setAlpha(alpha);
       updateItem(i, j, bit_val, color);
     }
-    updateItem(i, 8, binary[i], last_msg.colors[i]);
+    updateItem(i, 8, binary[i], colors[i]);
   }
 }
 
@@ -351,19 +352,19 @@ const std::vector<std::array<uint32_t, 8>> &BinaryViewModel::getBitFlipChanges(s
   auto [first, last] = can->eventsInRange(msg_id, time_range);
   if (std::distance(first, last) <= 1) return bit_flip_tracker.flip_counts;
 
-  std::vector<uint8_t> prev_values((*first)->dat, (*first)->dat + (*first)->size);
+  std::vector<uint8_t> prev_values(first->dat, first->dat + first->size);
   for (auto it = std::next(first); it != last; ++it) {
-    const CanEvent *event = *it;
-    int size = std::min<int>(msg_size, event->size);
+    const CanEvent event = *it;
+    int size = std::min<int>(msg_size, event.size);
     for (int i = 0; i < size; ++i) {
-      const uint8_t diff = event->dat[i] ^ prev_values[i];
+      const uint8_t diff = event.dat[i] ^ prev_values[i];
       if (!diff) continue;
 
       auto &bit_flips = bit_flip_tracker.flip_counts[i];
       for (int bit = 0; bit < 8; ++bit) {
         if (diff & (1u << bit)) ++bit_flips[7 - bit];
       }
-      prev_values[i] = event->dat[i];
+      prev_values[i] = event.dat[i];
     }
   }
 
@@ -282,15 +282,15 @@ void ChartView::updateSeriesPoints() {
   }
 }
 
-void ChartView::appendCanEvents(const cabana::Signal *sig, const std::vector<const CanEvent *> &events,
+void ChartView::appendCanEvents(const cabana::Signal *sig, const MessageEvents &events,
                                 std::vector<QPointF> &vals, std::vector<QPointF> &step_vals) {
-  vals.reserve(vals.size() + events.capacity());
-  step_vals.reserve(step_vals.size() + events.capacity() * 2);
+  vals.reserve(vals.size() + events.size());
+  step_vals.reserve(step_vals.size() + events.size() * 2);
 
   double value = 0;
-  for (const CanEvent *e : events) {
-    if (sig->getValue(e->dat, e->size, &value)) {
-      const double ts = can->toSeconds(e->mono_time);
+  for (const CanEvent e : events) {
+    if (sig->getValue(e.dat, e.size, &value)) {
+      const double ts = can->toSeconds(e.mono_time);
       vals.emplace_back(ts, value);
       if (!step_vals.empty())
         step_vals.emplace_back(ts, step_vals.back().y());
@@ -310,7 +310,7 @@ void ChartView::updateSeries(const cabana::Signal *sig, const MessageEventsMap *
       auto it = events->find(s.msg_id);
       if (it == events->end() || it->second.empty()) continue;
 
-      if (s.vals.empty() || can->toSeconds(it->second.back()->mono_time) > s.vals.back().x()) {
+      if (s.vals.empty() || can->toSeconds(it->second.back().mono_time) > s.vals.back().x()) {
         appendCanEvents(s.sig, it->second, s.vals, s.step_vals);
       } else {
         std::vector<QPointF> vals, step_vals;
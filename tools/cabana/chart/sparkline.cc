@@ -15,13 +15,14 @@ void Sparkline::update(const cabana::Signal *sig, CanEventIter first, CanEventIt
   max_val = std::numeric_limits<double>::lowest();
   points_.reserve(std::distance(first, last));
 
-  uint64_t start_time = (*first)->mono_time;
+  uint64_t start_time = first.monoTime();
   double value = 0.0;
   for (auto it = first; it != last; ++it) {
-    if (sig->getValue((*it)->dat, (*it)->size, &value)) {
+    const CanEvent e = *it;
+    if (sig->getValue(e.dat, e.size, &value)) {
       min_val = std::min(min_val, value);
       max_val = std::max(max_val, value);
-      points_.emplace_back(((*it)->mono_time - start_time) / 1e9, value);
+      points_.emplace_back((e.mono_time - start_time) / 1e9, value);
     }
   }
 
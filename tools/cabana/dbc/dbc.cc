@@ -203,7 +203,7 @@ double get_raw_value(const uint8_t *data, size_t data_size, const cabana::Signal
   }
 
   // Sign extension (if needed)
-  if (sig.is_signed && (val & (1ULL << (sig.size - 1)))) {
+  if (sig.is_signed && sig.size < 64 && (val & (1ULL << (sig.size - 1)))) {
     val |= ~((1ULL << sig.size) - 1);
   }
 
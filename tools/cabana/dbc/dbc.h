@@ -11,6 +11,8 @@
 #include <QColor>
 #include <QMetaType>
 
+#include "tools/cabana/utils/flatmap.h"
+
 const std::string UNTITLED = "untitled";
 const std::string DEFAULT_NODE_NAME = "XXX";
 constexpr int CAN_MAX_DATA_BYTES = 64;
@@ -54,7 +56,7 @@ Q_DECLARE_METATYPE(MessageId);
 template <>
 struct std::hash<MessageId> {
   std::size_t operator()(const MessageId &k) const noexcept {
-    return std::hash<uint8_t>{}(k.source) ^ (std::hash<uint32_t>{}(k.address) << 1);
+    return hash_mix(uint64_t(k.source) << 32 | k.address);
   }
 };
 
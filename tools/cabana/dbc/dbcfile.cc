@@ -41,6 +41,7 @@ bool DBCFile::writeContents(const std::string &fn) {
 
 void DBCFile::updateMsg(const MessageId &id, const std::string &name, uint32_t size, const std::string &node, const std::string &comment) {
   auto &m = msgs[id.address];
+  msg_index[id.address] = &m;
   m.address = id.address;
   m.name = name;
   m.size = size;
@@ -48,9 +49,14 @@ void DBCFile::updateMsg(const MessageId &id, const std::string &name, uint32_t s
   m.comment = comment;
 }
 
+void DBCFile::removeMsg(const MessageId &id) {
+  msgs.erase(id.address);
+  msg_index.erase(id.address);
+}
+
 cabana::Msg *DBCFile::msg(uint32_t address) {
-  auto it = msgs.find(address);
-  return it != msgs.end() ? &it->second : nullptr;
+  auto it = msg_index.find(address);
+  return it != msg_index.end() ? it->second : nullptr;
 }
 
 cabana::Msg *DBCFile::msg(const std::string &name) {
@@ -65,6 +71,7 @@ cabana::Signal *DBCFile::signal(uint32_t address, const std::string &name) {
 
 void DBCFile::parse(const QString &content) {
   msgs.clear();
+  msg_index.clear();
 
   int line_num = 0;
   QString line;
@@ -123,6 +130,7 @@ cabana::Msg *DBCFile::parseBO(const QString &line) {
 
   // Create a new message object
   cabana::Msg *msg = &msgs[address];
+  msg_index[address] = msg;
   msg->address = address;
   msg->name = match.captured("name").toStdString();
   msg->size = match.captured("size").toULong();
@@ -5,11 +5,14 @@
 #include <QTextStream>
 
 #include "tools/cabana/dbc/dbc.h"
+#include "tools/cabana/utils/flatmap.h"
 
 class DBCFile {
 public:
   DBCFile(const std::string &dbc_file_name);
   DBCFile(const std::string &name, const std::string &content);
+  DBCFile(const DBCFile &) = delete;
+  DBCFile &operator=(const DBCFile &) = delete;
   ~DBCFile() {}
 
   bool save();
@@ -18,7 +21,7 @@ public:
   std::string generateDBC();
 
   void updateMsg(const MessageId &id, const std::string &name, uint32_t size, const std::string &node, const std::string &comment);
-  inline void removeMsg(const MessageId &id) { msgs.erase(id.address); }
+  void removeMsg(const MessageId &id);
 
   inline const std::map<uint32_t, cabana::Msg> &getMessages() const { return msgs; }
   cabana::Msg *msg(uint32_t address);
@@ -41,5 +44,6 @@ private:
 
   std::string header;
   std::map<uint32_t, cabana::Msg> msgs;
+  FlatMap<uint32_t, cabana::Msg *, IntHash> msg_index;  // msgs by address, for lookups
   std::string name_;
 };
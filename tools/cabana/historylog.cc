@@ -86,7 +86,7 @@ void HistoryLogModel::updateState(bool clear) {
 
 bool HistoryLogModel::canFetchMore(const QModelIndex &parent) const {
   const auto &events = can->events(msg_id);
-  return !events.empty() && !messages.empty() && messages.back().mono_time > events.front()->mono_time;
+  return !events.empty() && !messages.empty() && messages.back().mono_time > events.front().mono_time;
 }
 
 void HistoryLogModel::fetchMore(const QModelIndex &parent) {
@@ -96,20 +96,20 @@ void HistoryLogModel::fetchMore(const QModelIndex &parent) {
 
 void HistoryLogModel::fetchData(std::deque<Message>::iterator insert_pos, uint64_t from_time, uint64_t min_time) {
   const auto &events = can->events(msg_id);
-  auto first = std::upper_bound(events.rbegin(), events.rend(), from_time, [](uint64_t ts, auto e) {
-    return ts > e->mono_time;
-  });
+  // newest first. CanEventIterator is a proxy iterator, so walk it back by hand instead of through
+  // std::reverse_iterator, whose operator-> doesn't work with it on libc++
+  auto last = events.lowerBound(from_time);
 
   std::vector<HistoryLogModel::Message> msgs;
   std::vector<double> values(sigs.size());
   msgs.reserve(batch_size);
-  for (; first != events.rend() && (*first)->mono_time > min_time; ++first) {
-    const CanEvent *e = *first;
+  while (last != events.begin() && (last - 1).monoTime() > min_time) {
+    const CanEvent e = *--last;
     for (int i = 0; i < sigs.size(); ++i) {
-      sigs[i]->getValue(e->dat, e->size, &values[i]);
+      sigs[i]->getValue(e.dat, e.size, &values[i]);
     }
     if (!filter_cmp || filter_cmp(values[filter_sig_idx], filter_value)) {
-       msgs.emplace_back(Message{e->mono_time, values, {e->dat, e->dat + e->size}});
+       msgs.emplace_back(Message{e.mono_time, values, {e.dat, e.dat + e.size}});
       if (msgs.size() >= batch_size && min_time == 0) {
         break;
       }
@@ -120,9 +120,11 @@ void HistoryLogModel::fetchData(std::deque<Message>::iterator insert_pos, uint64
     if (isHexMode() && (min_time > 0 || messages.empty())) {
       const auto freq = can->lastMessage(msg_id).freq;
       const std::vector<uint8_t> no_mask;
-      for (auto &m : msgs) {
-        hex_colors.compute(msg_id, m.data.data(), m.data.size(), m.mono_time / (double)1e9, can->getSpeed(), no_mask, freq);
-        m.colors = hex_colors.colors;
+      // msgs are newest first, the colors fade from the changes before them
+      for (auto it = msgs.rbegin(); it != msgs.rend(); ++it) {
+        const double sec = it->mono_time / (double)1e9;
+        hex_colors.compute(it->data.data(), it->data.size(), sec, no_mask, freq);
+        it->colors = hex_colors.colors(sec, can->getSpeed());
       }
     }
     int pos = std::distance(messages.begin(), insert_pos);
@@ -1,19 +1,32 @@
 #include "tools/cabana/streams/abstractstream.h"
 
+#include <cstring>
 #include <limits>
 #include <utility>
 
 #include <QApplication>
-#include "common/timing.h"
 #include "tools/cabana/settings.h"
 
-static const int EVENT_NEXT_BUFFER_SIZE = 6 * 1024 * 1024;  // 6MB
+// the longest stretch of events a seek replays for each message
+static const uint64_t CHECKPOINT_INTERVAL = 20 * 1000000000ULL;
 
 AbstractStream *can = nullptr;
 
+namespace {
+
+void clearMaskedBitFlips(CanData &m, const std::vector<uint8_t> &mask) {
+  const int size = std::min(mask.size(), m.bit_flip_counts.size());
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      if (((mask[i] >> (7 - j)) & 1) != 0) m.bit_flip_counts[i][j] = 0;
+    }
+  }
+}
+
+}  // namespace
+
 AbstractStream::AbstractStream(QObject *parent) : QObject(parent) {
   assert(parent != nullptr);
-  event_buffer_ = std::make_unique<MonotonicBuffer>(EVENT_NEXT_BUFFER_SIZE);
 
   QObject::connect(this, &AbstractStream::privateUpdateLastMsgsSignal, this, &AbstractStream::updateLastMessages, Qt::QueuedConnection);
   QObject::connect(this, &AbstractStream::seekedTo, this, &AbstractStream::updateLastMsgsTo);
@@ -35,13 +48,7 @@ void AbstractStream::updateMasks() {
   }
   // clear bit change counts
   for (auto &[id, m] : messages_) {
-    auto &mask = masks_[id];
-    const int size = std::min(mask.size(), m.last_changes.size());
-    for (int i = 0; i < size; ++i) {
-      for (int j = 0; j < 8; ++j) {
-        if (((mask[i] >> (7 - j)) & 1) != 0) m.bit_flip_counts[i][j] = 0;
-      }
-    }
+    clearMaskedBitFlips(m, masks_[id]);
   }
 }
 
@@ -111,12 +118,12 @@ void AbstractStream::setTimeRange(const std::optional<std::pair<double, double>>
 
 void AbstractStream::updateEvent(const MessageId &id, double sec, const uint8_t *data, uint8_t size) {
   std::lock_guard lk(mutex_);
-  messages_[id].compute(id, data, size, sec, getSpeed(), masks_[id]);
+  messages_[id].compute(data, size, sec, masks_[id]);
   new_msgs_.insert(id);
 }
 
-const std::vector<const CanEvent *> &AbstractStream::events(const MessageId &id) const {
-  static std::vector<const CanEvent *> empty_events;
+const MessageEvents &AbstractStream::events(const MessageId &id) const {
+  static MessageEvents empty_events;
   auto it = events_.find(id);
   return it != events_.end() ? it->second : empty_events;
 }
@@ -145,26 +152,40 @@ bool AbstractStream::isMessageActive(const MessageId &id) const {
 void AbstractStream::updateLastMsgsTo(double sec) {
   current_sec_ = sec;
   uint64_t last_ts = toMonoTime(sec);
-  std::unordered_map<MessageId, CanData> msgs;
+  FlatMap<MessageId, CanData> msgs;
   msgs.reserve(events_.size());
 
   for (const auto &[id, ev] : events_) {
-    auto it = std::upper_bound(ev.begin(), ev.end(), last_ts, CompareCanEvent());
-    if (it != ev.begin()) {
-      auto &m = msgs[id];
-      double freq = 0;
-      // Keep suppressed bits.
-      if (auto old_m = messages_.find(id); old_m != messages_.end()) {
-        freq = old_m->second.freq;
-        m.last_changes.reserve(old_m->second.last_changes.size());
-        std::transform(old_m->second.last_changes.cbegin(), old_m->second.last_changes.cend(),
-                       std::back_inserter(m.last_changes),
-                       [](const auto &change) { return CanData::ByteLastChange{.suppressed = change.suppressed}; });
+    auto last = ev.upperBound(last_ts);
+    if (last == ev.begin()) continue;
+
+    auto &m = msgs[id];
+    auto &cp = checkpoints_[id];
+    if (cp.state.count <= last.index()) {
+      updateCheckpoints(cp, ev, last.index());
+      m = cp.state;
+    } else {
+      // start from the last checkpoint before sec and replay the events after it
+      auto it = std::upper_bound(cp.checkpoints.begin(), cp.checkpoints.end(), last_ts,
+                                 [](uint64_t ts, const auto &c) { return ts < c.mono_time; });
+      if (it != cp.checkpoints.begin()) {
+        m = std::prev(it)->data;
+      }
+      for (auto e_it = ev.begin() + m.count; e_it != last; ++e_it) {
+        const CanEvent e = *e_it;
+        m.compute(e.dat, e.size, toSeconds(e.mono_time), {});
       }
+    }
 
-      auto prev = std::prev(it);
-      m.compute(id, (*prev)->dat, (*prev)->size, toSeconds((*prev)->mono_time), getSpeed(), {}, freq);
-      m.count = std::distance(ev.begin(), prev) + 1;
+    // Keep suppressed bits.
+    if (auto old_m = messages_.find(id); old_m != messages_.end()) {
+      const auto &old_changes = old_m->second.last_changes;
+      for (size_t i = 0; i < std::min(old_changes.size(), m.last_changes.size()); ++i) {
+        m.last_changes[i].suppressed = old_changes[i].suppressed;
+      }
+    }
+    if (auto mask = masks_.find(id); mask != masks_.end()) {
+      clearMaskedBitFlips(m, mask->second);
     }
   }
 
@@ -187,37 +208,47 @@ void AbstractStream::waitForSeekFinshed() {
   seek_finished_ = false;
 }
 
-const CanEvent *AbstractStream::newEvent(uint64_t mono_time, const cereal::CanData::Reader &c) {
+void AbstractStream::addEvent(NewCanEvents &new_events, uint64_t mono_time, const cereal::CanData::Reader &c) {
   auto dat = c.getDat();
-  CanEvent *e = (CanEvent *)event_buffer_->allocate(sizeof(CanEvent) + sizeof(uint8_t) * dat.size());
-  e->src = c.getSrc();
-  e->address = c.getAddress();
-  e->mono_time = mono_time;
-  e->size = dat.size();
-  memcpy(e->dat, (uint8_t *)dat.begin(), e->size);
-  return e;
+  new_events.push_back(mono_time, {.source = (uint8_t)c.getSrc(), .address = c.getAddress()}, (const uint8_t *)dat.begin(), dat.size());
 }
 
-void AbstractStream::mergeEvents(const std::vector<const CanEvent *> &events) {
-  static MessageEventsMap msg_events;
-  std::for_each(msg_events.begin(), msg_events.end(), [](auto &e) { e.second.clear(); });
+void AbstractStream::mergeEvents(const NewCanEvents &new_events) {
+  if (!new_events.empty()) {
+    all_events_.merge(events_, new_events);
+    invalidateCheckpoints(new_events);
+    emit eventsMerged(new_events.events);
+  }
+}
 
-  // Group events by message ID
-  for (auto e : events) {
-    msg_events[{.source = e->src, .address = e->address}].push_back(e);
+void AbstractStream::invalidateCheckpoints(const NewCanEvents &new_events) {
+  for (const auto &[id, new_e] : new_events.events) {
+    if (new_e.empty()) continue;
+
+    auto &[checkpoints, state] = checkpoints_[id];
+    const auto &events = events_.at(id);
+    // the new events went in after every event that isn't newer than the first of them,
+    // so only the states past that have to be redone, by the next seek past them
+    const uint64_t first_ts = new_e.front().mono_time;
+    checkpoints.erase(std::upper_bound(checkpoints.begin(), checkpoints.end(), first_ts,
+                                       [](uint64_t ts, const auto &c) { return ts < c.mono_time; }),
+                      checkpoints.end());
+    if (state.count > events.lowerBound(first_ts).index()) {
+      state = checkpoints.empty() ? CanData{} : checkpoints.back().data;
+    }
   }
+}
 
-  if (!events.empty()) {
-    for (const auto &[id, new_e] : msg_events) {
-      if (!new_e.empty()) {
-        auto &e = events_[id];
-        auto pos = std::upper_bound(e.cbegin(), e.cend(), new_e.front()->mono_time, CompareCanEvent());
-        e.insert(pos, new_e.cbegin(), new_e.cend());
-      }
+void AbstractStream::updateCheckpoints(MessageCheckpoints &cp, const MessageEvents &events, size_t end) {
+  auto &[checkpoints, state] = cp;
+  for (auto it = events.begin() + state.count; it != events.begin() + end; ++it) {
+    const CanEvent e = *it;
+    const uint64_t boundary = e.mono_time / CHECKPOINT_INTERVAL * CHECKPOINT_INTERVAL;
+    if (state.count > 0 && events.monoTime(state.count - 1) < boundary &&
+        (checkpoints.empty() || checkpoints.back().mono_time < boundary)) {
+      checkpoints.push_back({boundary, state});
     }
-    auto pos = std::upper_bound(all_events_.cbegin(), all_events_.cend(), events.front()->mono_time, CompareCanEvent());
-    all_events_.insert(pos, events.cbegin(), events.cend());
-    emit eventsMerged(msg_events);
+    state.compute(e.dat, e.size, toSeconds(e.mono_time), {});
   }
 }
 
@@ -225,8 +256,8 @@ std::pair<CanEventIter, CanEventIter> AbstractStream::eventsInRange(const Messag
   const auto &events = can->events(id);
   if (!time_range) return {events.begin(), events.end()};
 
-  auto first = std::lower_bound(events.begin(), events.end(), can->toMonoTime(time_range->first), CompareCanEvent());
-  auto last = std::upper_bound(first, events.end(), can->toMonoTime(time_range->second), CompareCanEvent());
+  auto first = events.lowerBound(can->toMonoTime(time_range->first));
+  auto last = std::max(first, events.upperBound(can->toMonoTime(time_range->second)));
   return {first, last};
 }
 
@@ -243,83 +274,106 @@ QColor getColor(int c) {
   return settings.theme == LIGHT_THEME ? colors[c] : colors[c].lighter(135);
 }
 
-inline QColor blend(const QColor &a, const QColor &b) {
-  return QColor((a.red() + b.red()) / 2, (a.green() + b.green()) / 2, (a.blue() + b.blue()) / 2, (a.alpha() + b.alpha()) / 2);
-}
-
-// Calculate the frequency from the past one minute data
-double calc_freq(const MessageId &msg_id, double current_sec) {
-  auto [first, last] = can->eventsInRange(msg_id, std::make_pair(current_sec - 59, current_sec));
-  int count = std::distance(first, last);
-  if (count <= 1) return 0.0;
-
-  double duration = ((*std::prev(last))->mono_time - (*first)->mono_time) / 1e9;
-  return duration > std::numeric_limits<double>::epsilon() ? (count - 1) / duration : 0.0;
+// up to 8 bytes as a word, byte i in bits 8 * i to 8 * i + 7
+inline uint64_t load_word(const uint8_t *data, int size) {
+  uint64_t word = 0;
+  memcpy(&word, data, size);
+  return word;
 }
 
 }  // namespace
 
-void CanData::compute(const MessageId &msg_id, const uint8_t *can_data, const int size, double current_sec,
-                      double playback_speed, const std::vector<uint8_t> &mask, double in_freq) {
+void CanData::compute(const uint8_t *can_data, const int size, double current_sec, const std::vector<uint8_t> &mask, double in_freq) {
   ts = current_sec;
   ++count;
-
-  if (auto sec = seconds_since_boot(); (sec - last_freq_update_ts) >= 1) {
-    last_freq_update_ts = sec;
-    freq = !in_freq ? calc_freq(msg_id, ts) : in_freq;
-  }
+  updateFreq(in_freq);
 
   if (dat.size() != size) {
     dat.assign(can_data, can_data + size);
-    colors.assign(size, QColor(0, 0, 0, 0));
     last_changes.resize(size);
     bit_flip_counts.resize(size);
     std::for_each(last_changes.begin(), last_changes.end(), [current_sec](auto &c) { c.ts = current_sec; });
-  } else {
-    constexpr int periodic_threshold = 10;
-    constexpr float fade_time = 2.0;
-    const float alpha_delta = 1.0 / (freq + 1) / (fade_time * playback_speed);
+    return;
+  }
 
-    for (int i = 0; i < size; ++i) {
-      auto &last_change = last_changes[i];
+  constexpr int periodic_threshold = 10;
+  // most words are the same as in the last frame, and only the changed bytes and bits are visited
+  for (int offset = 0; offset < size; offset += 8) {
+    const int n = std::min(8, size - offset);
+    const uint64_t last_word = load_word(&dat[offset], n);
+    const uint64_t cur_word = load_word(&can_data[offset], n);
+    if (last_word == cur_word) continue;
+
+    uint64_t watched = 0;
+    for (int j = 0; j < n; ++j) {
+      uint8_t mask_byte = last_changes[offset + j].suppressed ? 0x00 : 0xFF;
+      if (offset + j < mask.size()) mask_byte &= ~(mask[offset + j]);
+      watched |= uint64_t(mask_byte) << (j * 8);
+    }
+
+    for (uint64_t diff = (last_word ^ cur_word) & watched; diff != 0;) {
+      const int shift = __builtin_ctzll(diff) & ~7;
+      const int i = offset + shift / 8;
+      diff &= ~(0xFFull << shift);
 
-      uint8_t mask_byte = last_change.suppressed ? 0x00 : 0xFF;
-      if (i < mask.size()) mask_byte &= ~(mask[i]);
-
-      const uint8_t last = dat[i] & mask_byte;
-      const uint8_t cur = can_data[i] & mask_byte;
-      if (last != cur) {
-        const int delta = cur - last;
-        // Keep track if signal is changing randomly, or mostly moving in the same direction
-        last_change.same_delta_counter += std::signbit(delta) == std::signbit(last_change.delta) ? 1 : -4;
-        last_change.same_delta_counter = std::clamp(last_change.same_delta_counter, 0, 16);
-
-        const double delta_t = ts - last_change.ts;
-        // Mostly moves in the same direction, color based on delta up/down
-        if (delta_t * freq > periodic_threshold || last_change.same_delta_counter > 8) {
-          // Last change was while ago, choose color based on delta up or down
-          colors[i] = getColor(cur > last ? CYAN : RED);
-        } else {
-          // Periodic changes
-          colors[i] = blend(colors[i], getColor(GREYISH_BLUE));
-        }
-
-        // Track bit level changes
-        auto &row_bit_flips = bit_flip_counts[i];
-        const uint8_t diff = (cur ^ last);
-        for (int bit = 0; bit < 8; bit++) {
-          if (diff & (1u << bit)) {
-            ++row_bit_flips[7 - bit];
-          }
-        }
-
-        last_change.ts = ts;
-        last_change.delta = delta;
-      } else {
-        // Fade out
-        colors[i].setAlphaF(std::max(0.0, colors[i].alphaF() - alpha_delta));
+      auto &last_change = last_changes[i];
+      const uint8_t last = last_word >> shift & watched >> shift;
+      const uint8_t cur = cur_word >> shift & watched >> shift;
+      const int delta = cur - last;
+      // Keep track if signal is changing randomly, or mostly moving in the same direction
+      last_change.same_delta_counter += std::signbit(delta) == std::signbit(last_change.delta) ? 1 : -4;
+      last_change.same_delta_counter = std::clamp(last_change.same_delta_counter, 0, 16);
+      // Periodic changes, unless the last change was a while ago or it mostly moves in the same direction
+      last_change.periodic = (ts - last_change.ts) * freq <= periodic_threshold && last_change.same_delta_counter <= 8;
+      last_change.ts = ts;
+      last_change.delta = delta;
+
+      // Track bit level changes
+      auto &row_bit_flips = bit_flip_counts[i];
+      for (uint32_t bits = cur ^ last; bits != 0; bits &= bits - 1) {
+        ++row_bit_flips[7 - __builtin_ctz(bits)];
       }
     }
   }
   memcpy(dat.data(), can_data, size);
 }
+
+// frequency over the last 30 to 60 seconds, the same as counting the frames in it
+void CanData::updateFreq(double in_freq) {
+  constexpr double window = 30;
+  if (freq_window.count == 0 || ts < freq_window.start || ts - freq_window.start >= 2 * window) {
+    prev_freq_window = {};
+    freq_window = {.start = ts};
+  } else if (ts - freq_window.start >= window) {
+    prev_freq_window = freq_window;
+    freq_window = {.start = ts};
+  }
+  ++freq_window.count;
+
+  if (in_freq) {
+    freq = in_freq;
+  } else {
+    const uint32_t frames = prev_freq_window.count + freq_window.count;
+    const double duration = ts - (prev_freq_window.count ? prev_freq_window.start : freq_window.start);
+    freq = frames > 1 && duration > std::numeric_limits<double>::epsilon() ? (frames - 1) / duration : 0.0;
+  }
+}
+
+const std::vector<QColor> &CanData::colors(double current_sec, double playback_speed) const {
+  constexpr float fade_time = 2.0;
+  const QColor base[] = {getColor(GREYISH_BLUE), getColor(CYAN), getColor(RED)};
+
+  colors_.resize(last_changes.size());
+  for (size_t i = 0; i < last_changes.size(); ++i) {
+    const auto &c = last_changes[i];
+    if (c.delta == 0) {
+      colors_[i] = QColor(0, 0, 0, 0);
+      continue;
+    }
+    colors_[i] = base[c.periodic ? GREYISH_BLUE : c.delta > 0 ? CYAN : RED];
+    // Fade out
+    const double faded = std::max(0.0, current_sec - c.ts) / (fade_time * playback_speed);
+    colors_[i].setAlphaF(std::max(0.0, colors_[i].alphaF() - faded));
+  }
+  return colors_;
+}
@@ -7,7 +7,6 @@
 #include <mutex>
 #include <optional>
 #include <set>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -16,46 +15,43 @@
 
 #include "cereal/messaging/messaging.h"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/canevents.h"
+#include "tools/cabana/utils/flatmap.h"
 #include "tools/cabana/utils/util.h"
 #include "tools/replay/util.h"
 
 struct CanData {
-  void compute(const MessageId &msg_id, const uint8_t *dat, const int size, double current_sec,
-               double playback_speed, const std::vector<uint8_t> &mask, double in_freq = 0);
+  void compute(const uint8_t *dat, const int size, double current_sec, const std::vector<uint8_t> &mask, double in_freq = 0);
+  // colors of the bytes that changed recently, faded by how long ago that was at current_sec
+  const std::vector<QColor> &colors(double current_sec, double playback_speed) const;
 
   double ts = 0.;
   uint32_t count = 0;
   double freq = 0;
   std::vector<uint8_t> dat;
-  std::vector<QColor> colors;
 
   struct ByteLastChange {
     double ts = 0;
-    int delta = 0;
+    int delta = 0;  // 0 until it first changes
     int same_delta_counter = 0;
     bool suppressed = false;
+    bool periodic = false;  // changing back and forth rather than in one direction
   };
   std::vector<ByteLastChange> last_changes;
   std::vector<std::array<uint32_t, 8>> bit_flip_counts;
-  double last_freq_update_ts = 0;
-};
 
-struct CanEvent {
-  uint8_t src;
-  uint32_t address;
-  uint64_t mono_time;
-  uint8_t size;
-  uint8_t dat[];
-};
+  // frames counted for freq, the window before covers up to 30 s more
+  struct FreqWindow {
+    double start = 0;  // time of its first frame
+    uint32_t count = 0;
+  };
+  FreqWindow freq_window, prev_freq_window;
 
-struct CompareCanEvent {
-  constexpr bool operator()(const CanEvent *const e, uint64_t ts) const { return e->mono_time < ts; }
-  constexpr bool operator()(uint64_t ts, const CanEvent *const e) const { return ts < e->mono_time; }
+private:
+  void updateFreq(double in_freq);
+  mutable std::vector<QColor> colors_;
 };
 
-typedef std::unordered_map<MessageId, std::vector<const CanEvent *>> MessageEventsMap;
-using CanEventIter = std::vector<const CanEvent *>::const_iterator;
-
 class AbstractStream : public QObject {
   Q_OBJECT
 
@@ -82,12 +78,12 @@ public:
   inline uint64_t toMonoTime(double sec) const { return beginMonoTime() + std::max(sec, 0.0) * 1e9; }
   inline double toSeconds(uint64_t mono_time) const { return std::max(0.0, (mono_time - beginMonoTime()) / 1e9); }
 
-  inline const std::unordered_map<MessageId, CanData> &lastMessages() const { return last_msgs; }
+  inline const FlatMap<MessageId, CanData> &lastMessages() const { return last_msgs; }
   bool isMessageActive(const MessageId &id) const;
   inline const MessageEventsMap &eventsMap() const { return events_; }
-  inline const std::vector<const CanEvent *> &allEvents() const { return all_events_; }
+  inline const AllCanEvents &allEvents() const { return all_events_; }
   const CanData &lastMessage(const MessageId &id) const;
-  const std::vector<const CanEvent *> &events(const MessageId &id) const;
+  const MessageEvents &events(const MessageId &id) const;
   std::pair<CanEventIter, CanEventIter> eventsInRange(const MessageId &id, std::optional<std::pair<double, double>> time_range) const;
 
   size_t suppressHighlighted();
@@ -109,11 +105,11 @@ public:
   SourceSet sources;
 
 protected:
-  void mergeEvents(const std::vector<const CanEvent *> &events);
-  const CanEvent *newEvent(uint64_t mono_time, const cereal::CanData::Reader &c);
+  void mergeEvents(const NewCanEvents &new_events);
+  static void addEvent(NewCanEvents &new_events, uint64_t mono_time, const cereal::CanData::Reader &c);
   void updateEvent(const MessageId &id, double sec, const uint8_t *data, uint8_t size);
   void waitForSeekFinshed();
-  std::vector<const CanEvent *> all_events_;
+  AllCanEvents all_events_;
   double current_sec_ = 0;
   std::optional<std::pair<double, double>> time_range_;
 
@@ -121,18 +117,33 @@ private:
   void updateLastMessages();
   void updateLastMsgsTo(double sec);
   void updateMasks();
+  void invalidateCheckpoints(const NewCanEvents &new_events);
+
+  // CanData of a message at the start of every CHECKPOINT_INTERVAL of mono time it was sent in,
+  // so a seek only replays the events after the last checkpoint before it. Seeks past state build
+  // them, merges only drop the ones after their first new event, so merging stays cheap on the UI thread.
+  struct MessageCheckpoints {
+    struct Checkpoint {
+      uint64_t mono_time;
+      CanData data;  // after every event before mono_time
+    };
+    std::vector<Checkpoint> checkpoints;
+    CanData state;  // after the first state.count events
+  };
+  // computes cp.state up to the events before end, adding the checkpoints on the way
+  void updateCheckpoints(MessageCheckpoints &cp, const MessageEvents &events, size_t end);
 
   MessageEventsMap events_;
-  std::unordered_map<MessageId, CanData> last_msgs;
-  std::unique_ptr<MonotonicBuffer> event_buffer_;
+  FlatMap<MessageId, MessageCheckpoints> checkpoints_;
+  FlatMap<MessageId, CanData> last_msgs;
 
   // Members accessed in multiple threads. (mutex protected)
   std::mutex mutex_;
   std::condition_variable seek_finished_cv_;
   bool seek_finished_ = false;
   std::set<MessageId> new_msgs_;
-  std::unordered_map<MessageId, CanData> messages_;
-  std::unordered_map<MessageId, std::vector<uint8_t>> masks_;
+  FlatMap<MessageId, CanData> messages_;
+  FlatMap<MessageId, std::vector<uint8_t>> masks_;
 };
 
 class AbstractOpenStreamWidget : public QWidget {
@@ -0,0 +1,153 @@
+#include "tools/cabana/streams/canevents.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+// MessageEvents
+
+void MessageEvents::push_back(uint64_t mono_time, const uint8_t *dat, uint8_t size) {
+  if (empty()) size_ = size;
+  if (size > stride_) setStride(size);
+  if (size != size_ && sizes_.empty()) sizes_.assign(this->size(), size_);
+  if (!sizes_.empty()) sizes_.push_back(size);
+
+  mono_times_.push_back(mono_time);
+  const size_t offset = data_.size();
+  data_.resize(offset + stride_);
+  memcpy(data_.data() + offset, dat, size);
+}
+
+size_t MessageEvents::insert(const MessageEvents &other) {
+  if (other.empty()) return size();
+  if (empty()) size_ = other.size_;
+
+  const size_t pos = upperBound(other.mono_times_.front()).index();
+  if (other.stride_ > stride_) setStride(other.stride_);
+  if (!sizes_.empty() || !other.sizes_.empty() || other.size_ != size_) {
+    if (sizes_.empty()) sizes_.assign(size(), size_);
+    sizes_.insert(sizes_.begin() + pos, other.size(), 0);
+    for (size_t i = 0; i < other.size(); ++i) {
+      sizes_[pos + i] = other.frameSize(i);
+    }
+  }
+
+  mono_times_.insert(mono_times_.begin() + pos, other.mono_times_.begin(), other.mono_times_.end());
+  if (other.stride_ == stride_) {
+    data_.insert(data_.begin() + pos * stride_, other.data_.begin(), other.data_.end());
+  } else {
+    auto it = data_.insert(data_.begin() + pos * stride_, other.size() * stride_, 0);
+    for (size_t i = 0; i < other.size(); ++i) {
+      std::copy_n(other.data_.begin() + i * other.stride_, other.stride_, it + i * stride_);
+    }
+  }
+  return pos;
+}
+
+void MessageEvents::clear() {
+  mono_times_.clear();
+  data_.clear();
+  sizes_.clear();
+  stride_ = size_ = 0;
+}
+
+// a frame bigger than any before it, which only happens on CAN FD buses
+void MessageEvents::setStride(uint8_t stride) {
+  if (!empty()) {
+    std::vector<uint8_t> data(size() * stride, 0);
+    for (size_t i = 0; i < size(); ++i) {
+      std::copy_n(data_.begin() + i * stride_, stride_, data.begin() + i * stride);
+    }
+    data_ = std::move(data);
+  }
+  stride_ = stride;
+}
+
+MessageEvents::const_iterator MessageEvents::lowerBound(uint64_t mono_time) const {
+  return {this, size_t(std::lower_bound(mono_times_.begin(), mono_times_.end(), mono_time) - mono_times_.begin())};
+}
+
+MessageEvents::const_iterator MessageEvents::upperBound(uint64_t mono_time) const {
+  return {this, size_t(std::upper_bound(mono_times_.begin(), mono_times_.end(), mono_time) - mono_times_.begin())};
+}
+
+size_t MessageEvents::memoryUsage() const {
+  return sizeof(*this) + mono_times_.capacity() * sizeof(uint64_t) + data_.capacity() + sizes_.capacity();
+}
+
+// NewCanEvents
+
+void NewCanEvents::push_back(uint64_t mono_time, const MessageId &id, const uint8_t *dat, uint8_t size) {
+  auto it = events.try_emplace(id, id).first;
+  it->second.push_back(mono_time, dat, size);
+  order.push_back(it - events.begin());
+}
+
+void NewCanEvents::clear() {
+  std::for_each(events.begin(), events.end(), [](auto &e) { e.second.clear(); });
+  order.clear();
+}
+
+// AllCanEvents
+
+void AllCanEvents::merge(MessageEventsMap &events, const NewCanEvents &new_events) {
+  if (new_events.empty()) return;
+
+  // the batch goes in one piece after every frame that isn't newer than its first one
+  const size_t pos = upperBound(new_events.events.begin()[new_events.order.front()].second.front().mono_time).index();
+
+  struct Merged {
+    uint32_t msg;
+    uint32_t row;  // where the next frame of the batch went
+  };
+  std::vector<Merged> merged(new_events.events.size());
+  std::vector<std::pair<uint32_t, uint32_t>> shifts(messages_.size(), {std::numeric_limits<uint32_t>::max(), 0});
+  bool added = false;
+  for (size_t i = 0; i < new_events.events.size(); ++i) {
+    const auto &[id, e] = new_events.events.begin()[i];
+    if (e.empty()) continue;
+
+    auto [it, inserted] = msg_index_.try_emplace(id, messages_.size());
+    auto &msg_events = events.try_emplace(id, id).first->second;
+    if (inserted) messages_.push_back(nullptr);
+    added |= inserted;
+    const uint32_t row = msg_events.insert(e);
+    merged[i] = {it->second, row};
+    if (!inserted) shifts[it->second] = {row, e.size()};
+  }
+  if (added) {
+    for (const auto &[id, msg] : msg_index_) {
+      messages_[msg] = &events.find(id)->second;
+    }
+  }
+
+  // frames that were inserted in front of moved the older rows of their message
+  for (size_t i = pos; i < refs_.size(); ++i) {
+    auto &ref = refs_[i];
+    if (ref.msg < shifts.size() && ref.row >= shifts[ref.msg].first) {
+      ref.row += shifts[ref.msg].second;
+    }
+  }
+
+  std::vector<Ref> refs;
+  refs.reserve(new_events.order.size());
+  for (uint32_t i : new_events.order) {
+    auto &m = merged[i];
+    refs.push_back({m.msg, m.row++});
+  }
+  refs_.insert(refs_.begin() + pos, refs.begin(), refs.end());
+}
+
+AllCanEvents::const_iterator AllCanEvents::lowerBound(uint64_t mono_time) const {
+  return std::partition_point(begin(), end(), [mono_time](const CanEvent &e) { return e.mono_time < mono_time; });
+}
+
+AllCanEvents::const_iterator AllCanEvents::upperBound(uint64_t mono_time) const {
+  return std::partition_point(begin(), end(), [mono_time](const CanEvent &e) { return e.mono_time <= mono_time; });
+}
+
+size_t AllCanEvents::memoryUsage() const {
+  return sizeof(*this) + refs_.capacity() * sizeof(Ref) + messages_.capacity() * sizeof(void *) +
+         msg_index_.size() * (sizeof(MessageId) + sizeof(uint32_t) + 2 * sizeof(uint64_t));
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "tools/cabana/dbc/dbc.h"
+#include "tools/cabana/utils/flatmap.h"
+
+// A frame, as seen through the store it's kept in. dat points into the store and
+// is only valid until more events are merged into it.
+struct CanEvent {
+  uint8_t src;
+  uint32_t address;
+  uint64_t mono_time;
+  uint8_t size;
+  const uint8_t *dat;
+};
+
+// Random access iterator over a store that makes the CanEvent of its i-th frame with at(i).
+template <class Store>
+class CanEventIterator {
+public:
+  struct ArrowProxy {
+    CanEvent e;
+    const CanEvent *operator->() const { return &e; }
+  };
+
+  using iterator_category = std::random_access_iterator_tag;
+  using value_type = CanEvent;
+  using difference_type = std::ptrdiff_t;
+  using pointer = ArrowProxy;
+  using reference = CanEvent;
+
+  CanEventIterator() = default;
+  CanEventIterator(const Store *store, size_t i) : store_(store), i_(i) {}
+
+  CanEvent operator*() const { return store_->at(i_); }
+  ArrowProxy operator->() const { return {store_->at(i_)}; }
+  CanEvent operator[](difference_type n) const { return store_->at(i_ + n); }
+  uint64_t monoTime() const { return store_->monoTime(i_); }
+  size_t index() const { return i_; }
+
+  CanEventIterator &operator++() { ++i_; return *this; }
+  CanEventIterator &operator--() { --i_; return *this; }
+  CanEventIterator operator++(int) { auto it = *this; ++i_; return it; }
+  CanEventIterator operator--(int) { auto it = *this; --i_; return it; }
+  CanEventIterator &operator+=(difference_type n) { i_ += n; return *this; }
+  CanEventIterator &operator-=(difference_type n) { i_ -= n; return *this; }
+  CanEventIterator operator+(difference_type n) const { return {store_, i_ + n}; }
+  CanEventIterator operator-(difference_type n) const { return {store_, i_ - n}; }
+  friend CanEventIterator operator+(difference_type n, const CanEventIterator &it) { return it + n; }
+  difference_type operator-(const CanEventIterator &other) const { return (difference_type)i_ - (difference_type)other.i_; }
+
+  bool operator==(const CanEventIterator &other) const { return i_ == other.i_; }
+  bool operator!=(const CanEventIterator &other) const { return i_ != other.i_; }
+  bool operator<(const CanEventIterator &other) const { return i_ < other.i_; }
+  bool operator>(const CanEventIterator &other) const { return i_ > other.i_; }
+  bool operator<=(const CanEventIterator &other) const { return i_ <= other.i_; }
+  bool operator>=(const CanEventIterator &other) const { return i_ >= other.i_; }
+
+private:
+  const Store *store_ = nullptr;
+  size_t i_ = 0;
+};
+
+// Frames of one message in time order, kept in columns: the timestamps, the payloads at a
+// fixed stride, and the payload sizes, which are only stored once they stop being the same.
+class MessageEvents {
+public:
+  using const_iterator = CanEventIterator<MessageEvents>;
+
+  MessageEvents(const MessageId &msg_id = {}) : id(msg_id) {}
+  void push_back(uint64_t mono_time, const uint8_t *dat, uint8_t size);
+  // inserts the frames of other after the frames that aren't newer than other's first one, returns where
+  size_t insert(const MessageEvents &other);
+  void clear();
+
+  inline CanEvent at(size_t i) const {
+    return {id.source, id.address, mono_times_[i], frameSize(i), data_.data() + i * stride_};
+  }
+  inline uint64_t monoTime(size_t i) const { return mono_times_[i]; }
+  inline uint8_t frameSize(size_t i) const { return sizes_.empty() ? size_ : sizes_[i]; }
+  inline size_t size() const { return mono_times_.size(); }
+  inline bool empty() const { return mono_times_.empty(); }
+  inline CanEvent front() const { return at(0); }
+  inline CanEvent back() const { return at(size() - 1); }
+  inline const_iterator begin() const { return {this, 0}; }
+  inline const_iterator end() const { return {this, size()}; }
+  inline const_iterator cbegin() const { return begin(); }
+  inline const_iterator cend() const { return end(); }
+  inline std::reverse_iterator<const_iterator> rbegin() const { return std::reverse_iterator(end()); }
+  inline std::reverse_iterator<const_iterator> rend() const { return std::reverse_iterator(begin()); }
+  // first frame at or after mono_time, and first frame after it
+  const_iterator lowerBound(uint64_t mono_time) const;
+  const_iterator upperBound(uint64_t mono_time) const;
+  size_t memoryUsage() const;
+
+  MessageId id;
+
+private:
+  void setStride(uint8_t stride);
+
+  std::vector<uint64_t> mono_times_;
+  std::vector<uint8_t> data_;   // stride_ bytes per frame
+  std::vector<uint8_t> sizes_;  // empty while every frame is size_ bytes
+  uint8_t stride_ = 0;
+  uint8_t size_ = 0;
+};
+
+typedef FlatMap<MessageId, MessageEvents> MessageEventsMap;
+using CanEventIter = MessageEvents::const_iterator;
+
+// Frames received since the last merge, grouped by message.
+struct NewCanEvents {
+  void push_back(uint64_t mono_time, const MessageId &id, const uint8_t *dat, uint8_t size);
+  // keeps the messages and their memory around for the next batch
+  void clear();
+  inline bool empty() const { return order.empty(); }
+  inline uint64_t lastMonoTime() const { return events.begin()[order.back()].second.back().mono_time; }
+
+  MessageEventsMap events;  // only ever added to, so entries keep their position in it
+  std::vector<uint32_t> order;  // position in events of the message of each frame, in the order they were received
+};
+
+// All frames in time order, as a (message, row) reference into the MessageEvents of each message.
+class AllCanEvents {
+public:
+  using const_iterator = CanEventIterator<AllCanEvents>;
+
+  // merges new_events into events, and adds them here
+  void merge(MessageEventsMap &events, const NewCanEvents &new_events);
+
+  inline CanEvent at(size_t i) const { return messages_[refs_[i].msg]->at(refs_[i].row); }
+  inline uint64_t monoTime(size_t i) const { return messages_[refs_[i].msg]->monoTime(refs_[i].row); }
+  inline size_t size() const { return refs_.size(); }
+  inline bool empty() const { return refs_.empty(); }
+  inline CanEvent front() const { return at(0); }
+  inline CanEvent back() const { return at(size() - 1); }
+  inline const_iterator begin() const { return {this, 0}; }
+  inline const_iterator end() const { return {this, size()}; }
+  inline const_iterator cbegin() const { return begin(); }
+  inline const_iterator cend() const { return end(); }
+  const_iterator lowerBound(uint64_t mono_time) const;
+  const_iterator upperBound(uint64_t mono_time) const;
+  size_t memoryUsage() const;
+
+private:
+  struct Ref {
+    uint32_t msg;  // index in messages_
+    uint32_t row;
+  };
+  std::vector<Ref> refs_;
+  std::vector<const MessageEvents *> messages_;  // into the events merged into, which may move them when it grows
+  FlatMap<MessageId, uint32_t> msg_index_;
+};
@@ -80,7 +80,7 @@ void LiveStream::handleEvent(kj::ArrayPtr<capnp::word> data) {
     const uint64_t mono_time = event.getLogMonoTime();
     std::lock_guard lk(lock);
     for (const auto &c : event.getCan()) {
-      received_events_.push_back(newEvent(mono_time, c));
+      addEvent(received_events_, mono_time, c);
     }
   }
 }
@@ -91,12 +91,12 @@ void LiveStream::timerEvent(QTimerEvent *event) {
       // merge events received from live stream thread.
       std::lock_guard lk(lock);
       mergeEvents(received_events_);
-      uint64_t last_received_ts = !received_events_.empty() ? received_events_.back()->mono_time : 0;
+      uint64_t last_received_ts = !received_events_.empty() ? received_events_.lastMonoTime() : 0;
       lastest_event_ts = std::max(lastest_event_ts, last_received_ts);
       received_events_.clear();
     }
     if (!all_events_.empty()) {
-      begin_event_ts = all_events_.front()->mono_time;
+      begin_event_ts = all_events_.front().mono_time;
       updateEvents();
       return;
     }
@@ -109,7 +109,7 @@ void LiveStream::updateEvents() {
 
   if (first_update_ts == 0) {
     first_update_ts = nanos_since_boot();
-    first_event_ts = current_event_ts = all_events_.back()->mono_time;
+    first_event_ts = current_event_ts = all_events_.back().mono_time;
   }
 
   if (paused_ || prev_speed != speed_) {
@@ -120,16 +120,16 @@ void LiveStream::updateEvents() {
   }
 
   uint64_t last_ts = post_last_event && speed_ == 1.0
-                       ? all_events_.back()->mono_time
+                       ? all_events_.back().mono_time
                        : first_event_ts + (nanos_since_boot() - first_update_ts) * speed_;
-  auto first = std::upper_bound(all_events_.cbegin(), all_events_.cend(), current_event_ts, CompareCanEvent());
-  auto last = std::upper_bound(first, all_events_.cend(), last_ts, CompareCanEvent());
+  auto first = all_events_.upperBound(current_event_ts);
+  auto last = std::max(first, all_events_.upperBound(last_ts));
 
   for (auto it = first; it != last; ++it) {
-    const CanEvent *e = *it;
-    MessageId id = {.source = e->src, .address = e->address};
-    updateEvent(id, (e->mono_time - begin_event_ts) / 1e9, e->dat, e->size);
-    current_event_ts = e->mono_time;
+    const CanEvent e = *it;
+    MessageId id = {.source = e.src, .address = e.address};
+    updateEvent(id, (e.mono_time - begin_event_ts) / 1e9, e.dat, e.size);
+    current_event_ts = e.mono_time;
   }
   emit privateUpdateLastMsgsSignal();
 }
@@ -36,7 +36,7 @@ private:
 
   std::mutex lock;
   QThread *stream_thread;
-  std::vector<const CanEvent *> received_events_;
+  NewCanEvents received_events_;
 
   int timer_id;
   QBasicTimer update_timer;
@@ -30,15 +30,14 @@ void ReplayStream::mergeSegments() {
     if (!processed_segments.count(n)) {
       processed_segments.insert(n);
 
-      std::vector<const CanEvent *> new_events;
-      new_events.reserve(seg->log->events.size());
-      for (const Event &e : seg->log->events) {
-        if (e.which == cereal::Event::Which::CAN) {
-          capnp::FlatArrayMessageReader reader(e.data);
-          auto event = reader.getRoot<cereal::Event>();
-          for (const auto &c : event.getCan()) {
-            new_events.push_back(newEvent(e.mono_time, c));
-          }
+      NewCanEvents new_events;
+      const auto &can_events = seg->log->index.service(cereal::Event::Which::CAN);
+      for (uint32_t i : can_events) {
+        const Event &e = seg->log->events[i];
+        capnp::FlatArrayMessageReader reader(e.data);
+        auto event = reader.getRoot<cereal::Event>();
+        for (const auto &c : event.getCan()) {
+          addEvent(new_events, e.mono_time, c);
         }
       }
       mergeEvents(new_events);
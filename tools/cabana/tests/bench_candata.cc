@@ -0,0 +1,185 @@
+// Runs CanData::compute over every CAN frame of a log, the way the stream does for each frame it
+// receives, and over a copy of the per-byte compute it replaced, and reports the time per frame.
+// The new one also pays for the colors of every message at each UI update, which it derives lazily.
+// usage: tools/cabana/tests/bench_candata [rlog] [passes]
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/timing.h"
+#include "tools/cabana/settings.h"
+#include "tools/cabana/streams/abstractstream.h"
+#include "tools/replay/logreader.h"
+
+const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
+
+// the per-byte compute, as a baseline. The frequency it looked up once a second is passed in.
+struct OldCanData {
+  void compute(const uint8_t *can_data, const int size, double current_sec, double playback_speed,
+               const std::vector<uint8_t> &mask, double in_freq) {
+    ts = current_sec;
+    ++count;
+    freq = in_freq;
+
+    if (dat.size() != size) {
+      dat.assign(can_data, can_data + size);
+      colors.assign(size, QColor(0, 0, 0, 0));
+      last_changes.resize(size);
+      bit_flip_counts.resize(size);
+      std::for_each(last_changes.begin(), last_changes.end(), [current_sec](auto &c) { c.ts = current_sec; });
+    } else {
+      constexpr int periodic_threshold = 10;
+      constexpr float fade_time = 2.0;
+      const float alpha_delta = 1.0 / (freq + 1) / (fade_time * playback_speed);
+
+      for (int i = 0; i < size; ++i) {
+        auto &last_change = last_changes[i];
+
+        uint8_t mask_byte = last_change.suppressed ? 0x00 : 0xFF;
+        if (i < mask.size()) mask_byte &= ~(mask[i]);
+
+        const uint8_t last = dat[i] & mask_byte;
+        const uint8_t cur = can_data[i] & mask_byte;
+        if (last != cur) {
+          const int delta = cur - last;
+          last_change.same_delta_counter += std::signbit(delta) == std::signbit(last_change.delta) ? 1 : -4;
+          last_change.same_delta_counter = std::clamp(last_change.same_delta_counter, 0, 16);
+
+          const double delta_t = ts - last_change.ts;
+          if (delta_t * freq > periodic_threshold || last_change.same_delta_counter > 8) {
+            colors[i] = getColor(cur > last ? CYAN : RED);
+          } else {
+            colors[i] = blend(colors[i], getColor(GREYISH_BLUE));
+          }
+
+          auto &row_bit_flips = bit_flip_counts[i];
+          const uint8_t diff = (cur ^ last);
+          for (int bit = 0; bit < 8; bit++) {
+            if (diff & (1u << bit)) {
+              ++row_bit_flips[7 - bit];
+            }
+          }
+
+          last_change.ts = ts;
+          last_change.delta = delta;
+        } else {
+          colors[i].setAlphaF(std::max(0.0, colors[i].alphaF() - alpha_delta));
+        }
+      }
+    }
+    memcpy(dat.data(), can_data, size);
+  }
+
+  enum Color { GREYISH_BLUE, CYAN, RED };
+  static QColor getColor(int c) {
+    static const QColor colors[] = {QColor(102, 86, 169, 64), QColor(0, 187, 255, 128), QColor(255, 0, 0, 128)};
+    return settings.theme == LIGHT_THEME ? colors[c] : colors[c].lighter(135);
+  }
+  static QColor blend(const QColor &a, const QColor &b) {
+    return QColor((a.red() + b.red()) / 2, (a.green() + b.green()) / 2, (a.blue() + b.blue()) / 2, (a.alpha() + b.alpha()) / 2);
+  }
+
+  double ts = 0.;
+  uint32_t count = 0;
+  double freq = 0;
+  std::vector<uint8_t> dat;
+  std::vector<QColor> colors;
+  std::vector<CanData::ByteLastChange> last_changes;
+  std::vector<std::array<uint32_t, 8>> bit_flip_counts;
+};
+
+struct Frame {
+  MessageId id;
+  double sec;
+  std::vector<uint8_t> dat;
+};
+
+int main(int argc, char *argv[]) {
+  const std::string url = argc > 1 ? argv[1] : TEST_RLOG_URL;
+  const int passes = argc > 2 ? atoi(argv[2]) : 10;
+
+  LogReader log;
+  if (!log.load(url, nullptr, true)) {
+    fprintf(stderr, "failed to load %s\n", url.c_str());
+    return 1;
+  }
+
+  std::vector<Frame> frames;
+  for (uint32_t i : log.index.service(cereal::Event::Which::CAN)) {
+    const Event &e = log.events[i];
+    capnp::FlatArrayMessageReader reader(e.data);
+    for (const auto &c : reader.getRoot<cereal::Event>().getCan()) {
+      auto dat = c.getDat();
+      frames.push_back({.id = {.source = uint8_t(c.getSrc()), .address = c.getAddress()},
+                        .sec = (e.mono_time - log.events.front().mono_time) / 1e9,
+                        .dat = {dat.begin(), dat.end()}});
+    }
+  }
+  if (frames.empty()) {
+    fprintf(stderr, "no CAN frames in %s\n", url.c_str());
+    return 1;
+  }
+
+  // the frequencies the baseline would have looked up
+  std::unordered_map<MessageId, std::pair<double, uint32_t>> first_seen;
+  for (const auto &f : frames) {
+    auto &[first, n] = first_seen.try_emplace(f.id, f.sec, 0).first->second;
+    ++n;
+  }
+  std::unordered_map<MessageId, double> freqs;
+  for (const auto &[id, s] : first_seen) {
+    const double duration = frames.back().sec - s.first;
+    freqs[id] = s.second > 1 && duration > 0 ? (s.second - 1) / duration : 0;
+  }
+
+  const std::vector<uint8_t> no_mask;
+  double old_ms = 0, new_ms = 0, colors_ms = 0;
+  uint64_t checksum = 0;
+  for (int pass = 0; pass < passes; ++pass) {
+    std::unordered_map<MessageId, OldCanData> old_msgs;
+    double start = millis_since_boot();
+    for (const auto &f : frames) {
+      old_msgs[f.id].compute(f.dat.data(), f.dat.size(), f.sec, 1.0, no_mask, freqs[f.id]);
+    }
+    old_ms += millis_since_boot() - start;
+
+    std::unordered_map<MessageId, CanData> msgs;
+    start = millis_since_boot();
+    for (const auto &f : frames) {
+      msgs[f.id].compute(f.dat.data(), f.dat.size(), f.sec, no_mask);
+    }
+    new_ms += millis_since_boot() - start;
+
+    // what the messages view asks for at each UI update
+    start = millis_since_boot();
+    const double update_interval = 1.0 / settings.fps;
+    for (double sec = 0; sec <= frames.back().sec; sec += update_interval) {
+      for (const auto &[_, m] : msgs) {
+        checksum += m.colors(sec, 1.0).size();
+      }
+    }
+    colors_ms += millis_since_boot() - start;
+
+    for (const auto &[id, m] : msgs) {
+      const auto &old = old_msgs[id];
+      if (m.dat != old.dat || m.bit_flip_counts != old.bit_flip_counts) {
+        fprintf(stderr, "bit flips don't match\n");
+        return 1;
+      }
+    }
+  }
+
+  const double ns_per_frame = 1e6 / (frames.size() * passes);
+  printf("%zu frames, %zu messages, %.0f s, %d passes\n", frames.size(), freqs.size(), frames.back().sec, passes);
+  printf("%-10s %14s %24s\n", "", "compute ns/frame", "+ colors at UI updates");
+  printf("%-10s %14.1f %24.1f\n", "per-byte", old_ms * ns_per_frame, old_ms * ns_per_frame);
+  printf("%-10s %14.1f %24.1f\n", "words", new_ms * ns_per_frame, (new_ms + colors_ms) * ns_per_frame);
+  return checksum == 0;
+}
@@ -0,0 +1,146 @@
+// Merges a synthetic hour of CAN traffic into the per-message columnar store, and into the
+// pointer-per-frame layout it replaced, and reports the memory used per million frames and
+// the time to merge it and to go over every frame of each message the way a chart update does.
+// usage: tools/cabana/tests/bench_canevents [minutes]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "common/timing.h"
+#include "tools/cabana/streams/canevents.h"
+#include "tools/replay/util.h"
+
+// the old layout, as a baseline
+struct PtrCanEvent {
+  uint8_t src;
+  uint32_t address;
+  uint64_t mono_time;
+  uint8_t size;
+  uint8_t dat[];
+};
+
+struct Message {
+  MessageId id;
+  uint64_t period_ns;
+  uint64_t next_ns;
+};
+
+static uint16_t signal_value(const uint8_t *dat, uint8_t size) {
+  return size >= 4 ? (dat[2] << 8) | dat[3] : 0;
+}
+
+int main(int argc, char *argv[]) {
+  const int minutes = argc > 1 ? atoi(argv[1]) : 60;
+  const uint64_t duration_ns = minutes * 60 * 1000000000ull;
+
+  // ~4k frames/s over 300 messages on three buses, at the rates cars send them
+  std::mt19937 rng(0);
+  const uint64_t periods_ms[] = {10, 20, 50, 100, 200, 500, 1000};
+  std::vector<Message> messages;
+  for (int i = 0; i < 300; ++i) {
+    messages.push_back({.id = {.source = uint8_t(i % 3 * 4), .address = uint32_t(0x100 + i)},
+                        .period_ns = periods_ms[rng() % std::size(periods_ms)] * 2000000,
+                        .next_ns = rng() % 1000000000});
+  }
+
+  MessageEventsMap events;
+  AllCanEvents all_events;
+  NewCanEvents new_events;
+
+  MonotonicBuffer buffer(6 * 1024 * 1024);
+  size_t buffer_bytes = 0;
+  std::unordered_map<MessageId, std::vector<const PtrCanEvent *>> ptr_events, ptr_msg_events;
+  std::vector<const PtrCanEvent *> ptr_all_events;
+  std::vector<const PtrCanEvent *> ptr_new_events;
+
+  double merge_ms = 0, ptr_merge_ms = 0;
+  size_t frames = 0;
+  uint8_t dat[8] = {};
+  // merge a segment a minute, like a replay
+  for (uint64_t segment_end = 60000000000ull; segment_end <= duration_ns; segment_end += 60000000000ull) {
+    while (true) {
+      auto m = std::min_element(messages.begin(), messages.end(), [](auto &a, auto &b) { return a.next_ns < b.next_ns; });
+      if (m->next_ns >= segment_end) break;
+
+      const uint64_t bits = rng();
+      memcpy(dat, &bits, sizeof(dat));
+      new_events.push_back(m->next_ns, m->id, dat, 8);
+
+      auto e = (PtrCanEvent *)buffer.allocate(sizeof(PtrCanEvent) + 8);
+      buffer_bytes += (sizeof(PtrCanEvent) + 8 + 15) & ~15;
+      *e = {.src = m->id.source, .address = m->id.address, .mono_time = m->next_ns, .size = 8};
+      memcpy(e->dat, dat, 8);
+      ptr_new_events.push_back(e);
+
+      m->next_ns += m->period_ns;
+      ++frames;
+    }
+
+    double start = millis_since_boot();
+    all_events.merge(events, new_events);
+    new_events.clear();
+    merge_ms += millis_since_boot() - start;
+
+    // what AbstractStream::mergeEvents did
+    start = millis_since_boot();
+    auto cmp = [](const PtrCanEvent *e, uint64_t ts) { return e->mono_time <= ts; };
+    std::for_each(ptr_msg_events.begin(), ptr_msg_events.end(), [](auto &e) { e.second.clear(); });
+    for (auto e : ptr_new_events) {
+      ptr_msg_events[{.source = e->src, .address = e->address}].push_back(e);
+    }
+    for (const auto &[id, new_e] : ptr_msg_events) {
+      if (!new_e.empty()) {
+        auto &e = ptr_events[id];
+        auto pos = std::lower_bound(e.cbegin(), e.cend(), new_e.front()->mono_time, cmp);
+        e.insert(pos, new_e.cbegin(), new_e.cend());
+      }
+    }
+    auto pos = std::lower_bound(ptr_all_events.cbegin(), ptr_all_events.cend(), ptr_new_events.front()->mono_time, cmp);
+    ptr_all_events.insert(pos, ptr_new_events.begin(), ptr_new_events.end());
+    ptr_new_events.clear();
+    ptr_merge_ms += millis_since_boot() - start;
+  }
+
+  size_t bytes = all_events.memoryUsage();
+  for (const auto &[_, e] : events) bytes += e.memoryUsage();
+  size_t ptr_bytes = buffer_bytes + ptr_all_events.capacity() * sizeof(void *);
+  for (const auto &[_, e] : ptr_events) ptr_bytes += sizeof(e) + e.capacity() * sizeof(void *);
+
+  // decode one signal of every message, like the charts do when the events change
+  std::vector<std::pair<double, double>> points;
+  uint64_t sum = 0;
+  double start = millis_since_boot();
+  for (const auto &[_, e] : events) {
+    points.clear();
+    for (const CanEvent ev : e) {
+      points.emplace_back(ev.mono_time / 1e9, signal_value(ev.dat, ev.size));
+    }
+    sum += points.size();
+  }
+  const double chart_ms = millis_since_boot() - start;
+
+  start = millis_since_boot();
+  for (const auto &[_, e] : ptr_events) {
+    points.clear();
+    for (const PtrCanEvent *ev : e) {
+      points.emplace_back(ev->mono_time / 1e9, signal_value(ev->dat, ev->size));
+    }
+    sum -= points.size();
+  }
+  const double ptr_chart_ms = millis_since_boot() - start;
+  if (sum != 0 || all_events.size() != frames) {
+    fprintf(stderr, "frames don't match\n");
+    return 1;
+  }
+
+  printf("%d minutes, %zu frames, %zu messages\n", minutes, frames, events.size());
+  printf("%-12s %16s %12s %16s\n", "", "MB per 1M frames", "merge ms", "chart update ms");
+  printf("%-12s %16.1f %12.1f %16.1f\n", "columnar", bytes / (frames / 1e6) / (1 << 20), merge_ms, chart_ms);
+  printf("%-12s %16.1f %12.1f %16.1f\n", "pointers", ptr_bytes / (frames / 1e6) / (1 << 20), ptr_merge_ms, ptr_chart_ms);
+  return 0;
+}
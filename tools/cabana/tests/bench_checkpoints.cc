@@ -0,0 +1,83 @@
+// Merges a synthetic route a minute segment at a time, with the first segment arriving last, the way
+// a replay that starts in the middle of a route fills in the cache, and reports how long that
+// out-of-order merge takes on the UI thread and how long the next seeks take to rebuild the
+// checkpoints it invalidated.
+// usage: tools/cabana/tests/bench_checkpoints [minutes]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "common/timing.h"
+#include "tools/cabana/streams/abstractstream.h"
+
+class BenchStream : public DummyStream {
+public:
+  BenchStream(QObject *parent) : DummyStream(parent) {}
+  using AbstractStream::mergeEvents;
+};
+
+int main(int argc, char *argv[]) {
+  const int minutes = argc > 1 ? atoi(argv[1]) : 30;
+
+  QObject parent;
+  BenchStream stream(&parent);
+  can = &stream;
+
+  // ~4k frames/s over 300 messages on three buses, at the rates cars send them
+  std::mt19937 rng(0);
+  const uint64_t periods_ms[] = {10, 20, 50, 100, 200, 500, 1000};
+  std::vector<std::tuple<MessageId, uint64_t, uint64_t>> messages;  // id, period, phase
+  for (int i = 0; i < 300; ++i) {
+    const uint64_t period_ns = periods_ms[rng() % std::size(periods_ms)] * 2000000;
+    messages.push_back({{.source = uint8_t(i % 3 * 4), .address = uint32_t(0x100 + i)}, period_ns, rng() % period_ns});
+  }
+
+  auto segment = [&](int minute) {
+    const uint64_t begin = minute * 60000000000ull, end = begin + 60000000000ull;
+    std::vector<std::pair<uint64_t, size_t>> frames;
+    for (size_t m = 0; m < messages.size(); ++m) {
+      const auto &[id, period_ns, phase] = messages[m];
+      for (uint64_t t = begin + phase; t < end; t += period_ns) {
+        frames.emplace_back(t, m);
+      }
+    }
+    std::sort(frames.begin(), frames.end());
+
+    NewCanEvents new_events;
+    for (const auto &[t, m] : frames) {
+      const uint64_t bits = rng();
+      new_events.push_back(t, std::get<0>(messages[m]), (const uint8_t *)&bits, 8);
+    }
+    return new_events;
+  };
+
+  for (int minute = 1; minute < minutes; ++minute) {
+    stream.mergeEvents(segment(minute));
+  }
+  const double end_sec = minutes * 60 - 1;
+  emit stream.seekedTo(end_sec);
+
+  NewCanEvents first = segment(0);
+  double start = millis_since_boot();
+  stream.mergeEvents(first);
+  const double merge_ms = millis_since_boot() - start;
+
+  start = millis_since_boot();
+  emit stream.seekedTo(end_sec);
+  const double rebuild_ms = millis_since_boot() - start;
+
+  start = millis_since_boot();
+  emit stream.seekedTo(end_sec / 2);
+  const double seek_ms = millis_since_boot() - start;
+
+  printf("%d minutes, %zu frames, %zu messages\n", minutes, stream.allEvents().size(), stream.eventsMap().size());
+  printf("  %-40s %8.1f ms\n", "merge the first segment last", merge_ms);
+  printf("  %-40s %8.1f ms\n", "next seek to the end, rebuilds", rebuild_ms);
+  printf("  %-40s %8.1f ms\n", "seek back to the middle", seek_ms);
+  can = nullptr;
+  return 0;
+}
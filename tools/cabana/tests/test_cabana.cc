@@ -1,9 +1,15 @@
 
 #undef INFO
+#include <cmath>
+#include <map>
+#include <random>
+#include <type_traits>
 #include <QDir>
 
 #include "catch2/catch.hpp"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/tools/findsignal.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
 
@@ -155,3 +161,261 @@ TEST_CASE("parse_opendbc") {
   INFO(errors.join("\n").toStdString());
   REQUIRE(errors.empty());
 }
+
+TEST_CASE("MessageEvents") {
+  MessageEvents events({.source = 1, .address = 0x100});
+  const uint8_t dat[64] = {1, 2, 3, 4, 5, 6, 7, 8};
+  for (uint64_t t = 10; t <= 50; t += 10) {
+    events.push_back(t, dat, 8);
+  }
+  REQUIRE(events.size() == 5);
+  REQUIRE(events.front().mono_time == 10);
+  REQUIRE(events.back().mono_time == 50);
+  REQUIRE(events.back().src == 1);
+  REQUIRE(events.back().address == 0x100);
+  REQUIRE(events.lowerBound(20).index() == 1);
+  REQUIRE(events.upperBound(20).index() == 2);
+  REQUIRE(events.upperBound(100) == events.end());
+
+  SECTION("shorter and CAN FD frames") {
+    events.push_back(60, dat, 2);
+    events.push_back(70, dat, 64);
+    REQUIRE(events.size() == 7);
+    for (int i = 0; i < 5; ++i) {
+      REQUIRE(events.at(i).size == 8);
+      REQUIRE(std::equal(dat, dat + 8, events.at(i).dat));
+    }
+    REQUIRE(events.at(5).size == 2);
+    REQUIRE(std::equal(dat, dat + 2, events.at(5).dat));
+    REQUIRE(events.at(6).size == 64);
+    REQUIRE(std::equal(dat, dat + 64, events.at(6).dat));
+  }
+
+  SECTION("insert") {
+    MessageEvents other;
+    const uint8_t other_dat[] = {9, 9, 9, 9};
+    other.push_back(25, other_dat, 4);
+    other.push_back(26, other_dat, 4);
+    REQUIRE(events.insert(other) == 2);
+
+    std::vector<uint64_t> times;
+    for (const CanEvent e : events) times.push_back(e.mono_time);
+    REQUIRE(times == std::vector<uint64_t>{10, 20, 25, 26, 30, 40, 50});
+    REQUIRE(events.at(2).size == 4);
+    REQUIRE(std::equal(other_dat, other_dat + 4, events.at(2).dat));
+    REQUIRE(events.at(4).size == 8);
+    REQUIRE(std::equal(dat, dat + 8, events.at(4).dat));
+  }
+}
+
+TEST_CASE("AllCanEvents::merge") {
+  MessageEventsMap events;
+  AllCanEvents all_events;
+  NewCanEvents new_events;
+  const MessageId a = {.source = 0, .address = 1}, b = {.source = 0, .address = 2};
+  auto add = [&](const MessageId &id, uint64_t t) {
+    const uint8_t dat[] = {uint8_t(t)};
+    new_events.push_back(t, id, dat, 1);
+  };
+  auto merge = [&]() {
+    all_events.merge(events, new_events);
+    new_events.clear();
+  };
+
+  // a later segment first
+  add(a, 100), add(b, 110), add(a, 120);
+  merge();
+  // then the one before it
+  add(b, 10), add(a, 20), add(a, 30);
+  merge();
+  // and live frames at the end
+  add(b, 200);
+  merge();
+
+  const std::vector<std::pair<MessageId, uint64_t>> expected = {{b, 10}, {a, 20}, {a, 30}, {a, 100}, {b, 110}, {a, 120}, {b, 200}};
+  REQUIRE(all_events.size() == expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    const CanEvent e = all_events.at(i);
+    REQUIRE(MessageId{.source = e.src, .address = e.address} == expected[i].first);
+    REQUIRE(e.mono_time == expected[i].second);
+    REQUIRE(e.dat[0] == uint8_t(e.mono_time));
+  }
+  REQUIRE(events[a].size() == 4);
+  REQUIRE(events[b].size() == 3);
+  REQUIRE(all_events.upperBound(100).index() == 4);
+  REQUIRE(all_events.lowerBound(100).index() == 3);
+
+  // new messages move the ones merged before them
+  for (uint32_t address = 100; address < 200; ++address) {
+    add({.source = 1, .address = address}, 300 + address);
+  }
+  merge();
+  REQUIRE(all_events.size() == expected.size() + 100);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    REQUIRE(all_events.at(i).mono_time == expected[i].second);
+  }
+  REQUIRE(all_events.back().address == 199);
+}
+
+TEST_CASE("FlatMap") {
+  FlatMap<MessageId, int> map;
+  std::map<MessageId, int> expected;
+  // ids that collided with the old hash, and random inserts and erases
+  for (uint8_t source = 0; source < 8; source += 4) {
+    for (uint32_t address = 0; address < 8; ++address) {
+      map[{.source = source, .address = address}] = expected[{.source = source, .address = address}] = address;
+    }
+  }
+  std::mt19937 rng(0);
+  for (int i = 0; i < 10000; ++i) {
+    const MessageId id = {.source = uint8_t(rng() % 3), .address = uint32_t(rng() % 500)};
+    if (rng() % 3 == 0) {
+      REQUIRE(map.erase(id) == expected.erase(id));
+    } else {
+      REQUIRE(map.try_emplace(id, i).second == expected.try_emplace(id, i).second);
+    }
+  }
+
+  REQUIRE(map.size() == expected.size());
+  for (const auto &[id, v] : expected) {
+    REQUIRE(map.count(id) == 1);
+    REQUIRE(map.at(id) == v);
+  }
+  std::map<MessageId, int> entries(map.begin(), map.end());
+  REQUIRE(entries == expected);
+  static_assert(std::is_const_v<decltype(map.begin()->first)>, "keys can't be changed in place");
+
+  FlatMap<MessageId, int> copy;
+  copy[{.source = 1, .address = 1000}] = 1;
+  copy = map;
+  REQUIRE(std::map<MessageId, int>(copy.begin(), copy.end()) == expected);
+  REQUIRE(copy.count({.source = 1, .address = 1000}) == 0);
+
+  map.clear();
+  REQUIRE(map.empty());
+  REQUIRE(map.find({.source = 0, .address = 1}) == map.end());
+}
+
+TEST_CASE("CanData::compute") {
+  // a 12 byte frame at 100Hz, with a counter in the second word and a masked bit
+  CanData m;
+  const std::vector<uint8_t> mask = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0x80};
+  for (int i = 0; i < 300; ++i) {
+    const uint8_t dat[12] = {0xab, 0, 0, 0, 0, 0, 0, 0, 0, uint8_t(i % 2 ? 0x01 : 0x80), 0, uint8_t(i)};
+    m.compute(dat, std::size(dat), i / 100.0, mask);
+  }
+  REQUIRE(m.count == 300);
+  REQUIRE(m.freq == Approx(100));
+  REQUIRE(m.bit_flip_counts[0] == std::array<uint32_t, 8>{});
+  REQUIRE(m.bit_flip_counts[9] == std::array<uint32_t, 8>{0, 0, 0, 0, 0, 0, 0, 299});
+  REQUIRE(m.bit_flip_counts[11][7] == 299);
+
+  auto colors = m.colors(m.ts, 1.0);
+  REQUIRE(colors.size() == 12);
+  REQUIRE(colors[0].alpha() == 0);
+  REQUIRE(colors[9].alpha() > 0);
+  REQUIRE(colors[11].alpha() > 0);
+  REQUIRE(m.colors(m.ts + 2.0, 1.0)[11].alpha() == 0);
+  REQUIRE(m.colors(m.ts + 2.0, 4.0)[11].alpha() > 0);
+}
+
+class TestStream : public DummyStream {
+public:
+  TestStream(QObject *parent) : DummyStream(parent) {}
+  using AbstractStream::mergeEvents;
+};
+
+TEST_CASE("AbstractStream seeks from checkpoints") {
+  QObject parent;
+  TestStream stream(&parent);
+  can = &stream;
+
+  // a 10Hz counter, with the second minute merged first
+  const MessageId id = {.source = 0, .address = 0x10};
+  auto merge = [&](int from, int to) {
+    NewCanEvents new_events;
+    for (int i = from; i < to; ++i) {
+      const uint8_t dat[] = {uint8_t(i), 0xff};
+      new_events.push_back(i * 100000000ULL, id, dat, 2);
+    }
+    stream.mergeEvents(new_events);
+  };
+  merge(600, 1200);
+  emit stream.seekedTo(90.0);
+  merge(0, 600);
+
+  // forward seeks build the checkpoints, backward ones start from them
+  for (double sec : {0.0, 25.0, 59.95, 60.0, 119.0, 30.0, 0.0, 90.0}) {
+    emit stream.seekedTo(sec);
+    const int count = std::floor(sec * 10) + 1;
+    const auto &m = stream.lastMessage(id);
+    REQUIRE(m.count == count);
+    REQUIRE(m.dat == std::vector<uint8_t>{uint8_t(count - 1), 0xff});
+
+    std::array<uint32_t, 8> flips = {};
+    for (int i = 1; i < count; ++i) {
+      const uint8_t diff = uint8_t(i) ^ uint8_t(i - 1);
+      for (int bit = 0; bit < 8; ++bit) {
+        if (diff & (1u << bit)) ++flips[7 - bit];
+      }
+    }
+    REQUIRE(m.bit_flip_counts[0] == flips);
+    REQUIRE(m.bit_flip_counts[1] == std::array<uint32_t, 8>{});
+  }
+  can = nullptr;
+}
+
+TEST_CASE("FindSignalModel::search") {
+  QObject parent;
+  TestStream stream(&parent);
+  can = &stream;
+
+  // random frames of a classic and a CAN FD message
+  std::mt19937 rng(0);
+  NewCanEvents new_events;
+  for (int i = 0; i < 2000; ++i) {
+    uint8_t dat[12];
+    for (auto &b : dat) b = rng() % 4 == 0 ? rng() : 0;
+    new_events.push_back(i * 10000000ULL, {.source = 0, .address = 0x10}, dat, 8);
+    new_events.push_back(i * 10000000ULL + 5000000, {.source = 1, .address = 0x20}, dat, 12);
+  }
+  stream.mergeEvents(new_events);
+
+  for (bool little_endian : {true, false}) {
+    FindSignalModel model(&parent);
+    model.properties.is_little_endian = little_endian;
+    model.properties.is_signed = true;
+    model.properties.factor = 0.5;
+    model.properties.offset = 1;
+    for (const auto &[id, e] : stream.eventsMap()) {
+      for (int size = 1; size <= 64; ++size) {
+        for (int start = 0; start <= e.front().size * 8 - size; ++start) {
+          model.initial_signals.push_back({.id = id, .mono_time = e.front().mono_time, .start_bit = start, .size = size});
+        }
+      }
+    }
+
+    // what the search did, one candidate at a time
+    auto expected = [&](const FindSignalModel::SearchCondition &cond) {
+      std::vector<std::pair<uint64_t, double>> found;
+      for (const auto &s : !model.histories.empty() ? model.histories.back() : model.initial_signals) {
+        const auto &events = stream.events(s.id);
+        const auto sig = model.signal(s);
+        auto it = std::find_if(events.upperBound(s.mono_time), events.end(), [&](const CanEvent &e) { return cond(get_raw_value(e.dat, e.size, sig)); });
+        if (it != events.end()) found.push_back({it->mono_time, get_raw_value(it->dat, it->size, sig)});
+      }
+      return found;
+    };
+    using Cond = FindSignalModel::SearchCondition;
+    for (const auto &cond : {Cond{.op = Cond::GREATER, .v1 = 100}, Cond{.op = Cond::BETWEEN, .v1 = -3, .v2 = 3}, Cond{.op = Cond::NOT_EQUAL, .v1 = 1}}) {
+      const auto found = expected(cond);
+      model.search(cond);
+      REQUIRE(model.filtered_signals.size() == found.size());
+      for (size_t i = 0; i < found.size(); ++i) {
+        REQUIRE(model.filtered_signals[i].mono_time == found[i].first);
+        REQUIRE(model.filtered_signals[i].values.back().endsWith(QString(", %1)").arg(found[i].second)));
+      }
+    }
+  }
+  can = nullptr;
+}
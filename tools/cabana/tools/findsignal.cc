@@ -1,5 +1,7 @@
 #include "tools/cabana/tools/findsignal.h"
 
+#include <cstring>
+#include <numeric>
 #include <thread>
 
 #include <QFormLayout>
@@ -9,6 +11,8 @@
 #include <QTimer>
 #include <QVBoxLayout>
 
+#include "common/timing.h"
+
 // FindSignalModel
 
 QVariant FindSignalModel::headerData(int section, Qt::Orientation orientation, int role) const {
@@ -22,52 +26,196 @@ QVariant FindSignalModel::data(const QModelIndex &index, int role) const {
     const auto &s = filtered_signals[index.row()];
     switch (index.column()) {
       case 0: return QString::fromStdString(s.id.toString());
-      case 1: return QString("%1, %2").arg(s.sig.start_bit).arg(s.sig.size);
+      case 1: return QString("%1, %2").arg(s.start_bit).arg(s.size);
       case 2: return s.values.join(" ");
     }
   }
   return {};
 }
 
-void FindSignalModel::search(std::function<bool(double)> cmp) {
-  beginResetModel();
+cabana::Signal FindSignalModel::signal(const SearchSignal &s) const {
+  cabana::Signal sig = properties;
+  sig.start_bit = s.start_bit;
+  sig.size = s.size;
+  updateMsbLsb(sig);
+  return sig;
+}
 
-  std::mutex lock;
-  const auto prev_sigs = !histories.empty() ? histories.back() : initial_signals;
-  filtered_signals.clear();
-  filtered_signals.reserve(prev_sigs.size());
+namespace {
 
-  unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
-  size_t chunk = (prev_sigs.size() + num_threads - 1) / num_threads;
-  std::vector<std::thread> threads;
-  for (unsigned int t = 0; t < num_threads && t * chunk < (size_t)prev_sigs.size(); ++t) {
-    size_t start = t * chunk;
-    size_t end = std::min(start + chunk, (size_t)prev_sigs.size());
-    threads.emplace_back([&, start, end]() {
-      for (size_t i = start; i < end; ++i) {
-        const auto &s = prev_sigs[i];
-        const auto &events = can->events(s.id);
-        auto first = std::upper_bound(events.cbegin(), events.cend(), s.mono_time, CompareCanEvent());
-        auto last = events.cend();
-        if (last_time < std::numeric_limits<uint64_t>::max()) {
-          last = std::upper_bound(events.cbegin(), events.cend(), last_time, CompareCanEvent());
+// up to 8 bytes as a little endian number
+inline uint64_t load_le(const uint8_t *dat, int n) {
+  uint64_t w = 0;
+  memcpy(&w, dat, std::min(n, 8));
+  return w;
+}
+
+inline uint64_t low_bits(int size) { return size >= 64 ? ~0ULL : (1ULL << size) - 1; }
+
+inline double raw_value(uint64_t val, int size, const cabana::Signal &props) {
+  if (props.is_signed && size < 64 && (val & (1ULL << (size - 1)))) {
+    val |= ~low_bits(size);
+  }
+  return static_cast<int64_t>(val) * props.factor + props.offset;
+}
+
+// Finds the candidates' matches in the frames of their message, the same as comparing get_raw_value()
+// of each frame after the one they were last found in. Each frame is read once: for frames of up to
+// 8 bytes, the value at every start bit is a shift of the same word. The candidates still looking for
+// a match are a bitset, and the ones that match, or start at a later frame, are out of it.
+void search_message(const MessageEvents &events, uint64_t last_time, const cabana::Signal &props,
+                    const FindSignalModel::SearchCondition &cond, const FindSignalModel::SearchSignal *sigs, size_t count,
+                    std::vector<FindSignalModel::SearchSignal> &results) {
+  const size_t end_row = last_time == std::numeric_limits<uint64_t>::max() ? events.size() : events.upperBound(last_time).index();
+
+  struct Candidate {
+    uint32_t begin_row;
+    uint16_t pos;  // first bit, counted from the LSB of the frame for little endian, from the MSB for big endian
+    uint8_t size;
+  };
+  std::vector<Candidate> candidates(count);
+  for (size_t i = 0; i < count; ++i) {
+    const bool same_time = i > 0 && sigs[i].mono_time == sigs[i - 1].mono_time;
+    candidates[i] = {.begin_row = same_time ? candidates[i - 1].begin_row : (uint32_t)events.upperBound(sigs[i].mono_time).index(),
+                     .pos = uint16_t(props.is_little_endian ? sigs[i].start_bit : flipBitPos(sigs[i].start_bit)),
+                     .size = uint8_t(sigs[i].size)};
+  }
+  std::vector<uint32_t> by_begin(count);
+  std::iota(by_begin.begin(), by_begin.end(), 0);
+  std::stable_sort(by_begin.begin(), by_begin.end(), [&](uint32_t a, uint32_t b) { return candidates[a].begin_row < candidates[b].begin_row; });
+
+  std::vector<uint64_t> pending((count + 63) / 64, 0);
+  std::vector<uint32_t> found_row(count, UINT32_MAX);
+  std::vector<double> found_value(count);
+  size_t num_pending = 0, next = 0;
+  for (size_t row = 0; row < end_row; ++row) {
+    if (num_pending == 0) {
+      if (next == count) break;
+      row = std::max<size_t>(row, candidates[by_begin[next]].begin_row);
+      if (row >= end_row) break;
+    }
+    for (; next < count && candidates[by_begin[next]].begin_row <= row; ++next) {
+      pending[by_begin[next] / 64] |= 1ULL << (by_begin[next] % 64);
+      ++num_pending;
+    }
+
+    const CanEvent e = events.at(row);
+    const int n = e.size;
+    const uint64_t le_word = load_le(e.dat, n);
+    const uint64_t be_word = __builtin_bswap64(le_word);
+    for (size_t w = 0; w < pending.size(); ++w) {
+      for (uint64_t bits = pending[w]; bits != 0; bits &= bits - 1) {
+        const size_t i = w * 64 + __builtin_ctzll(bits);
+        const int pos = candidates[i].pos, size = candidates[i].size;
+
+        // 0 if the MSB isn't in the frame
+        double value = 0;
+        uint64_t val = 0;
+        if (props.is_little_endian) {
+          if (pos + size <= n * 8) {
+            if (n <= 8) {
+              val = (le_word >> pos) & low_bits(size);
+            } else {
+              const int byte = pos / 8, shift = pos % 8;
+              val = load_le(e.dat + byte, n - byte) >> shift;
+              if (shift + size > 64) val |= uint64_t(e.dat[byte + 8]) << (64 - shift);
+              val &= low_bits(size);
+            }
+            value = raw_value(val, size, props);
+          }
+        } else if (pos / 8 < n) {
+          // the part of it that's in the frame
+          const int bits_in_frame = std::min(size, n * 8 - pos);
+          if (n <= 8) {
+            val = (be_word << pos) >> (64 - bits_in_frame);
+          } else {
+            const int byte = pos / 8, shift = pos % 8;
+            uint64_t window = __builtin_bswap64(load_le(e.dat + byte, n - byte)) << shift;
+            if (shift + bits_in_frame > 64) window |= uint64_t(e.dat[byte + 8]) >> (8 - shift);
+            val = window >> (64 - bits_in_frame);
+          }
+          value = raw_value(val, size, props);
         }
 
-        auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(get_raw_value(e->dat, e->size, s.sig)); });
-        if (it != last) {
-          auto values = s.values;
-          values += QString("(%1, %2)").arg(can->toSeconds((*it)->mono_time), 0, 'f', 3).arg(get_raw_value((*it)->dat, (*it)->size, s.sig));
-          std::lock_guard lk(lock);
-          filtered_signals.push_back({.id = s.id, .mono_time = (*it)->mono_time, .sig = s.sig, .values = values});
+        if (cond(value)) {
+          found_row[i] = row;
+          found_value[i] = value;
+          pending[w] &= ~(1ULL << (i % 64));
+          --num_pending;
         }
       }
-    });
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if (found_row[i] != UINT32_MAX) {
+      auto &s = results.emplace_back(sigs[i]);
+      s.mono_time = events.monoTime(found_row[i]);
+      s.values += QString("(%1, %2)").arg(can->toSeconds(s.mono_time), 0, 'f', 3).arg(found_value[i]);
+    }
   }
+}
+
+}  // namespace
+
+void FindSignalModel::startSearch(const SearchCondition &cond) {
+  search_ = std::make_unique<Search>();
+  search_->cond = cond;
+  search_->candidates = !histories.empty() ? histories.back() : initial_signals;
+  const auto &candidates = search_->candidates;
+  for (size_t i = 0; i < candidates.size();) {
+    size_t j = i + 1;
+    while (j < candidates.size() && candidates[j].id == candidates[i].id) ++j;
+    search_->chunks.push_back({i, j});
+    i = j;
+  }
+  search_->results.resize(search_->chunks.size());
+}
+
+bool FindSignalModel::searchStep(int max_ms) {
+  if (!search_) return false;
+
+  auto &s = *search_;
+  const double deadline = max_ms < 0 ? std::numeric_limits<double>::max() : millis_since_boot() + max_ms;
+  auto worker = [&]() {
+    do {
+      const size_t chunk = s.next_chunk++;
+      if (chunk >= s.chunks.size()) break;
+
+      const auto [first, last] = s.chunks[chunk];
+      const auto &events = can->events(s.candidates[first].id);
+      search_message(events, last_time, properties, s.cond, &s.candidates[first], last - first, s.results[chunk]);
+      s.searched += last - first;
+    } while (millis_since_boot() < deadline);
+  };
+  std::vector<std::thread> threads;
+  const unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int t = 1; t < std::min<size_t>(num_threads, s.chunks.size()); ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
   for (auto &th : threads) th.join();
 
-  histories.push_back(filtered_signals);
+  if (s.searched < s.candidates.size()) return true;
 
+  beginResetModel();
+  filtered_signals.clear();
+  for (auto &r : s.results) {
+    filtered_signals.insert(filtered_signals.end(), std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+  }
+  histories.push_back(filtered_signals);
+  search_.reset();
   endResetModel();
+  return false;
+}
+
+double FindSignalModel::searchProgress() const {
+  return search_ && !search_->candidates.empty() ? search_->searched / (double)search_->candidates.size() : 0;
+}
+
+void FindSignalModel::search(const SearchCondition &cond) {
+  startSearch(cond);
+  while (searchStep(-1)) {}
 }
 
 void FindSignalModel::undo() {
@@ -82,6 +230,7 @@ void FindSignalModel::undo() {
 
 void FindSignalModel::reset() {
   beginResetModel();
+  search_.reset();
   histories.clear();
   filtered_signals.clear();
   initial_signals.clear();
@@ -186,27 +335,36 @@ FindSignalDlg::FindSignalDlg(QWidget *parent) : QDialog(parent, Qt::WindowFlags(
 }
 
 void FindSignalDlg::search() {
+  if (model->searching()) {
+    model->cancelSearch();
+    modelReset();
+    return;
+  }
+
   if (model->histories.empty()) {
     setInitialSignals();
   }
-  auto v1 = value1->text().toDouble();
-  auto v2 = value2->text().toDouble();
-  std::function<bool(double)> cmp = nullptr;
-  switch (compare_cb->currentIndex()) {
-    case 0: cmp = [v1](double v) { return v == v1;}; break;
-    case 1: cmp = [v1](double v) { return v > v1;}; break;
-    case 2: cmp = [v1](double v) { return v >= v1;}; break;
-    case 3: cmp = [v1](double v) { return v != v1;}; break;
-    case 4: cmp = [v1](double v) { return v < v1;}; break;
-    case 5: cmp = [v1](double v) { return v <= v1;}; break;
-    case 6: cmp = [v1, v2](double v) { return v >= v1 && v <= v2;}; break;
-  }
+  FindSignalModel::SearchCondition cond = {
+      .op = (FindSignalModel::SearchCondition::Op)compare_cb->currentIndex(),
+      .v1 = value1->text().toDouble(),
+      .v2 = value2->text().toDouble(),
+  };
   properties_group->setEnabled(false);
   message_group->setEnabled(false);
-  search_btn->setEnabled(false);
-  stats_label->setVisible(false);
-  search_btn->setText("Finding ....");
-  QTimer::singleShot(0, this, [=]() { model->search(cmp); });
+  undo_btn->setEnabled(false);
+  reset_btn->setEnabled(false);
+  search_btn->setText(tr("Cancel"));
+  stats_label->setText(tr("Finding ..."));
+  model->startSearch(cond);
+  QTimer::singleShot(0, this, &FindSignalDlg::searchStep);
+}
+
+void FindSignalDlg::searchStep() {
+  // return to the event loop every 100ms to show the progress and take a click on cancel
+  if (model->searchStep(100)) {
+    stats_label->setText(tr("Finding ... %1%").arg(int(model->searchProgress() * 100)));
+    QTimer::singleShot(0, this, &FindSignalDlg::searchStep);
+  }
 }
 
 void FindSignalDlg::setInitialSignals() {
@@ -222,7 +380,8 @@ void FindSignalDlg::setInitialSignals() {
     if (!addr.isEmpty()) addresses.insert(addr.toULong(nullptr, 16));
   }
 
-  cabana::Signal sig{};
+  cabana::Signal &sig = model->properties;
+  sig = {};
   sig.is_little_endian = litter_endian->isChecked();
   sig.is_signed = is_signed->isChecked();
   sig.factor = factor_edit->text().toDouble();
@@ -241,16 +400,13 @@ void FindSignalDlg::setInitialSignals() {
   for (const auto &[id, m] : can->lastMessages()) {
     if ((buses.isEmpty() || buses.contains(id.source)) && (addresses.isEmpty() || addresses.contains(id.address))) {
       const auto &events = can->events(id);
-      auto e = std::lower_bound(events.cbegin(), events.cend(), first_time, CompareCanEvent());
+      auto e = events.lowerBound(first_time);
       if (e != events.cend()) {
         const int total_size = m.dat.size() * 8;
         for (int size = min_size->value(); size <= max_size->value(); ++size) {
           for (int start = 0; start <= total_size - size; ++start) {
-            FindSignalModel::SearchSignal s{.id = id, .mono_time = first_time, .sig = sig};
-            s.sig.start_bit = start;
-            s.sig.size = size;
-            updateMsbLsb(s.sig);
-            s.value = get_raw_value((*e)->dat, (*e)->size, s.sig);
+            FindSignalModel::SearchSignal s{.id = id, .mono_time = first_time, .start_bit = start, .size = size};
+            s.value = get_raw_value(e->dat, e->size, model->signal(s));
             model->initial_signals.push_back(s);
           }
         }
@@ -276,7 +432,7 @@ void FindSignalDlg::customMenuRequested(const QPoint &pos) {
     menu.addAction(tr("Create Signal"));
     if (menu.exec(view->mapToGlobal(pos))) {
       auto &s = model->filtered_signals[index.row()];
-      UndoStack::push(new AddSigCommand(s.id, s.sig));
+      UndoStack::push(new AddSigCommand(s.id, model->signal(s)));
       emit openMessage(s.id);
     }
   }
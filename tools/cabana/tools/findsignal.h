@@ -1,8 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <QAbstractTableModel>
@@ -16,27 +19,70 @@
 
 class FindSignalModel : public QAbstractTableModel {
 public:
+  // a candidate signal of the message id, with the start bit and size, and the properties of the search
   struct SearchSignal {
     MessageId id = {};
-    uint64_t mono_time = 0;
-    cabana::Signal sig = {};
+    uint64_t mono_time = 0;  // of the frame it was last found in
+    int start_bit = 0;
+    int size = 0;
     double value = 0.;
     QStringList values;
   };
 
+  struct SearchCondition {
+    enum Op { EQUAL, GREATER, GREATER_EQUAL, NOT_EQUAL, LESS, LESS_EQUAL, BETWEEN };
+    inline bool operator()(double v) const {
+      switch (op) {
+        case EQUAL: return v == v1;
+        case GREATER: return v > v1;
+        case GREATER_EQUAL: return v >= v1;
+        case NOT_EQUAL: return v != v1;
+        case LESS: return v < v1;
+        case LESS_EQUAL: return v <= v1;
+        case BETWEEN: return v >= v1 && v <= v2;
+      }
+      return false;
+    }
+    Op op = EQUAL;
+    double v1 = 0, v2 = 0;
+  };
+
   FindSignalModel(QObject *parent) : QAbstractTableModel(parent) {}
   QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
   QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
   int columnCount(const QModelIndex &parent = QModelIndex()) const override { return 3; }
   int rowCount(const QModelIndex &parent = QModelIndex()) const override { return std::min((int)filtered_signals.size(), 300); }
-  void search(std::function<bool(double)> cmp);
+  cabana::Signal signal(const SearchSignal &s) const;
+
+  // Searches the candidates left by the last search for the first frame after the one they were found in
+  // that meets cond. It runs in steps of about max_ms, so the caller can show progress and cancel it
+  // in between: searchStep() returns false once it's done and the model is reset with the results.
+  void startSearch(const SearchCondition &cond);
+  bool searchStep(int max_ms);
+  void cancelSearch() { search_.reset(); }
+  inline bool searching() const { return search_ != nullptr; }
+  double searchProgress() const;
+  void search(const SearchCondition &cond);
   void reset();
   void undo();
 
+  cabana::Signal properties;  // of every candidate
   std::vector<SearchSignal> filtered_signals;
   std::vector<SearchSignal> initial_signals;
   std::vector<std::vector<SearchSignal>> histories;
   uint64_t last_time = std::numeric_limits<uint64_t>::max();
+
+private:
+  // The candidates of each message are a chunk, which the worker threads take in turn.
+  struct Search {
+    SearchCondition cond;
+    std::vector<SearchSignal> candidates;
+    std::vector<std::pair<size_t, size_t>> chunks;  // [first, last) candidates of each message
+    std::vector<std::vector<SearchSignal>> results;  // of each chunk
+    std::atomic<size_t> next_chunk = 0;
+    std::atomic<size_t> searched = 0;  // candidates
+  };
+  std::unique_ptr<Search> search_;
 };
 
 class FindSignalDlg : public QDialog {
@@ -49,6 +95,7 @@ signals:
 
 private:
   void search();
+  void searchStep();
   void modelReset();
   void setInitialSignals();
   void customMenuRequested(const QPoint &pos);
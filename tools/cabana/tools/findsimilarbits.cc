@@ -121,23 +121,23 @@ std::vector<FindSimilarBitsDlg::mismatched_struct> FindSimilarBitsDlg::calcBits(
   std::unordered_map<uint32_t, uint32_t> msg_count;
   const auto &events = can->allEvents();
   int bit_to_find = -1;
-  for (const CanEvent *e : events) {
-    if (e->src == bus) {
-      if (e->address == selected_address && e->size > byte_idx) {
-        bit_to_find = ((e->dat[byte_idx] >> (7 - bit_idx)) & 1) != 0;
+  for (const CanEvent e : events) {
+    if (e.src == bus) {
+      if (e.address == selected_address && e.size > byte_idx) {
+        bit_to_find = ((e.dat[byte_idx] >> (7 - bit_idx)) & 1) != 0;
       }
     }
-    if (e->src == find_bus) {
-      ++msg_count[e->address];
+    if (e.src == find_bus) {
+      ++msg_count[e.address];
       if (bit_to_find == -1) continue;
 
-      auto &mismatched = mismatches[e->address];
-      if (mismatched.size() < e->size * 8) {
-        mismatched.resize(e->size * 8);
+      auto &mismatched = mismatches[e.address];
+      if (mismatched.size() < e.size * 8) {
+        mismatched.resize(e.size * 8);
       }
-      for (int i = 0; i < e->size; ++i) {
+      for (int i = 0; i < e.size; ++i) {
         for (int j = 0; j < 8; ++j) {
-          int bit = ((e->dat[i] >> (7 - j)) & 1) != 0;
+          int bit = ((e.dat[i] >> (7 - j)) & 1) != 0;
           mismatched[i * 8 + j] += equal ? (bit != bit_to_find) : (bit == bit_to_find);
         }
       }
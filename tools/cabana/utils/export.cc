@@ -12,11 +12,14 @@ void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id) {
   if (file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
     QTextStream stream(&file);
     stream << "time,addr,bus,data\n";
-    for (auto e : msg_id ? can->events(*msg_id) : can->allEvents()) {
-      stream << QString::number(can->toSeconds(e->mono_time), 'f', 3) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src << ","
-             << "0x" << QByteArray::fromRawData((const char *)e->dat, e->size).toHex().toUpper() << "\n";
-    }
+    auto write = [&stream](const auto &events) {
+      for (const CanEvent e : events) {
+        stream << QString::number(can->toSeconds(e.mono_time), 'f', 3) << ","
+               << "0x" << QString::number(e.address, 16) << "," << e.src << ","
+               << "0x" << QByteArray::fromRawData((const char *)e.dat, e.size).toHex().toUpper() << "\n";
+      }
+    };
+    msg_id ? write(can->events(*msg_id)) : write(can->allEvents());
   }
 }
 
@@ -29,12 +32,12 @@ void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id) {
       stream << "," << s->name.c_str();
     stream << "\n";
 
-    for (auto e : can->events(msg_id)) {
-      stream << QString::number(can->toSeconds(e->mono_time), 'f', 3) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src;
+    for (const CanEvent e : can->events(msg_id)) {
+      stream << QString::number(can->toSeconds(e.mono_time), 'f', 3) << ","
+             << "0x" << QString::number(e.address, 16) << "," << e.src;
       for (auto s : msg->sigs) {
         double value = 0;
-        s->getValue(e->dat, e->size, &value);
+        s->getValue(e.dat, e.size, &value);
         stream << "," << QString::number(value, 'f', s->precision);
       }
       stream << "\n";
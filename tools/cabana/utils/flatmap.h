@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// murmur3's 64-bit finalizer, every bit of k changes about half the bits of the result
+inline uint64_t hash_mix(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// for integer keys, which std::hash leaves as they are
+struct IntHash {
+  inline size_t operator()(uint64_t k) const noexcept { return hash_mix(k); }
+};
+
+// Open-addressing hash map for small keys. The entries are kept in one vector in the order they
+// were inserted, and the table only holds their positions and hashes, so a lookup goes over a few
+// adjacent slots and compares keys only when the hashes match. Hash has to mix its low bits well.
+// Unlike std::unordered_map, inserting may move the entries, and erase() moves the last entry in
+// place of the erased one: entries stay at the same position in the vector as long as none is erased.
+// Keys are const like in std::unordered_map, so entries are never assigned, only constructed.
+template <class Key, class T, class Hash = std::hash<Key>>
+class FlatMap {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<const Key, T>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  inline iterator begin() { return entries_.begin(); }
+  inline iterator end() { return entries_.end(); }
+  inline const_iterator begin() const { return entries_.begin(); }
+  inline const_iterator end() const { return entries_.end(); }
+  inline const_iterator cbegin() const { return entries_.cbegin(); }
+  inline const_iterator cend() const { return entries_.cend(); }
+  inline size_t size() const { return entries_.size(); }
+  inline bool empty() const { return entries_.empty(); }
+
+  FlatMap() = default;
+  FlatMap(const FlatMap &other) = default;
+  FlatMap(FlatMap &&other) = default;
+  FlatMap &operator=(FlatMap &&other) = default;
+  // std::vector's copy assignment assigns to the entries it already has
+  FlatMap &operator=(const FlatMap &other) {
+    if (this != &other) {
+      entries_.clear();
+      entries_.reserve(other.size());
+      for (const auto &e : other.entries_) entries_.push_back(e);
+      slots_ = other.slots_;
+    }
+    return *this;
+  }
+
+  void clear() {
+    entries_.clear();
+    std::fill(slots_.begin(), slots_.end(), Slot{});
+  }
+  void reserve(size_t n) {
+    entries_.reserve(n);
+    if (n * 2 > slots_.size()) rehash(n * 2);
+  }
+
+  iterator find(const Key &key) {
+    const size_t slot = findSlot(key);
+    return slot != npos ? begin() + (slots_[slot].index - 1) : end();
+  }
+  const_iterator find(const Key &key) const {
+    const size_t slot = findSlot(key);
+    return slot != npos ? begin() + (slots_[slot].index - 1) : end();
+  }
+  inline size_t count(const Key &key) const { return findSlot(key) != npos; }
+  T &at(const Key &key) {
+    auto it = find(key);
+    if (it == end()) throw std::out_of_range("FlatMap::at");
+    return it->second;
+  }
+  const T &at(const Key &key) const {
+    auto it = find(key);
+    if (it == end()) throw std::out_of_range("FlatMap::at");
+    return it->second;
+  }
+  inline T &operator[](const Key &key) { return try_emplace(key).first->second; }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+    const uint32_t hash = Hash{}(key);
+    if (const size_t slot = findSlot(key, hash); slot != npos) {
+      return {begin() + (slots_[slot].index - 1), false};
+    }
+
+    if ((entries_.size() + 1) * 2 > slots_.size()) rehash(std::max<size_t>(16, slots_.size() * 2));
+    size_t i = hash & mask();
+    while (slots_[i].index != 0) i = (i + 1) & mask();
+    entries_.emplace_back(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+    slots_[i] = {hash, uint32_t(entries_.size())};
+    return {end() - 1, true};
+  }
+
+  size_t erase(const Key &key) {
+    const size_t slot = findSlot(key);
+    if (slot == npos) return 0;
+
+    const uint32_t index = slots_[slot].index - 1;
+    // shift the slots after it back into the gap, unless that would put them before their home slot
+    size_t gap = slot;
+    for (size_t i = (gap + 1) & mask(); slots_[i].index != 0; i = (i + 1) & mask()) {
+      const size_t home = slots_[i].hash & mask();
+      if (((i - home) & mask()) >= ((i - gap) & mask())) {
+        slots_[gap] = slots_[i];
+        gap = i;
+      }
+    }
+    slots_[gap] = {};
+
+    if (index != entries_.size() - 1) {
+      slots_[findSlot(entries_.back().first)].index = index + 1;
+      value_type *e = &entries_[index];
+      e->~value_type();
+      new (e) value_type(std::move(entries_.back()));
+    }
+    entries_.pop_back();
+    return 1;
+  }
+
+private:
+  struct Slot {
+    uint32_t hash = 0;   // low bits of the key's hash
+    uint32_t index = 0;  // position of the entry + 1, or 0 for an empty slot
+  };
+  static constexpr size_t npos = SIZE_MAX;
+
+  inline size_t mask() const { return slots_.size() - 1; }
+
+  inline size_t findSlot(const Key &key) const { return findSlot(key, Hash{}(key)); }
+  size_t findSlot(const Key &key, uint32_t hash) const {
+    if (entries_.empty()) return npos;
+
+    for (size_t i = hash & mask(); slots_[i].index != 0; i = (i + 1) & mask()) {
+      if (slots_[i].hash == hash && entries_[slots_[i].index - 1].first == key) return i;
+    }
+    return npos;
+  }
+
+  // capacity is rounded up to a power of two
+  void rehash(size_t capacity) {
+    size_t n = 16;
+    while (n < capacity) n *= 2;
+    std::vector<Slot> slots(n);
+    for (const Slot &s : slots_) {
+      if (s.index == 0) continue;
+      size_t i = s.hash & (n - 1);
+      while (slots[i].index != 0) i = (i + 1) & (n - 1);
+      slots[i] = s;
+    }
+    slots_ = std::move(slots);
+  }
+
+  std::vector<value_type> entries_;
+  std::vector<Slot> slots_;  // at most half full
+};
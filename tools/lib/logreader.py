@@ -43,7 +43,7 @@ def decompress_stream(data: bytes):
   dctx = zstd.ZstdDecompressor()
   decompressed_data = b""
 
-  with dctx.stream_reader(data) as reader:
+  with dctx.stream_reader(data, read_across_frames=True) as reader:
     decompressed_data = reader.read()
 
   return decompressed_data
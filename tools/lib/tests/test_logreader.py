@@ -6,6 +6,7 @@ import tempfile
 import os
 import pytest
 import requests
+import zstandard as zstd
 
 from openpilot.common.parameterized import parameterized
 
@@ -233,6 +234,16 @@ class TestLogReader:
     msgs = list(LogReader(f"{TEST_ROUTE}/0/q", sort_by_time=True))
     assert msgs == sorted(msgs, key=lambda m: m.logMonoTime)
 
+  def test_multiple_zst_frames(self):
+    # loggerd writes seekable zst logs: independent frames followed by a skippable seek table
+    msgs = [capnp_log.Event.new_message(logMonoTime=i).to_bytes() for i in range(100)]
+    skippable = (0x184D2A5E).to_bytes(4, "little") + (9).to_bytes(4, "little") + bytes(9)
+    with tempfile.NamedTemporaryFile(suffix=".zst") as rlog:
+      with open(rlog.name, "wb") as f:
+        f.write(b"".join(zstd.compress(b"".join(msgs[i:i + 10])) for i in range(0, len(msgs), 10)) + skippable)
+
+      assert [m.logMonoTime for m in LogReader(rlog.name)] == list(range(100))
+
   def test_only_union_types(self):
     with tempfile.NamedTemporaryFile() as qlog:
       # write valid Event messages
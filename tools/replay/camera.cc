@@ -1,13 +1,23 @@
 #include "tools/replay/camera.h"
 
-#include <algorithm>
-
 #include <capnp/dynamic.h>
 
 #include "system/camerad/cameras/nv12_info.h"
 #include "tools/replay/util.h"
 
 const int BUFFER_COUNT = 40;
+// frames decoded ahead of the publisher, well below BUFFER_COUNT so the ring never
+// hands out a buffer a client may still be reading
+const size_t DECODE_AHEAD = 8;
+// with FrameDropPolicy::Skip, a decoder further behind than this jumps to the next keyframe
+const int MAX_DECODE_LAG = 4;
+
+// whether a and b are the camera of the same segment. they're compared by the segment that owns them,
+// which unlike an address isn't reused while a weak_ptr to it is around.
+template <typename A, typename B>
+static bool same_reader(const A &a, const B &b) {
+  return !a.owner_before(b) && !b.owner_before(a);
+}
 
 CameraServer::CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS]) {
   for (int i = 0; i < MAX_CAMERAS; ++i) {
@@ -17,16 +27,15 @@ CameraServer::CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS]) {
 }
 
 CameraServer::~CameraServer() {
+  for (auto &cam : cameras_) {
+    {
+      std::lock_guard lk(cam.lock);
+      exit_ = true;
+    }
+    cam.cv.notify_all();
+  }
   for (auto &cam : cameras_) {
     if (cam.thread.joinable()) {
-      // Clear the queue
-      std::pair<FrameReader*, const Event *> item;
-      while (cam.queue.try_pop(item)) {
-        --publishing_;
-      }
-
-      // Signal termination and join the thread
-      cam.queue.push({});
       cam.thread.join();
     }
   }
@@ -36,8 +45,6 @@ CameraServer::~CameraServer() {
 void CameraServer::startVipcServer() {
   vipc_server_.reset(new VisionIpcServer("camerad"));
   for (auto &cam : cameras_) {
-    cam.cached_buf.clear();
-
     if (cam.width > 0 && cam.height > 0) {
       rInfo("camera[%d] frame size %dx%d", cam.type, cam.width, cam.height);
       auto [stride, y_height, uv_height_, buffer_size] = get_nv12_info(cam.width, cam.height);
@@ -45,72 +52,157 @@ void CameraServer::startVipcServer() {
       vipc_server_->create_buffers_with_sizes(cam.stream_type, BUFFER_COUNT, cam.width, cam.height,
                                               buffer_size, stride, stride * y_height);
       if (!cam.thread.joinable()) {
-        cam.thread = std::thread(&CameraServer::cameraThread, this, std::ref(cam));
+        cam.thread = std::thread(&CameraServer::decoderThread, this, std::ref(cam));
       }
     }
   }
   vipc_server_->start_listener();
 }
 
-void CameraServer::cameraThread(Camera &cam) {
-  while (true) {
-    const auto [fr, event] = cam.queue.pop();
-    if (!fr) break;
-
-    capnp::FlatArrayMessageReader reader(event->data);
-    auto evt = reader.getRoot<cereal::Event>();
-    auto eidx = capnp::AnyStruct::Reader(evt).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-
-    int segment_id = eidx.getSegmentId();
-    uint32_t frame_id = eidx.getFrameId();
-    if (auto yuv = getFrame(cam, fr, segment_id, frame_id)) {
-      VisionIpcBufExtra extra = {
-          .frame_id = frame_id,
-          .timestamp_sof = eidx.getTimestampSof(),
-          .timestamp_eof = eidx.getTimestampEof(),
-      };
-      vipc_server_->send(yuv, &extra);
-    } else {
-      rError("camera[%d] failed to get frame: %lu", cam.type, segment_id);
-    }
-
-    // Prefetch the next frame
-    getFrame(cam, fr, segment_id + 1, frame_id + 1);
-
-    --publishing_;
+// parks every decoder and drops their rings, so nothing refers to the buffers of vipc_server_
+void CameraServer::stopDecoding() {
+  for (auto &cam : cameras_) {
+    std::unique_lock lk(cam.lock);
+    moveDecoder(cam, nullptr, nullptr, 0);
+    cam.cv.wait(lk, [&cam]() { return !cam.busy; });
   }
 }
 
-VisionBuf *CameraServer::getFrame(Camera &cam, FrameReader *fr, int32_t segment_id, uint32_t frame_id) {
-  // Check if the frame is cached
-  auto buf_it = std::find_if(cam.cached_buf.begin(), cam.cached_buf.end(),
-                             [frame_id](VisionBuf *buf) { return buf->get_frame_id() == frame_id; });
-  if (buf_it != cam.cached_buf.end()) return *buf_it;
-
-  VisionBuf *yuv_buf = vipc_server_->get_buffer(cam.stream_type);
-  if (fr->get(segment_id, yuv_buf)) {
-    yuv_buf->set_frame_id(frame_id);
-    cam.cached_buf.insert(yuv_buf);
-    return yuv_buf;
+// called with cam.lock held
+void CameraServer::moveDecoder(Camera &cam, std::shared_ptr<FrameReader> fr, std::shared_ptr<FrameReader> next_fr, int idx) {
+  cam.reader = std::move(fr);
+  cam.next_reader = std::move(next_fr);
+  cam.next_idx = idx;
+  cam.decoding_idx = -1;
+  ++cam.generation;
+  cam.ring.clear();
+  cam.cv.notify_all();
+}
+
+void CameraServer::decoderThread(Camera &cam) {
+  std::unique_lock lk(cam.lock);
+  while (true) {
+    cam.cv.wait(lk, [this, &cam]() {
+      return exit_ || (cam.reader && cam.ring.size() < DECODE_AHEAD &&
+                       (cam.next_idx < (int)cam.reader->getFrameCount() || cam.next_reader));
+    });
+    if (exit_) break;
+
+    if (cam.next_idx >= (int)cam.reader->getFrameCount()) {
+      // on to the next segment. it isn't a seek, the frames in the ring stay
+      auto done = std::move(cam.reader);
+      cam.reader = std::move(cam.next_reader);
+      cam.next_idx = 0;
+      lk.unlock();
+      // may be the last reference to a segment the publisher has moved past
+      done.reset();
+      lk.lock();
+      continue;
+    }
+
+    auto reader = cam.reader;
+    const int idx = cam.decoding_idx = cam.next_idx++;
+    const uint64_t generation = cam.generation;
+    VisionBuf *buf = vipc_server_->get_buffer(cam.stream_type);
+    cam.busy = true;
+    lk.unlock();
+
+    bool ok = reader->get(idx, buf);
+    std::weak_ptr<FrameReader> decoded_reader = reader;
+    // may be the last reference to a segment the publisher has moved past
+    reader.reset();
+
+    lk.lock();
+    cam.busy = false;
+    if (cam.generation == generation) {
+      if (!ok) rError("camera[%d] failed to get frame: %d", cam.type, idx);
+      cam.ring.push_back({decoded_reader, idx, ok ? buf : nullptr});
+      cam.decoding_idx = -1;
+    }
+    cam.cv.notify_all();
   }
-  return nullptr;
 }
 
-void CameraServer::pushFrame(CameraType type, FrameReader *fr, const Event *event) {
+void CameraServer::pushFrame(CameraType type, std::shared_ptr<FrameReader> fr, std::shared_ptr<FrameReader> next_fr,
+                             const Event *event, FrameDropPolicy policy) {
   auto &cam = cameras_[type];
   if (cam.width != fr->width || cam.height != fr->height) {
     cam.width = fr->width;
     cam.height = fr->height;
-    waitForSent();
+    stopDecoding();
     startVipcServer();
   }
+  if (next_fr && (next_fr->width != fr->width || next_fr->height != fr->height)) {
+    // its frames don't fit the buffers, the decoder starts on it once it's pushed
+    next_fr.reset();
+  }
 
-  ++publishing_;
-  cam.queue.push({fr, event});
-}
+  capnp::FlatArrayMessageReader reader(event->data);
+  auto evt = reader.getRoot<cereal::Event>();
+  auto eidx = capnp::AnyStruct::Reader(evt).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+  const int idx = eidx.getSegmentId();
+  if (idx < 0 || idx >= (int)fr->getFrameCount()) {
+    rError("camera[%d] failed to get frame: %d", cam.type, idx);
+    return;
+  }
+
+  std::unique_lock lk(cam.lock);
+  // where frame i of r is in publishing order: the frames of fr, then those of next_fr. -1 for other segments
+  const int frame_count = fr->getFrameCount();
+  auto position = [&](const auto &r, int i) {
+    return same_reader(r, fr) ? i : next_fr && same_reader(r, next_fr) ? frame_count + i : -1;
+  };
+  auto drop_stale = [&]() {
+    while (!cam.ring.empty() && position(cam.ring.front().reader, cam.ring.front().idx) < idx) cam.ring.pop_front();
+  };
+  drop_stale();
+  if (cam.reader == fr) {
+    // the next segment may have been loaded since the last frame
+    cam.next_reader = next_fr;
+  }
 
-void CameraServer::waitForSent() {
-  while (publishing_ > 0) {
-    std::this_thread::yield();
+  // first frame the decoder still has to hand over, anything before it was skipped.
+  // the decoder may already be on next_fr, but anywhere else it has to be moved.
+  int pending = !cam.ring.empty() ? position(cam.ring.front().reader, cam.ring.front().idx)
+                                  : position(cam.reader, cam.decoding_idx != -1 ? cam.decoding_idx : cam.next_idx);
+  bool seek = pending < 0 || (same_reader(cam.last_reader, fr) && idx <= cam.last_idx);
+  cam.last_reader = fr;
+  cam.last_idx = idx;
+  if (seek || (idx < pending && policy == FrameDropPolicy::Wait)) {
+    moveDecoder(cam, fr, next_fr, idx);
+  } else if (idx - position(cam.reader, cam.next_idx) > MAX_DECODE_LAG) {
+    // too far behind to catch up by decoding everything in between
+    int next = idx;
+    if (policy == FrameDropPolicy::Skip) {
+      const auto &packets = fr->packets_info;
+      for (next = idx + 1; next < (int)packets.size() && !(packets[next].flags & AV_PKT_FLAG_KEY); ++next) {}
+      rDebug("camera[%d] decoder fell behind, skipping frames %d..%d", cam.type, cam.next_idx, next - 1);
+    }
+    moveDecoder(cam, fr, next_fr, next);
+  } else {
+    cam.cv.notify_all();  // the decoder may have room in the ring again
+  }
+
+  if (policy == FrameDropPolicy::Wait) {
+    const uint64_t generation = cam.generation;
+    cam.cv.wait(lk, [&]() {
+      drop_stale();
+      return exit_ || cam.generation != generation || !cam.ring.empty();
+    });
+  }
+  if (cam.ring.empty() || position(cam.ring.front().reader, cam.ring.front().idx) != idx) return;
+
+  VisionBuf *buf = cam.ring.front().buf;
+  cam.ring.pop_front();
+  cam.cv.notify_all();
+  lk.unlock();
+
+  if (buf) {
+    VisionIpcBufExtra extra = {
+        .frame_id = eidx.getFrameId(),
+        .timestamp_sof = eidx.getTimestampSof(),
+        .timestamp_eof = eidx.getTimestampEof(),
+    };
+    vipc_server_->send(buf, &extra);
   }
 }
@@ -1,41 +1,73 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
-#include <set>
+#include <mutex>
+#include <thread>
 #include <tuple>
 #include <utility>
 
 #include "msgq/visionipc/visionipc_server.h"
-#include "common/queue.h"
 #include "tools/replay/framereader.h"
 #include "tools/replay/logreader.h"
 
+// what the publisher does with a frame that isn't decoded by its publish time
+enum class FrameDropPolicy {
+  Wait,  // hold the message stream until it's decoded, no frame is lost
+  Skip,  // don't publish it, and a decoder that fell too far behind jumps to the next keyframe
+};
+
+// Each camera has a decoder thread that decodes ahead of the publisher into a ring of
+// vipc buffers. pushFrame publishes at event time from the ring, so a slow decode only
+// delays or drops frames of its own camera. At the end of a segment the decoder goes on
+// with the next one, so the ring stays warm across segment boundaries.
 class CameraServer {
 public:
   CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS] = nullptr);
   ~CameraServer();
-  void pushFrame(CameraType type, FrameReader* fr, const Event *event);
-  void waitForSent();
+  // fr shares ownership of its segment, which stays alive while frames are decoded from it.
+  // next_fr is the camera of the segment after it, if that's loaded.
+  void pushFrame(CameraType type, std::shared_ptr<FrameReader> fr, std::shared_ptr<FrameReader> next_fr,
+                 const Event *event, FrameDropPolicy policy);
 
 protected:
+  struct DecodedFrame {
+    std::weak_ptr<FrameReader> reader;  // only to tell the segments apart, doesn't keep them alive
+    int idx;
+    VisionBuf *buf;  // nullptr if decoding failed
+  };
+
   struct Camera {
     CameraType type;
     VisionStreamType stream_type;
     int width;
     int height;
     std::thread thread;
-    SafeQueue<std::pair<FrameReader*, const Event *>> queue;
-    std::set<VisionBuf *> cached_buf;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::shared_ptr<FrameReader> reader;       // the decoder follows this reader from next_idx on
+    std::shared_ptr<FrameReader> next_reader;  // and then this one from its first frame
+    int next_idx = 0;
+    std::weak_ptr<FrameReader> last_reader;    // where the last frame was pushed from
+    int last_idx = -1;
+    int decoding_idx = -1;           // frame being decoded, -1 if none or if it's been discarded
+    bool busy = false;               // the decoder thread is writing into a vipc buffer
+    uint64_t generation = 0;         // bumped whenever the decoder is moved, discards its frame in flight
+    std::deque<DecodedFrame> ring;   // decoded frames ahead of the publisher, in order
   };
   void startVipcServer();
-  void cameraThread(Camera &cam);
-  VisionBuf *getFrame(Camera &cam, FrameReader *fr, int32_t segment_id, uint32_t frame_id);
+  void stopDecoding();
+  void moveDecoder(Camera &cam, std::shared_ptr<FrameReader> fr, std::shared_ptr<FrameReader> next_fr, int idx);
+  void decoderThread(Camera &cam);
 
   Camera cameras_[MAX_CAMERAS] = {
       {.type = RoadCam, .stream_type = VISION_STREAM_ROAD},
       {.type = DriverCam, .stream_type = VISION_STREAM_DRIVER},
       {.type = WideRoadCam, .stream_type = VISION_STREAM_WIDE_ROAD},
   };
-  std::atomic<int> publishing_ = 0;
+  std::atomic<bool> exit_ = false;
   std::unique_ptr<VisionIpcServer> vipc_server_;
 };
@@ -1,5 +1,7 @@
 #include "tools/replay/framereader.h"
 
+#include <algorithm>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <tuple>
@@ -31,9 +33,12 @@ enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *
   return AV_PIX_FMT_YUV420P;
 }
 
+DecoderThreadType decoder_thread_type = DecoderThreadType::Slice;
+int decoder_threads = 0;
+
 struct DecoderManager {
   VideoDecoder *acquire(CameraType type, AVCodecParameters *codecpar, bool hw_decoder) {
-    auto key = std::tuple(type, codecpar->width, codecpar->height);
+    auto key = std::tuple(type, codecpar->width, codecpar->height, decoder_thread_type, decoder_threads);
     std::unique_lock lock(mutex_);
     if (auto it = decoders_.find(key); it != decoders_.end()) {
       return it->second.get();
@@ -57,13 +62,19 @@ struct DecoderManager {
   }
 
   std::mutex mutex_;
-  std::map<std::tuple<CameraType, int, int>, std::unique_ptr<VideoDecoder>> decoders_;
+  std::map<std::tuple<CameraType, int, int, DecoderThreadType, int>, std::unique_ptr<VideoDecoder>> decoders_;
 };
 
 DecoderManager decoder_manager;
 
 }  // namespace
 
+void setDecoderThreading(DecoderThreadType type, int threads) {
+  std::unique_lock lock(decoder_manager.mutex_);
+  decoder_thread_type = type;
+  decoder_threads = std::max(0, threads);
+}
+
 FrameReader::FrameReader() {
   av_log_set_level(AV_LOG_QUIET);
 }
@@ -75,7 +86,9 @@ FrameReader::~FrameReader() {
 bool FrameReader::load(CameraType type, const std::string &url, bool no_hw_decoder, std::atomic<bool> *abort, bool local_cache) {
   std::string local_file_path;
   if (url.find("https://") == 0 || url.find("http://") == 0) {
+    const auto download_start = std::chrono::steady_clock::now();
     local_file_path = PyDownloader::download(url, local_cache, abort);
+    download_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - download_start).count();
     if (local_file_path.empty()) return false;
   } else {
     local_file_path = url;
@@ -120,7 +133,58 @@ bool FrameReader::get(int idx, VisionBuf *buf) {
   if (!buf || idx < 0 || idx >= packets_info.size()) {
     return false;
   }
-  return decoder_->decode(this, idx, buf);
+  const auto start = std::chrono::steady_clock::now();
+  // the decoder stays where it was, so the frames after prev_idx are still decoded sequentially
+  bool ret = frame_cache.get(idx, buf) || decoder_->decode(this, idx, buf);
+  get_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  ++get_count;
+  return ret;
+}
+
+// class FrameCache
+
+bool FrameCache::get(int idx, VisionBuf *buf) {
+  auto it = frames_.find(idx);
+  if (it == frames_.end() || it->second->stride != buf->stride || it->second->height != buf->height) {
+    return false;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  const Frame &frame = *it->second;
+  const size_t y_size = frame.stride * frame.height;
+  memcpy(buf->y, frame.data.data(), y_size);
+  memcpy(buf->uv, frame.data.data() + y_size, frame.data.size() - y_size);
+  return true;
+}
+
+void FrameCache::put(int idx, const VisionBuf *buf) {
+  const size_t y_size = buf->stride * buf->height;
+  const size_t size = y_size + buf->stride * (buf->height / 2);
+  if (size > max_bytes_ || contains(idx)) return;
+
+  // make room, reusing the buffer of the least recently used frame
+  std::vector<uint8_t> data;
+  while (bytes_ + size > max_bytes_) {
+    data = std::move(lru_.back().data);
+    bytes_ -= data.size();
+    frames_.erase(lru_.back().idx);
+    lru_.pop_back();
+  }
+  data.resize(size);
+  memcpy(data.data(), buf->y, y_size);
+  memcpy(data.data() + y_size, buf->uv, size - y_size);
+
+  lru_.push_front({idx, buf->stride, buf->height, std::move(data)});
+  frames_[idx] = lru_.begin();
+  bytes_ += size;
+}
+
+void FrameCache::setMaxBytes(size_t max_bytes) {
+  max_bytes_ = max_bytes;
+  while (bytes_ > max_bytes_) {
+    bytes_ -= lru_.back().data.size();
+    frames_.erase(lru_.back().idx);
+    lru_.pop_back();
+  }
 }
 
 // class VideoDecoder
@@ -152,6 +216,10 @@ bool FFmpegVideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder) {
   if (hw_decoder && !initHardwareDecoder(HW_DEVICE_TYPE)) {
     rWarning("No device with hardware decoder found. fallback to CPU decoding.");
   }
+  if (hw_pix_fmt == AV_PIX_FMT_NONE) {
+    decoder_ctx->thread_count = decoder_threads;
+    decoder_ctx->thread_type = decoder_thread_type == DecoderThreadType::Frame ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+  }
 
   if (avcodec_open2(decoder_ctx, decoder, nullptr) < 0) {
     rError("Failed to open codec");
@@ -186,9 +254,14 @@ bool FFmpegVideoDecoder::initHardwareDecoder(AVHWDeviceType hw_device_type) {
   return true;
 }
 
+// With frame threading the decoder returns a frame only a few packets after the packet went in, so packets are
+// sent until the frames come out and the frames are counted by their output.
 bool FFmpegVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
   int current_idx = idx;
-  if (idx != reader->prev_idx + 1) {
+  // the decoder is shared by the readers of a camera, and may still hold frames of another one
+  const bool seeking = idx != reader->prev_idx + 1 || reader->prev_idx < 0 || reader != last_reader_;
+  const bool cache_frames = seeking && reader->frame_cache.maxBytes() > 0;
+  if (seeking) {
     // seeking to the nearest key frame
     for (int i = idx; i >= 0; --i) {
       if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
@@ -205,8 +278,37 @@ bool FFmpegVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
     }
     avcodec_flush_buffers(decoder_ctx);
   }
+  last_reader_ = reader;
   reader->prev_idx = idx;
 
+  while (true) {
+    AVFrame *frame = nullptr;
+    int ret = receiveFrame(&frame);
+    if (ret == AVERROR(EAGAIN)) {
+      if (!sendNextPacket(reader)) return false;
+      continue;
+    } else if (ret == AVERROR_EOF) {
+      rError("Failed to find frame at index %d", idx);
+      return false;
+    } else if (ret != 0) {
+      rError("Failed to decode frame at index %d", current_idx);
+      return false;
+    }
+
+    if (current_idx == idx) {
+      bool success = copyBuffer(frame, buf);
+      if (success && cache_frames) reader->frame_cache.put(idx, buf);
+      return success;
+    }
+    // buf is free until the target frame, convert the frames on the way in it
+    if (cache_frames && !reader->frame_cache.contains(current_idx) && copyBuffer(frame, buf)) {
+      reader->frame_cache.put(current_idx, buf);
+    }
+    ++current_idx;
+  }
+}
+
+bool FFmpegVideoDecoder::sendNextPacket(FrameReader *reader) {
   AVPacket pkt;
   while (av_read_frame(reader->input_ctx, &pkt) >= 0) {
     // Skip non-video packets
@@ -214,40 +316,34 @@ bool FFmpegVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
       av_packet_unref(&pkt);
       continue;
     }
-
-    AVFrame *frame = decodeFrame(&pkt);
+    int ret = avcodec_send_packet(decoder_ctx, &pkt);
     av_packet_unref(&pkt);
-    if (!frame) {
-      rError("Failed to decode frame at index %d", current_idx);
+    if (ret < 0) {
+      rError("Error sending a packet for decoding: %d", ret);
       return false;
     }
-
-    if (current_idx++ == idx) {
-      return copyBuffer(frame, buf);
-    }
+    return true;
   }
-  rError("Failed to find frame at index %d", idx);
-  return false;
+  // end of the file, drain the frames that are still in the decoder
+  int ret = avcodec_send_packet(decoder_ctx, nullptr);
+  return ret >= 0 || ret == AVERROR_EOF;
 }
 
-AVFrame *FFmpegVideoDecoder::decodeFrame(AVPacket *pkt) {
-  int ret = avcodec_send_packet(decoder_ctx, pkt);
-  if (ret < 0) {
-    rError("Error sending a packet for decoding: %d", ret);
-    return nullptr;
-  }
-
-  ret = avcodec_receive_frame(decoder_ctx, av_frame_);
+int FFmpegVideoDecoder::receiveFrame(AVFrame **frame) {
+  int ret = avcodec_receive_frame(decoder_ctx, av_frame_);
   if (ret != 0) {
-    rError("avcodec_receive_frame error: %d", ret);
-    return nullptr;
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+      rError("avcodec_receive_frame error: %d", ret);
+    }
+    return ret;
   }
 
   if (av_frame_->format == hw_pix_fmt && av_hwframe_transfer_data(hw_frame_, av_frame_, 0) < 0) {
     rError("error transferring frame data from GPU to CPU");
-    return nullptr;
+    return AVERROR(EIO);
   }
-  return (av_frame_->format == hw_pix_fmt) ? hw_frame_ : av_frame_;
+  *frame = (av_frame_->format == hw_pix_fmt) ? hw_frame_ : av_frame_;
+  return 0;
 }
 
 bool FFmpegVideoDecoder::copyBuffer(AVFrame *f, VisionBuf *buf) {
@@ -282,7 +378,8 @@ bool QcomVideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder) {
 
 bool QcomVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
   int from_idx = idx;
-  if (idx != reader->prev_idx + 1) {
+  const bool seeking = idx != reader->prev_idx + 1;
+  if (seeking) {
     // seeking to the nearest key frame
     for (int i = idx; i >= 0; --i) {
       if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
@@ -304,8 +401,12 @@ bool QcomVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
   msm_vidc.avctx = reader->input_ctx;
   for (int i = from_idx; i <= idx; ++i) {
     if (av_read_frame(reader->input_ctx, &pkt) == 0) {
-      result = msm_vidc.decodeFrame(&pkt, buf) && (i == idx);
+      bool decoded = msm_vidc.decodeFrame(&pkt, buf);
+      result = decoded && (i == idx);
       av_packet_unref(&pkt);
+      if (decoded && seeking) {
+        reader->frame_cache.put(i, buf);
+      }
     }
   }
   return result;
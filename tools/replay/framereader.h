@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <list>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "msgq/visionipc/visionbuf.h"
@@ -17,6 +20,37 @@ extern "C" {
 
 class VideoDecoder;
 
+// LRU cache of decoded NV12 frames, limited by their size in bytes
+class FrameCache {
+public:
+  FrameCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+  bool get(int idx, VisionBuf *buf);
+  void put(int idx, const VisionBuf *buf);
+  bool contains(int idx) const { return frames_.count(idx) > 0; }
+  void setMaxBytes(size_t max_bytes);
+  size_t maxBytes() const { return max_bytes_; }
+
+private:
+  struct Frame {
+    int idx;
+    size_t stride, height;
+    std::vector<uint8_t> data;
+  };
+
+  std::list<Frame> lru_;  // most recently used first
+  std::unordered_map<int, std::list<Frame>::iterator> frames_;
+  size_t max_bytes_, bytes_ = 0;
+};
+
+enum class DecoderThreadType { Frame, Slice };
+// threading of the software decoders opened from now on, 0 threads uses all cores and 1 turns it off.
+// defaults to slice threads: frame threads decode faster sequentially, but add a frame of latency per thread
+// and have to refill the pipeline after every seek, which is what random access like cabana does most.
+void setDecoderThreading(DecoderThreadType type, int threads);
+
+// a bit more than a GOP of 1928x1208 frames
+const size_t FRAME_CACHE_BYTES = 96 * 1024 * 1024;
+
 class FrameReader {
 public:
   FrameReader();
@@ -37,6 +71,13 @@ public:
     int64_t pos;
   };
   std::vector<PacketInfo> packets_info;
+  // frames decoded on the way to a seek target, so stepping back within a GOP doesn't decode it again
+  FrameCache frame_cache{FRAME_CACHE_BYTES};
+
+  // for benchmarks, get() runs on the camera's decoder thread while they're read
+  double download_seconds = 0.0;
+  std::atomic<uint64_t> get_nanos = 0;
+  std::atomic<uint32_t> get_count = 0;
 };
 
 
@@ -57,9 +98,11 @@ public:
 
 private:
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
-  AVFrame *decodeFrame(AVPacket *pkt);
+  bool sendNextPacket(FrameReader *reader);
+  int receiveFrame(AVFrame **frame);
   bool copyBuffer(AVFrame *f, VisionBuf *buf);
 
+  const FrameReader *last_reader_ = nullptr;
   AVFrame *av_frame_, *hw_frame_;
   AVCodecContext *decoder_ctx = nullptr;
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
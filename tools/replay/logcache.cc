@@ -0,0 +1,191 @@
+#include "tools/replay/logcache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "common/util.h"
+#include "system/hardware/hw.h"
+#include "tools/replay/util.h"
+
+namespace {
+
+constexpr char CACHE_MAGIC[8] = {'O', 'P', 'L', 'O', 'G', 'C', '0', '1'};
+
+// followed by the key, padded to a word, and the decompressed log
+struct CacheHeader {
+  char magic[8];
+  uint64_t data_size;
+  uint64_t key_size;
+  uint64_t reserved;
+};
+
+// the modification time, st_mtim is st_mtimespec on macOS
+timespec mtime(const struct stat &st) {
+#ifdef __APPLE__
+  return st.st_mtimespec;
+#else
+  return st.st_mtim;
+#endif
+}
+
+std::string cache_dir() {
+  return Path::download_cache_root() + "/decompressed_logs/";
+}
+
+// signed urls differ in their query, and local files can be rewritten in place
+std::string cache_key(const std::string &url) {
+  std::string key = getUrlWithoutQuery(url);
+  struct stat st;
+  if (url.find("://") == std::string::npos && stat(url.c_str(), &st) == 0) {
+    const timespec t = mtime(st);
+    key += "@" + std::to_string(t.tv_sec) + "." + std::to_string(t.tv_nsec);
+  }
+  return key;
+}
+
+std::string cache_path(const std::string &key) {
+  std::ostringstream ss;
+  ss << cache_dir() << std::hex << std::hash<std::string>{}(key) << ".log";
+  return ss.str();
+}
+
+size_t data_offset(size_t key_size) {
+  return sizeof(CacheHeader) + (key_size + sizeof(capnp::word) - 1) / sizeof(capnp::word) * sizeof(capnp::word);
+}
+
+// remove the least recently used entries until the cache fits in its budget
+void evict(size_t budget) {
+  static std::mutex evict_lock;
+  std::lock_guard lk(evict_lock);
+
+  std::vector<std::tuple<timespec, size_t, std::string>> entries;  // (last use, size, path)
+  size_t total = 0;
+  const std::string dir = cache_dir();
+  if (DIR *d = opendir(dir.c_str())) {
+    while (struct dirent *entry = readdir(d)) {
+      std::string path = dir + entry->d_name;
+      struct stat st;
+      if (util::ends_with(entry->d_name, ".log") && stat(path.c_str(), &st) == 0) {
+        entries.emplace_back(mtime(st), st.st_size, path);
+        total += st.st_size;
+      }
+    }
+    closedir(d);
+  }
+
+  std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
+    auto &ta = std::get<0>(a), &tb = std::get<0>(b);
+    return ta.tv_sec < tb.tv_sec || (ta.tv_sec == tb.tv_sec && ta.tv_nsec < tb.tv_nsec);
+  });
+  for (auto &[_, size, path] : entries) {
+    if (total <= budget) break;
+    // mappings of a removed entry stay valid until they're unmapped
+    if (unlink(path.c_str()) == 0) total -= size;
+  }
+}
+
+}  // namespace
+
+MappedLog::~MappedLog() {
+  munmap(addr_, size_);
+}
+
+size_t LogCache::budget() {
+  return std::max(0, util::getenv("REPLAY_LOG_CACHE_MB", 0)) * size_t(1024 * 1024);
+}
+
+std::unique_ptr<MappedLog> LogCache::open(const std::string &url) {
+  const std::string key = cache_key(url);
+  const std::string path = cache_path(key);
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader)) {
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) return nullptr;
+
+  const CacheHeader *header = (const CacheHeader *)addr;
+  const size_t size = st.st_size;
+  bool valid = memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header->key_size < size &&
+               data_offset(header->key_size) + header->data_size == size &&
+               key == std::string_view((const char *)addr + sizeof(CacheHeader), header->key_size);
+  if (!valid) {
+    munmap(addr, size);
+    return nullptr;
+  }
+
+  // mark as recently used for eviction
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  return std::make_unique<MappedLog>(addr, size, data_offset(header->key_size));
+}
+
+LogCacheWriter::LogCacheWriter(const std::string &url) {
+  const std::string key = cache_key(url);
+  path_ = cache_path(key);
+  std::ostringstream tmp;
+  tmp << path_ << "." << getpid() << "." << std::this_thread::get_id() << ".tmp";
+  tmp_path_ = tmp.str();
+
+  util::create_directories(cache_dir(), 0775);
+  file_ = fopen(tmp_path_.c_str(), "wb");
+  if (!file_) {
+    rWarning("failed to create log cache file %s", tmp_path_.c_str());
+    return;
+  }
+  CacheHeader header = {};
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.key_size = key.size();
+  std::string padded_key = key;
+  padded_key.resize(data_offset(key.size()) - sizeof(CacheHeader), '\0');
+  failed_ = fwrite(&header, sizeof(header), 1, file_) != 1 ||
+            fwrite(padded_key.data(), 1, padded_key.size(), file_) != padded_key.size();
+}
+
+LogCacheWriter::~LogCacheWriter() {
+  if (file_) {
+    fclose(file_);
+    unlink(tmp_path_.c_str());
+  }
+}
+
+void LogCacheWriter::write(kj::ArrayPtr<const capnp::word> words) {
+  if (!file_ || failed_) return;
+  const size_t size = words.size() * sizeof(capnp::word);
+  failed_ = fwrite(words.begin(), 1, size, file_) != size;
+  data_size_ += size;
+}
+
+bool LogCacheWriter::commit() {
+  if (!file_ || failed_) return false;
+
+  // the size goes in last, so a partially written entry never validates
+  uint64_t data_size = data_size_;
+  bool ok = fseek(file_, offsetof(CacheHeader, data_size), SEEK_SET) == 0 &&
+            fwrite(&data_size, sizeof(data_size), 1, file_) == 1;
+  ok = fclose(file_) == 0 && ok;
+  file_ = nullptr;
+  if (!ok || rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+    unlink(tmp_path_.c_str());
+    return false;
+  }
+  evict(LogCache::budget());
+  return true;
+}
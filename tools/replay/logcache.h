@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "cereal/messaging/messaging.h"
+
+// On-disk cache of decompressed logs in Path::download_cache_root()/decompressed_logs,
+// enabled by REPLAY_LOG_CACHE_MB=<size budget>. Entries are keyed by url and, for local
+// files, their mtime. A hit is mmap'd, and events point straight into the mapping.
+// The least recently used entries are removed once the cache exceeds its budget.
+
+// read-only mapping of a cached log
+class MappedLog {
+public:
+  MappedLog(void *addr, size_t size, size_t data_offset) : addr_(addr), size_(size), data_offset_(data_offset) {}
+  MappedLog(const MappedLog &) = delete;
+  MappedLog &operator=(const MappedLog &) = delete;
+  ~MappedLog();
+  kj::ArrayPtr<const capnp::word> words() const {
+    return kj::arrayPtr((const capnp::word *)((const char *)addr_ + data_offset_), (size_ - data_offset_) / sizeof(capnp::word));
+  }
+
+private:
+  void *addr_;
+  size_t size_, data_offset_;
+};
+
+namespace LogCache {
+
+// size budget in bytes, 0 if the cache is disabled
+size_t budget();
+// maps the cached log for url, nullptr if it's not cached
+std::unique_ptr<MappedLog> open(const std::string &url);
+
+}  // namespace LogCache
+
+// writes a decompressed log into the cache, it only becomes visible with commit()
+class LogCacheWriter {
+public:
+  LogCacheWriter(const std::string &url);
+  ~LogCacheWriter();
+  void write(kj::ArrayPtr<const capnp::word> words);
+  bool commit();
+
+private:
+  std::string path_, tmp_path_;
+  FILE *file_ = nullptr;
+  size_t data_size_ = 0;
+  bool failed_ = false;
+};
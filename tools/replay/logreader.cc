@@ -2,12 +2,77 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <utility>
 #include "tools/replay/filereader.h"
 #include "tools/replay/py_downloader.h"
 #include "tools/replay/util.h"
 #include "common/util.h"
 
+namespace {
+
+constexpr size_t CHUNK_WORDS = 4 * 1024 * 1024 / sizeof(capnp::word);
+constexpr size_t MAX_MESSAGE_WORDS = 256 * 1024 * 1024 / sizeof(capnp::word);
+
+// Copies decompressed bytes into word-aligned chunks and hands out the whole messages in them.
+// A message never spans two chunks: an incomplete one at the end of a full chunk moves to the next.
+class MessageChunker {
+public:
+  MessageChunker(std::vector<kj::Array<capnp::word>> &chunks) : chunks_(chunks) { newChunk(CHUNK_WORDS, {}); }
+
+  template <typename Ready>
+  bool append(const char *data, size_t size, Ready &&ready) {
+    while (size > 0) {
+      kj::Array<capnp::word> &chunk = chunks_.back();
+      const size_t n = std::min(size, chunk.size() * sizeof(capnp::word) - filled_);
+      memcpy((char *)chunk.begin() + filled_, data, n);
+      filled_ += n;
+      data += n;
+      size -= n;
+
+      const size_t start = scanned_;
+      const size_t filled_words = filled_ / sizeof(capnp::word);
+      while (scanned_ < filled_words) {
+        size_t expected = capnp::expectedSizeInWordsFromPrefix(kj::arrayPtr(chunk.begin() + scanned_, filled_words - scanned_));
+        if (expected > filled_words - scanned_) break;
+        scanned_ += expected;
+      }
+      if (scanned_ > start) {
+        ready(kj::arrayPtr<const capnp::word>(chunk.begin() + start, scanned_ - start));
+      }
+
+      if (filled_ == chunk.size() * sizeof(capnp::word)) {
+        auto rest = kj::arrayPtr<const capnp::word>(chunk.begin() + scanned_, chunk.end());
+        size_t expected = capnp::expectedSizeInWordsFromPrefix(rest);
+        if (expected > MAX_MESSAGE_WORDS) return false;
+        newChunk(std::max(CHUNK_WORDS, expected), rest);
+      }
+    }
+    return true;
+  }
+  // bytes of an incomplete message at the end of the input
+  size_t leftover() const { return filled_ - scanned_ * sizeof(capnp::word); }
+
+private:
+  void newChunk(size_t words, kj::ArrayPtr<const capnp::word> rest) {
+    auto chunk = kj::heapArray<capnp::word>(words);
+    memcpy(chunk.begin(), rest.begin(), rest.size() * sizeof(capnp::word));
+    filled_ = rest.size() * sizeof(capnp::word);
+    scanned_ = 0;
+    chunks_.push_back(std::move(chunk));
+  }
+
+  std::vector<kj::Array<capnp::word>> &chunks_;
+  size_t filled_ = 0;   // bytes
+  size_t scanned_ = 0;  // words of whole messages
+};
+
+}  // namespace
+
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache,
                      const ProgressCallback &progress) {
   using Clock = std::chrono::steady_clock;
@@ -16,6 +81,19 @@ bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool loca
   download_seconds_ = 0.0;
   decompress_seconds_ = 0.0;
   parse_seconds_ = 0.0;
+  sort_seconds_ = 0.0;
+  first_event_seconds_ = 0.0;
+
+  if (LogCache::budget() > 0) {
+    if (auto mapped = LogCache::open(url)) {
+      auto words = mapped->words();
+      decompressed_size_ = words.size() * sizeof(capnp::word);
+      bool success = load((const char *)words.begin(), decompressed_size_, abort, progress);
+      if (filters_.empty())
+        mapped_ = std::move(mapped);
+      return success;
+    }
+  }
 
   if (progress) {
     installDownloadProgressHandler([progress](uint64_t cur, uint64_t total, bool success) {
@@ -32,24 +110,119 @@ bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool loca
   }
   compressed_size_ = data.size();
   download_seconds_ = std::chrono::duration<double>(download_end - download_start).count();
-  if (!data.empty()) {
-    const auto decompress_start = Clock::now();
-    if (url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9")) {
-      data = decompressBZ2(data, abort);
-    } else if (url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD")) {
-      data = decompressZST(data, abort);
-    }
-    const auto decompress_end = Clock::now();
-    decompress_seconds_ = std::chrono::duration<double>(decompress_end - decompress_start).count();
+  if (data.empty()) return false;
+
+  if (url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9")) {
+    return loadCompressed(url, data, true, abort, progress);
+  } else if (url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD")) {
+    return loadCompressed(url, data, false, abort, progress);
   }
-  decompressed_size_ = data.size();
 
-  bool success = !data.empty() && load(data.data(), data.size(), abort, progress);
+  decompressed_size_ = data.size();
+  bool success = load(data.data(), data.size(), abort, progress);
   if (filters_.empty())
     raw_ = std::move(data);
   return success;
 }
 
+// Decompresses on a separate thread while this one parses the messages that are already whole,
+// so parsing overlaps decompression and only the decompressed chunks are kept in memory.
+// The messages are also written to the LogCache, if it's enabled.
+bool LogReader::loadCompressed(const std::string &url, const std::string &data, bool bz2, std::atomic<bool> *abort,
+                               const ProgressCallback &progress) {
+  using Clock = std::chrono::steady_clock;
+  const auto start = Clock::now();
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::pair<kj::ArrayPtr<const capnp::word>, size_t>> ready;  // (whole messages, input bytes consumed)
+  bool decompress_done = false, decompress_complete = false;
+  std::atomic<bool> parse_failed = false;
+
+  // the frames in the time range, if that's less than the whole log
+  std::optional<std::vector<ZstdFrame>> frames;
+  if (!bz2 && (begin_mono_time_ > 0 || end_mono_time_ < UINT64_MAX)) {
+    auto all_frames = zstdSeekTable((const std::byte *)data.data(), data.size());
+    if (auto in_range = zstdFramesInRange(all_frames, begin_mono_time_, end_mono_time_); in_range.size() < all_frames.size()) {
+      frames = std::move(in_range);
+    }
+  }
+  std::unique_ptr<LogCacheWriter> cache_writer;
+  if (LogCache::budget() > 0 && !frames) {
+    cache_writer = std::make_unique<LogCacheWriter>(url);
+  }
+
+  std::thread decompress_thread([&]() {
+    MessageChunker chunker(chunks_);
+    auto output = [&](const char *out, size_t size, size_t in_pos) {
+      decompressed_size_ += size;
+      return !parse_failed && chunker.append(out, size, [&](kj::ArrayPtr<const capnp::word> words) {
+        std::lock_guard lk(lock);
+        ready.emplace_back(words, in_pos);
+        cv.notify_one();
+      });
+    };
+    const std::byte *in = (const std::byte *)data.data();
+    bool complete = bz2      ? decompressBZ2Stream(in, data.size(), output, abort)
+                    : frames ? decompressZSTFrames(in, data.size(), *frames, output, abort)
+                             : decompressZSTStream(in, data.size(), output, abort);
+    if (chunker.leftover() > 0) {
+      rWarning("Failed to parse log : %zu bytes of truncated message", chunker.leftover());
+    }
+    decompress_seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::lock_guard lk(lock);
+    decompress_done = true;
+    decompress_complete = complete && chunker.leftover() == 0;
+    cv.notify_one();
+  });
+
+  events.reserve(65000);
+  if (progress) {
+    progress(ProgressStage::Parsing, 0, data.size());
+  }
+  while (!(abort && *abort)) {
+    std::unique_lock lk(lock);
+    cv.wait(lk, [&]() { return !ready.empty() || decompress_done; });
+    if (ready.empty()) break;
+    auto [words, in_pos] = ready.front();
+    ready.pop_front();
+    lk.unlock();
+
+    try {
+      parseEvents(words, abort);
+    } catch (const kj::Exception &e) {
+      rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
+      parse_failed = true;
+      break;
+    }
+    if (cache_writer) {
+      cache_writer->write(words);
+    }
+    if (first_event_seconds_ == 0 && !events.empty()) {
+      first_event_seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    if (progress) {
+      progress(ProgressStage::Parsing, in_pos, data.size());
+    }
+  }
+  decompress_thread.join();
+
+  if (progress) {
+    progress(ProgressStage::Parsing, data.size(), data.size());
+  }
+  bool success = finishLoad(abort);
+  parse_seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+  if (cache_writer && success && decompress_complete && !parse_failed) {
+    cache_writer->commit();
+  }
+  if (!filters_.empty()) {
+    // events were copied out of the chunks
+    chunks_.clear();
+  }
+  return success;
+}
+
 bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort,
                      const ProgressCallback &progress) {
   using Clock = std::chrono::steady_clock;
@@ -63,46 +236,16 @@ bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort,
     if (progress) {
       progress(ProgressStage::Parsing, 0, total_bytes);
     }
-    while (words.size() > 0 && !(abort && *abort)) {
-      capnp::FlatArrayMessageReader reader(words);
-      auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
-      auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
-      words = kj::arrayPtr(reader.getEnd(), words.end());
-      if (which == cereal::Event::Which::SELFDRIVE_STATE) {
-        requires_migration = false;
-      }
-
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
-      }
-
-      uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
-        }
-      }
-
+    parseEvents(words, abort, [&](kj::ArrayPtr<const capnp::word> rest) {
       if (progress) {
         const uint64_t current_bytes =
-          total_bytes - static_cast<uint64_t>(words.size() * sizeof(capnp::word));
+          total_bytes - static_cast<uint64_t>(rest.size() * sizeof(capnp::word));
         if (current_bytes >= total_bytes || current_bytes - last_reported >= report_step) {
           progress(ProgressStage::Parsing, current_bytes, total_bytes);
           last_reported = current_bytes;
         }
       }
-    }
+    });
   } catch (const kj::Exception &e) {
     rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
@@ -111,20 +254,119 @@ bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort,
     progress(ProgressStage::Parsing, size, size);
   }
 
+  bool success = finishLoad(abort);
+  parse_seconds_ = std::chrono::duration<double>(Clock::now() - parse_start).count();
+  return success;
+}
+
+void LogReader::parseEvents(kj::ArrayPtr<const capnp::word> words, std::atomic<bool> *abort,
+                            const std::function<void(kj::ArrayPtr<const capnp::word> rest)> &on_event) {
+  while (words.size() > 0 && !(abort && *abort)) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    auto which = event.which();
+    auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+    if (which == cereal::Event::Which::SELFDRIVE_STATE) {
+      requires_migration = false;
+    }
+    if (on_event) on_event(words);
+
+    if (!filters_.empty()) {
+      if (which >= filters_.size() || !filters_[which])
+        continue;
+      auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+      memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+      event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+    }
+
+    uint64_t mono_time = event.getLogMonoTime();
+    const Event &evt = events.emplace_back(which, mono_time, event_data);
+    // Add encodeIdx packet again as a frame packet for the video stream
+    if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
+        evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
+        evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+      auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+      if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+        uint64_t sof = idx.getTimestampSof();
+        events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+      }
+    }
+  }
+}
+
+bool LogReader::finishLoad(std::atomic<bool> *abort) {
   if (requires_migration) {
     migrateOldEvents();
   }
 
-  parse_seconds_ = std::chrono::duration<double>(Clock::now() - parse_start).count();
-
   if (!events.empty() && !(abort && *abort)) {
     events.shrink_to_fit();
-    std::sort(events.begin(), events.end());
+    const auto sort_start = std::chrono::steady_clock::now();
+    sortEvents();
+    index.build(events);
+    sort_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - sort_start).count();
     return true;
   }
   return false;
 }
 
+// Every service is logged in time order and they're interleaved only slightly out of order, so an insertion
+// sort takes about linear time here. Events that are further out of place, like the migrated ones appended
+// at the end, make it fall back to std::sort.
+void LogReader::sortEvents() {
+  const size_t max_moves = events.size() * 16;
+  size_t moves = 0;
+  for (size_t i = 1; i < events.size(); ++i) {
+    if (!(events[i] < events[i - 1])) continue;
+
+    const Event e = events[i];
+    size_t j = i;
+    for (; j > 0 && e < events[j - 1]; --j) {
+      events[j] = events[j - 1];
+    }
+    events[j] = e;
+    moves += i - j;
+    if (moves > max_moves) {
+      std::sort(events.begin(), events.end());
+      return;
+    }
+  }
+}
+
+void EventIndex::build(const std::vector<Event> &events) {
+  mono_times_.resize(events.size());
+  types_.resize(events.size());
+  services_.clear();
+  for (uint32_t i = 0; i < events.size(); ++i) {
+    const Event &e = events[i];
+    mono_times_[i] = e.mono_time;
+    types_[i] = e.which;
+    if (e.which >= services_.size()) services_.resize(e.which + 1);
+    services_[e.which].push_back(i);
+  }
+}
+
+const std::vector<uint32_t> &EventIndex::service(cereal::Event::Which which) const {
+  static const std::vector<uint32_t> empty;
+  return which < services_.size() ? services_[which] : empty;
+}
+
+size_t EventIndex::upperBound(uint64_t mono_time, cereal::Event::Which which) const {
+  auto [first, last] = std::equal_range(mono_times_.begin(), mono_times_.end(), mono_time);
+  // events at the same time are ordered by type
+  auto types_begin = types_.begin() + (first - mono_times_.begin());
+  auto types_end = types_.begin() + (last - mono_times_.begin());
+  return std::upper_bound(types_begin, types_end, (uint16_t)which) - types_.begin();
+}
+
+int64_t EventIndex::nextOf(cereal::Event::Which which, uint64_t mono_time) const {
+  const auto &positions = service(which);
+  auto it = std::upper_bound(positions.begin(), positions.end(), mono_time,
+                             [this](uint64_t t, uint32_t pos) { return t < mono_times_[pos]; });
+  return it != positions.end() ? (int64_t)*it : -1;
+}
+
 void LogReader::migrateOldEvents() {
   size_t events_size = events.size();
   for (int i = 0; i < events_size; ++i) {
@@ -2,10 +2,12 @@
 
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "cereal/gen/cpp/log.capnp.h"
+#include "tools/replay/logcache.h"
 #include "tools/replay/util.h"
 
 const CameraType ALL_CAMERAS[] = {RoadCam, DriverCam, WideRoadCam};
@@ -14,18 +16,37 @@ const int MAX_CAMERAS = std::size(ALL_CAMERAS);
 class Event {
 public:
   Event(cereal::Event::Which which, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &data, int eidx_segnum = -1)
-    : which(which), mono_time(mono_time), data(data), eidx_segnum(eidx_segnum) {}
+    : mono_time(mono_time), data(data), which(which), eidx_segnum(eidx_segnum) {}
 
   bool operator<(const Event &other) const {
     return mono_time < other.mono_time || (mono_time == other.mono_time && which < other.which);
   }
 
+  // ordered to pack into 32 bytes
   uint64_t mono_time;
-  cereal::Event::Which which;
   kj::ArrayPtr<const capnp::word> data;
+  cereal::Event::Which which;
   int32_t eidx_segnum;
 };
 
+// Column-wise index of a sorted std::vector<Event>: the times and types are kept in their own arrays,
+// and each service has the positions of its events, so lookups don't have to walk the whole Events.
+class EventIndex {
+public:
+  void build(const std::vector<Event> &events);
+  // positions of the events of `which`, in time order
+  const std::vector<uint32_t> &service(cereal::Event::Which which) const;
+  // position of the first event after (mono_time, which), same as std::upper_bound over the events
+  size_t upperBound(uint64_t mono_time, cereal::Event::Which which) const;
+  // position of the first event of `which` after mono_time, or -1
+  int64_t nextOf(cereal::Event::Which which, uint64_t mono_time) const;
+
+private:
+  std::vector<uint64_t> mono_times_;
+  std::vector<uint16_t> types_;
+  std::vector<std::vector<uint32_t>> services_;
+};
+
 class LogReader {
 public:
   enum class ProgressStage {
@@ -40,24 +61,43 @@ public:
             bool local_cache = false, const ProgressCallback &progress = {});
   bool load(const char *data, size_t size, std::atomic<bool> *abort = nullptr,
             const ProgressCallback &progress = {});
+  // only load the frames of seekable zst logs with events in [begin, end) logMonoTime. the other events of those
+  // frames are loaded too, and logs without a logMonoTime index are loaded whole.
+  void setTimeRange(uint64_t begin, uint64_t end) { begin_mono_time_ = begin; end_mono_time_ = end; }
   std::vector<Event> events;
+  EventIndex index;
 
   uint64_t compressed_size() const { return compressed_size_; }
   uint64_t decompressed_size() const { return decompressed_size_; }
   double download_seconds() const { return download_seconds_; }
   double decompress_seconds() const { return decompress_seconds_; }
   double parse_seconds() const { return parse_seconds_; }
+  // the part of parse_seconds() spent sorting and indexing the events
+  double sort_seconds() const { return sort_seconds_; }
+  // from the start of decompression until the first event was parsed
+  double first_event_seconds() const { return first_event_seconds_; }
 
 private:
+  bool loadCompressed(const std::string &url, const std::string &data, bool bz2, std::atomic<bool> *abort,
+                      const ProgressCallback &progress);
+  void parseEvents(kj::ArrayPtr<const capnp::word> words, std::atomic<bool> *abort,
+                   const std::function<void(kj::ArrayPtr<const capnp::word> rest)> &on_event = nullptr);
+  bool finishLoad(std::atomic<bool> *abort);
   void migrateOldEvents();
+  void sortEvents();
 
   std::string raw_;
+  std::vector<kj::Array<capnp::word>> chunks_;  // decompressed messages, when loaded by loadCompressed()
+  std::unique_ptr<MappedLog> mapped_;           // when loaded from the LogCache
   bool requires_migration = true;
   std::vector<bool> filters_;
+  uint64_t begin_mono_time_ = 0, end_mono_time_ = UINT64_MAX;
   MonotonicBuffer buffer_{1024 * 1024};
   uint64_t compressed_size_ = 0;
   uint64_t decompressed_size_ = 0;
   double download_seconds_ = 0.0;
   double decompress_seconds_ = 0.0;
   double parse_seconds_ = 0.0;
+  double sort_seconds_ = 0.0;
+  double first_event_seconds_ = 0.0;
 };
@@ -1,6 +1,8 @@
 #include <getopt.h>
+#include <sys/resource.h>
 
 #include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
@@ -9,6 +11,7 @@
 
 #include "common/prefix.h"
 #include "common/timing.h"
+#include "third_party/json11/json11.hpp"
 #include "tools/replay/consoleui.h"
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
@@ -19,6 +22,7 @@ Options:
   -a, --allow        Whitelist of services to send (comma-separated)
   -b, --block        Blacklist of services to send (comma-separated)
   -c, --cache        Cache <n> segments in memory. Default is 5
+      --prefetch-mb  Stop prefetching segments once they use <n> MB of memory
   -s, --start        Start from <seconds>
   -x, --playback     Playback <speed>
       --demo         Use a demo route instead of providing your own
@@ -32,9 +36,12 @@ Options:
       --no-cache     Turn off local cache
       --qcam         Load qcamera
       --no-hw-decoder Disable HW video decoding
+      --decoder-threads Software video decoding with <n> threads. Default is 0, one per core
+      --slice-threads Decode with slice instead of frame threads, better for frequent seeking
       --no-vipc      Do not output video
       --all          Output all messages including bookmarkButton, uiDebug, userBookmark
       --benchmark    Run in benchmark mode (process all events then exit with stats)
+      --benchmark-json Benchmark, and write the per-segment stages and service rates as JSON to <file>
   -h, --help         Show this help message
 )";
 
@@ -44,10 +51,14 @@ struct ReplayConfig {
   std::vector<std::string> block;
   std::string data_dir;
   std::string prefix;
+  std::string benchmark_json;
   uint32_t flags = REPLAY_FLAG_NONE;
   bool auto_source = false;
   int start_seconds = 0;
   int cache_segments = -1;
+  int prefetch_mb = 0;
+  int decoder_threads = 0;
+  DecoderThreadType decoder_thread_type = DecoderThreadType::Frame;  // playback reads frames in order
   float playback_speed = -1;
 };
 
@@ -56,6 +67,7 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"allow", required_argument, nullptr, 'a'},
       {"block", required_argument, nullptr, 'b'},
       {"cache", required_argument, nullptr, 'c'},
+      {"prefetch-mb", required_argument, nullptr, 0},
       {"start", required_argument, nullptr, 's'},
       {"playback", required_argument, nullptr, 'x'},
       {"demo", no_argument, nullptr, 0},
@@ -68,9 +80,12 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"no-cache", no_argument, nullptr, 0},
       {"qcam", no_argument, nullptr, 0},
       {"no-hw-decoder", no_argument, nullptr, 0},
+      {"decoder-threads", required_argument, nullptr, 0},
+      {"slice-threads", no_argument, nullptr, 0},
       {"no-vipc", no_argument, nullptr, 0},
       {"all", no_argument, nullptr, 0},
       {"benchmark", no_argument, nullptr, 0},
+      {"benchmark-json", required_argument, nullptr, 0},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, 0, nullptr, 0},  // Terminating entry
   };
@@ -106,6 +121,13 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
         std::string name = cli_options[option_index].name;
         if (name == "demo") config.route = DEMO_ROUTE;
         else if (name == "auto") config.auto_source = true;
+        else if (name == "prefetch-mb") config.prefetch_mb = std::atoi(optarg);
+        else if (name == "decoder-threads") config.decoder_threads = std::atoi(optarg);
+        else if (name == "slice-threads") config.decoder_thread_type = DecoderThreadType::Slice;
+        else if (name == "benchmark-json") {
+          config.benchmark_json = optarg;
+          config.flags |= REPLAY_FLAG_BENCHMARK;
+        }
         else config.flags |= flag_map.at(name);
         break;
       }
@@ -127,6 +149,57 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
   return true;
 }
 
+// peak resident set size in MB
+static double peak_rss_mb() {
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1e6;  // bytes
+#else
+  return usage.ru_maxrss / 1e3;  // kilobytes
+#endif
+}
+
+static json11::Json benchmark_json(const Replay &replay, const BenchmarkStats &stats, double peak_rss) {
+  const double stream_seconds = (stats.stream_end_ts - stats.stream_start_ts) / 1e9;
+  auto per_second = [=](double n) { return stream_seconds > 0 ? n / stream_seconds : 0.0; };
+
+  uint64_t total_events = 0;
+  json11::Json::object services;
+  for (const auto &[name, count] : stats.service_events) {
+    services[name] = json11::Json::object{{"events", (double)count}, {"events_per_second", per_second(count)}};
+    total_events += count;
+  }
+
+  json11::Json::array segments;
+  for (const auto &seg : stats.segments) {
+    segments.push_back(json11::Json::object{
+        {"segment", seg.seg_num},
+        {"download_ms", seg.download_ms},
+        {"decompress_ms", seg.decompress_ms},
+        {"parse_ms", seg.parse_ms},
+        {"sort_ms", seg.sort_ms},
+        {"merge_ms", seg.merge_ms},
+        {"publish_ms", seg.publish_ms},
+        {"frame_decode_ms", seg.decode_ms},
+        {"events", (double)seg.events},
+        {"frames", (double)seg.frames},
+    });
+  }
+
+  return json11::Json::object{
+      {"route", replay.route().name()},
+      {"total_ms", (stats.stream_end_ts - stats.process_start_ts) / 1e6},
+      {"stream_ms", stream_seconds * 1e3},
+      {"peak_rss_mb", peak_rss},
+      {"events", (double)total_events},
+      {"events_per_second", per_second(total_events)},
+      {"services", services},
+      {"segments", segments},
+      {"failed_segments", json11::Json(stats.failed_segments)},
+  };
+}
+
 int main(int argc, char *argv[]) {
 #ifdef __APPLE__
   // With all sockets opened, we might hit the default limit of 256 on macOS
@@ -148,10 +221,14 @@ int main(int argc, char *argv[]) {
     op_prefix = std::make_unique<OpenpilotPrefix>(config.prefix);
   }
 
+  setDecoderThreading(config.decoder_thread_type, config.decoder_threads);
   Replay replay(config.route, config.allow, config.block, nullptr, config.flags, config.data_dir, config.auto_source);
   if (config.cache_segments > 0) {
     replay.setSegmentCacheLimit(config.cache_segments);
   }
+  if (config.prefetch_mb > 0) {
+    replay.setPrefetchMemoryLimit(config.prefetch_mb * size_t(1024 * 1024));
+  }
   if (config.playback_speed > 0) {
     replay.setSpeed(std::clamp(config.playback_speed, ConsoleUI::speed_array.front(), ConsoleUI::speed_array.back()));
   }
@@ -163,7 +240,8 @@ int main(int argc, char *argv[]) {
     replay.start(config.start_seconds);
     replay.waitForFinished();
 
-    const auto &stats = replay.getBenchmarkStats();
+    const auto stats = replay.getBenchmarkStats();
+    const double peak_rss = peak_rss_mb();
     uint64_t process_start = stats.process_start_ts;
 
     std::cout << "\n===== REPLAY BENCHMARK RESULTS =====\n";
@@ -178,7 +256,30 @@ int main(int argc, char *argv[]) {
                 << event << "\n";
     }
 
-    return 0;
+    std::cout << "\nSEGMENTS (ms):\n";
+    std::cout << "  seg";
+    for (const char *stage : {"download", "decompress", "parse", "sort", "merge", "publish", "decode"}) {
+      std::cout << " " << std::setw(10) << stage;
+    }
+    std::cout << "\n";
+    for (const auto &seg : stats.segments) {
+      std::cout << "  " << std::setw(3) << seg.seg_num << std::fixed << std::setprecision(1);
+      for (double ms : {seg.download_ms, seg.decompress_ms, seg.parse_ms, seg.sort_ms, seg.merge_ms, seg.publish_ms, seg.decode_ms}) {
+        std::cout << " " << std::setw(10) << ms;
+      }
+      std::cout << "\n";
+    }
+    std::cout << "\nPeak RSS: " << std::setprecision(1) << peak_rss << " MB\n";
+
+    if (!config.benchmark_json.empty()) {
+      std::ofstream out(config.benchmark_json);
+      out << benchmark_json(replay, stats, peak_rss).dump() << "\n";
+      if (!out) {
+        std::cerr << "failed to write " << config.benchmark_json << "\n";
+        return 1;
+      }
+    }
+    return stats.failed_segments.empty() ? 0 : 1;
   }
 
   ConsoleUI console_ui(&replay);
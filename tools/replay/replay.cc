@@ -23,9 +23,17 @@ Replay::Replay(const std::string &route, std::vector<std::string> allow, std::ve
 
   if (flags_ & REPLAY_FLAG_BENCHMARK) {
     benchmark_stats_.process_start_ts = nanos_since_boot();
-    seg_mgr_->setBenchmarkCallback([this](int seg_num, const std::string& event) {
-      benchmark_stats_.timeline.emplace_back(nanos_since_boot(),
-          "segment " + std::to_string(seg_num) + " " + event);
+    seg_mgr_->setBenchmarkCallback([this](int seg_num, const std::string& event, double seconds) {
+      addBenchmarkEvent("segment " + std::to_string(seg_num) + " " + event);
+      std::unique_lock lock(benchmark_lock_);
+      if (event == "merged") {
+        benchmark_merge_ms_[seg_num] += seconds * 1e3;
+      } else if (event == "load failed") {
+        benchmark_stats_.failed_segments.push_back(seg_num);
+        lock.unlock();
+        // let a stream that's waiting for this segment find out it won't come
+        interruptStream([]() { return true; });
+      }
     });
   }
 
@@ -34,6 +42,7 @@ Replay::Replay(const std::string &route, std::vector<std::string> allow, std::ve
   }
   setupServices(allow, block);
   setupSegmentManager(!allow.empty() || !block.empty());
+  benchmark_service_events_.resize(sockets_.size(), 0);
 }
 
 void Replay::setupServices(const std::vector<std::string> &allow, const std::vector<std::string> &block) {
@@ -92,7 +101,7 @@ bool Replay::load() {
   if (!seg_mgr_->load()) return false;
 
   if (hasFlag(REPLAY_FLAG_BENCHMARK)) {
-    benchmark_stats_.timeline.emplace_back(nanos_since_boot(), "route metadata loaded");
+    addBenchmarkEvent("route metadata loaded");
   }
 
   min_seconds_ = seg_mgr_->route_.segments().begin()->first * 60;
@@ -186,10 +195,9 @@ void Replay::startStream(const std::shared_ptr<Segment> segment) {
 
   // get datetime from INIT_DATA, fallback to datetime in the route name
   route_date_time_ = route().datetime();
-  auto it = std::find_if(events.cbegin(), events.cend(),
-                         [](const Event &e) { return e.which == cereal::Event::Which::INIT_DATA; });
-  if (it != events.cend()) {
-    capnp::FlatArrayMessageReader reader(it->data);
+  const auto &index = segment->log->index;
+  if (const auto &init_data = index.service(cereal::Event::Which::INIT_DATA); !init_data.empty()) {
+    capnp::FlatArrayMessageReader reader(events[init_data.front()].data);
     auto event = reader.getRoot<cereal::Event>();
     uint64_t wall_time = event.getInitData().getWallTimeNanos();
     if (wall_time > 0) {
@@ -198,9 +206,8 @@ void Replay::startStream(const std::shared_ptr<Segment> segment) {
   }
 
   // write CarParams
-  it = std::find_if(events.begin(), events.end(), [](const Event &e) { return e.which == cereal::Event::Which::CAR_PARAMS; });
-  if (it != events.end()) {
-    capnp::FlatArrayMessageReader reader(it->data);
+  if (const auto &car_params = index.service(cereal::Event::Which::CAR_PARAMS); !car_params.empty()) {
+    capnp::FlatArrayMessageReader reader(events[car_params.front()].data);
     auto event = reader.getRoot<cereal::Event>();
     car_fingerprint_ = event.getCarParams().getCarFingerprint();
 
@@ -263,7 +270,16 @@ void Replay::publishFrame(const Event *e) {
   auto seg_it = event_data_->segments.find(e->eidx_segnum);
   if (seg_it != event_data_->segments.end()) {
     if (auto &frame = seg_it->second->frames[cam]; frame) {
-      camera_server_->pushFrame(cam, frame.get(), e);
+      // frames in flight keep their segment alive, even once it's merged out of event_data_
+      std::shared_ptr<FrameReader> reader(seg_it->second, frame.get());
+      // the decoder goes on with the next loaded segment at the end of this one
+      std::shared_ptr<FrameReader> next_reader;
+      if (auto next_it = std::next(seg_it); next_it != event_data_->segments.end() && next_it->second->frames[cam]) {
+        next_reader = std::shared_ptr<FrameReader>(next_it->second, next_it->second->frames[cam].get());
+      }
+      // every frame counts in a benchmark, at speed > 1 the message stream shouldn't wait on decoding
+      auto policy = speed_ > 1.0 && !hasFlag(REPLAY_FLAG_BENCHMARK) ? FrameDropPolicy::Skip : FrameDropPolicy::Wait;
+      camera_server_->pushFrame(cam, reader, next_reader, e, policy);
     }
   }
 }
@@ -283,26 +299,27 @@ void Replay::streamThread() {
 
     event_data_ = seg_mgr_->getEventData();
     const auto &events = event_data_->events;
-    auto first = std::upper_bound(events.cbegin(), events.cend(), Event(cur_which_, cur_mono_time_, {}));
-    if (first == events.cend()) {
+    auto first = events.upperBound(cur_mono_time_, cur_which_);
+    if (first == events.end()) {
+      // a benchmark goes through the whole route, waiting for its segments as they're merged
+      if (hasFlag(REPLAY_FLAG_BENCHMARK) && benchmarkFinished()) {
+        exit_ = true;
+        break;
+      }
       rInfo("waiting for events...");
       events_ready_ = false;
       continue;
     }
 
     if (!streaming_started && hasFlag(REPLAY_FLAG_BENCHMARK)) {
-      benchmark_stats_.timeline.emplace_back(nanos_since_boot(), "streaming started");
+      benchmark_stats_.stream_start_ts = nanos_since_boot();
+      addBenchmarkEvent("streaming started");
       streaming_started = true;
     }
 
-    auto it = publishEvents(first, events.cend(), last_processed_segment, segment_start_time);
-
-    // Ensure frames are sent before unlocking to prevent race conditions
-    if (camera_server_) {
-      camera_server_->waitForSent();
-    }
+    auto it = publishEvents(first, events.end(), last_processed_segment, segment_start_time);
 
-    if (it == events.cend() && !hasFlag(REPLAY_FLAG_NO_LOOP) && !hasFlag(REPLAY_FLAG_BENCHMARK)) {
+    if (it == events.end() && !hasFlag(REPLAY_FLAG_NO_LOOP) && !hasFlag(REPLAY_FLAG_BENCHMARK)) {
       int last_segment = seg_mgr_->route_.segments().rbegin()->first;
       if (event_data_->isSegmentLoaded(last_segment)) {
         rInfo("reaches the end of route, restart from beginning");
@@ -310,28 +327,75 @@ void Replay::streamThread() {
         seekTo(minSeconds(), false);
         stream_lock_.lock();
       }
-    } else if (it == events.cend() && hasFlag(REPLAY_FLAG_BENCHMARK)) {
-      // Exit benchmark mode after first segment completes
-      exit_ = true;
-      break;
     }
   }
 
   if (hasFlag(REPLAY_FLAG_BENCHMARK)) {
-    benchmark_stats_.timeline.emplace_back(nanos_since_boot(), "benchmark done");
+    benchmark_stats_.stream_end_ts = nanos_since_boot();
+    if (last_processed_segment >= 0) {
+      addBenchmarkSegment(last_processed_segment, benchmark_stats_.stream_end_ts - segment_start_time);
+    }
+    addBenchmarkEvent("benchmark done");
 
     {
       std::unique_lock lock(benchmark_lock_);
+      for (size_t i = 0; i < benchmark_service_events_.size(); ++i) {
+        if (benchmark_service_events_[i] > 0) {
+          benchmark_stats_.service_events[sockets_[i]] = benchmark_service_events_[i];
+        }
+      }
       benchmark_done_ = true;
     }
     benchmark_cv_.notify_one();
   }
 }
 
-std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::const_iterator first,
-                                                         std::vector<Event>::const_iterator last,
-                                                         int &last_processed_segment,
-                                                         uint64_t &segment_start_time) {
+void Replay::addBenchmarkEvent(const std::string &event) {
+  std::lock_guard lock(benchmark_lock_);
+  benchmark_stats_.timeline.emplace_back(nanos_since_boot(), event);
+}
+
+// collects the stages of a segment that's done publishing, while event_data_ still holds it
+void Replay::addBenchmarkSegment(int seg_num, uint64_t publish_ns) {
+  BenchmarkStats::SegmentStats stats = {.seg_num = seg_num, .publish_ms = publish_ns / 1e6};
+  if (auto it = event_data_->segments.find(seg_num); it != event_data_->segments.end()) {
+    if (const auto &log = it->second->log) {
+      stats.download_ms = log->download_seconds() * 1e3;
+      stats.decompress_ms = log->decompress_seconds() * 1e3;
+      stats.sort_ms = log->sort_seconds() * 1e3;
+      stats.parse_ms = log->parse_seconds() * 1e3 - stats.sort_ms;
+      stats.events = log->events.size();
+    }
+    for (const auto &frame : it->second->frames) {
+      if (frame) {
+        stats.download_ms += frame->download_seconds * 1e3;
+        stats.decode_ms += frame->get_nanos / 1e6;
+        stats.frames += frame->get_count;
+      }
+    }
+  }
+
+  std::lock_guard lock(benchmark_lock_);
+  stats.merge_ms = benchmark_merge_ms_[seg_num];
+  benchmark_stats_.segments.push_back(stats);
+}
+
+// the whole route is published, or the rest of it can't be as the next segment failed to load
+bool Replay::benchmarkFinished() {
+  if (event_data_->segments.empty()) return false;
+
+  int last_merged = event_data_->segments.rbegin()->first;
+  if (last_merged == seg_mgr_->route_.segments().rbegin()->first) return true;
+
+  std::lock_guard lock(benchmark_lock_);
+  const auto &failed = benchmark_stats_.failed_segments;
+  return std::find(failed.begin(), failed.end(), last_merged + 1) != failed.end();
+}
+
+EventList::const_iterator Replay::publishEvents(EventList::const_iterator first,
+                                                EventList::const_iterator last,
+                                                int &last_processed_segment,
+                                                uint64_t &segment_start_time) {
   uint64_t evt_start_ts = cur_mono_time_;
   uint64_t loop_start_ts = nanos_since_boot();
   double prev_replay_speed = speed_;
@@ -356,7 +420,8 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
         oss << "segment " << last_processed_segment << " done publishing ("
             << std::fixed << std::setprecision(0) << processing_time_ms << " ms, "
             << std::fixed << std::setprecision(0) << realtime_factor << "x realtime)";
-        benchmark_stats_.timeline.emplace_back(nanos_since_boot(), oss.str());
+        addBenchmarkEvent(oss.str());
+        addBenchmarkSegment(last_processed_segment, processing_time_ns);
       }
       segment_start_time = nanos_since_boot();
       last_processed_segment = segment;
@@ -367,6 +432,7 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
 
     // Skip events if socket is not present
     if (!sockets_[evt.which]) continue;
+    if (hasFlag(REPLAY_FLAG_BENCHMARK)) ++benchmark_service_events_[evt.which];
 
     const uint64_t current_nanos = nanos_since_boot();
     const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
@@ -388,9 +454,6 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
     if (evt.eidx_segnum == -1) {
       publishMessage(&evt);
     } else if (camera_server_) {
-      if (speed_ > 1.0) {
-        camera_server_->waitForSent();
-      }
       publishFrame(&evt);
     }
   }
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -28,8 +29,22 @@ enum REPLAY_FLAGS {
 };
 
 struct BenchmarkStats {
+  // stages of a segment in ms. they overlap: parsing runs alongside decompression, and the
+  // frames are decoded on the camera threads while the events are published
+  struct SegmentStats {
+    int seg_num = -1;
+    double download_ms = 0, decompress_ms = 0, parse_ms = 0, sort_ms = 0, merge_ms = 0;
+    double publish_ms = 0, decode_ms = 0;
+    size_t events = 0;
+    uint32_t frames = 0;
+  };
+
   uint64_t process_start_ts = 0;
+  uint64_t stream_start_ts = 0, stream_end_ts = 0;
   std::vector<std::pair<uint64_t, std::string>> timeline;
+  std::vector<SegmentStats> segments;
+  std::map<std::string, uint64_t> service_events;  // published events of each service
+  std::vector<int> failed_segments;
 };
 
 class Replay {
@@ -46,6 +61,7 @@ public:
   inline bool isPaused() const { return user_paused_; }
   inline int segmentCacheLimit() const { return seg_mgr_->segment_cache_limit_; }
   inline void setSegmentCacheLimit(int n) { seg_mgr_->segment_cache_limit_ = std::max(MIN_SEGMENTS_CACHE, n); }
+  inline void setPrefetchMemoryLimit(size_t bytes) { seg_mgr_->prefetch_memory_limit_ = bytes; }
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   void setLoop(bool loop) { loop ? flags_ &= ~REPLAY_FLAG_NO_LOOP : flags_ |= REPLAY_FLAG_NO_LOOP; }
   bool loop() const { return !(flags_ & REPLAY_FLAG_NO_LOOP); }
@@ -64,7 +80,10 @@ public:
   const std::shared_ptr<SegmentManager::EventData> getEventData() const { return seg_mgr_->getEventData(); }
   void installEventFilter(std::function<bool(const Event *)> filter) { event_filter_ = filter; }
   void waitForFinished();
-  const BenchmarkStats &getBenchmarkStats() const { return benchmark_stats_; }
+  BenchmarkStats getBenchmarkStats() {
+    std::lock_guard lock(benchmark_lock_);
+    return benchmark_stats_;
+  }
 
   // Event callback functions
   std::function<void()> onSegmentsMerged = nullptr;
@@ -79,13 +98,16 @@ private:
   void streamThread();
   void handleSegmentMerge();
   void interruptStream(const std::function<bool()>& update_fn);
-  std::vector<Event>::const_iterator publishEvents(std::vector<Event>::const_iterator first,
-                                                   std::vector<Event>::const_iterator last,
-                                                   int &last_processed_segment,
-                                                   uint64_t &segment_start_time);
+  EventList::const_iterator publishEvents(EventList::const_iterator first,
+                                          EventList::const_iterator last,
+                                          int &last_processed_segment,
+                                          uint64_t &segment_start_time);
   void publishMessage(const Event *e);
   void publishFrame(const Event *e);
   void checkSeekProgress();
+  void addBenchmarkEvent(const std::string &event);
+  void addBenchmarkSegment(int seg_num, uint64_t publish_ns);
+  bool benchmarkFinished();
 
   std::unique_ptr<SegmentManager> seg_mgr_;
   Timeline timeline_;
@@ -122,4 +144,6 @@ private:
   std::condition_variable benchmark_cv_;
   std::mutex benchmark_lock_;
   bool benchmark_done_ = false;
+  std::map<int, double> benchmark_merge_ms_;
+  std::vector<uint64_t> benchmark_service_events_;
 };
@@ -1,6 +1,8 @@
 #include "tools/replay/seg_mgr.h"
 
 #include <algorithm>
+#include <chrono>
+#include <iterator>
 
 SegmentManager::~SegmentManager() {
   {
@@ -74,74 +76,159 @@ void SegmentManager::manageSegmentCache() {
   }
 }
 
+// The merged events only reference the segments' events, so a merge costs
+// O(segments * (log(events) + overlap)) however many events are cached.
 bool SegmentManager::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   std::set<int> segments_to_merge;
-  size_t total_event_count = 0;
   for (auto it = begin; it != end; ++it) {
     const auto &segment = it->second;
     if (segment && segment->getState() == Segment::LoadState::Loaded) {
       segments_to_merge.insert(segment->seg_num);
-      total_event_count += segment->log->events.size();
     }
   }
 
   if (segments_to_merge == merged_segments_) return false;
 
+  const auto start = std::chrono::steady_clock::now();
   auto merged_event_data = std::make_shared<EventData>();
-  auto &merged_events = merged_event_data->events;
-  merged_events.reserve(total_event_count);
-
   std::string segments_str = join(segments_to_merge, ", ");
   rDebug("merging segments: %s", segments_str.c_str());
   for (int n : segments_to_merge) {
-    const auto &events = segments_.at(n)->log->events;
-    if (events.empty()) continue;
+    const auto &log = segments_.at(n)->log;
+    if (log->events.empty()) continue;
 
     // Skip INIT_DATA if present
-    auto events_begin = (events.front().which == cereal::Event::Which::INIT_DATA) ? std::next(events.begin()) : events.begin();
-
-    size_t previous_size = merged_events.size();
-    merged_events.insert(merged_events.end(), events_begin, events.end());
-    std::inplace_merge(merged_events.begin(), merged_events.begin() + previous_size, merged_events.end());
-
+    size_t first = log->events.front().which == cereal::Event::Which::INIT_DATA ? 1 : 0;
+    merged_event_data->events.append(log->events, first, &log->index);
     merged_event_data->segments[n] = segments_.at(n);
   }
 
   std::atomic_store(&event_data_, std::move(merged_event_data));
+  if (onBenchmarkEvent_) {
+    // split the time across the segments this merge added, so the per-segment times add up to the time spent
+    // merging. merges that only drop segments aren't counted.
+    std::vector<int> added;
+    std::set_difference(segments_to_merge.begin(), segments_to_merge.end(), merged_segments_.begin(), merged_segments_.end(),
+                        std::back_inserter(added));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (int n : added) {
+      onBenchmarkEvent_(n, "merged", seconds / added.size());
+    }
+  }
   merged_segments_ = segments_to_merge;
 
   return true;
 }
 
+// estimated memory of a loaded segment, the videos are read from their files as they're decoded
+static size_t segmentMemory(const Segment &segment) {
+  return segment.log ? segment.log->decompressed_size() + segment.log->events.capacity() * sizeof(Event) : 0;
+}
+
+// Loads up to MAX_PARALLEL_SEGMENT_LOADS segments at once: the current segment first, then the ones ahead
+// of it in playback order, then the ones behind it. Segments other than the current one are only
+// prefetched while the loaded and loading segments are expected to fit in prefetch_memory_limit_.
 void SegmentManager::loadSegmentsInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end) {
-  auto tryLoadSegment = [this](auto first, auto last) {
-    for (auto it = first; it != last; ++it) {
-      auto &segment_ptr = it->second;
-      if (!segment_ptr) {
-        if (onBenchmarkEvent_) {
-          onBenchmarkEvent_(it->first, "loading");
-        }
-        segment_ptr = std::make_shared<Segment>(
-            it->first, route_.at(it->first), flags_, filters_,
-            [this](int seg_num, bool success) {
-              if (onBenchmarkEvent_) {
-                onBenchmarkEvent_(seg_num, success ? "loaded" : "load failed");
-              }
-              std::unique_lock lock(mutex_);
-              needs_update_ = true;
-              cv_.notify_one();
-            });
+  std::vector<SegmentMap::iterator> order;
+  for (auto it = cur; it != end; ++it) order.push_back(it);
+  for (auto it = cur; it != begin;) order.push_back(--it);
+
+  int loading = 0, loaded = 0;
+  size_t loaded_memory = 0;
+  for (auto it : order) {
+    if (!it->second) continue;
+    auto state = it->second->getState();
+    if (state == Segment::LoadState::Loading) {
+      ++loading;
+    } else if (state == Segment::LoadState::Loaded) {
+      ++loaded;
+      loaded_memory += segmentMemory(*it->second);
+    }
+  }
+  const size_t segment_estimate = loaded > 0 ? loaded_memory / loaded : 0;
+  size_t expected_memory = loaded_memory + loading * segment_estimate;
+
+  for (auto it : order) {
+    auto &segment_ptr = it->second;
+    if (segment_ptr) continue;
+    if (it != cur) {
+      if (loading >= MAX_PARALLEL_SEGMENT_LOADS) break;
+      if (prefetch_memory_limit_ > 0 && expected_memory + segment_estimate > prefetch_memory_limit_) {
+        rDebug("prefetching paused at %.1f MB of segments", expected_memory / 1e6);
+        break;
       }
+    }
 
-      if (segment_ptr->getState() == Segment::LoadState::Loading) {
-        return true;  // Segment is still loading
+    if (onBenchmarkEvent_) {
+      onBenchmarkEvent_(it->first, "loading", 0);
+    }
+    segment_ptr = std::make_shared<Segment>(
+        it->first, route_.at(it->first), flags_, filters_,
+        [this](int seg_num, bool success) {
+          if (onBenchmarkEvent_) {
+            onBenchmarkEvent_(seg_num, success ? "loaded" : "load failed", 0);
+          }
+          std::unique_lock lock(mutex_);
+          needs_update_ = true;
+          cv_.notify_one();
+        });
+    ++loading;
+    expected_memory += segment_estimate;
+  }
+}
+
+void EventList::append(const std::vector<Event> &events, size_t first, const EventIndex *index) {
+  const Event *begin = events.data() + first, *end = events.data() + events.size();
+  if (begin == end) return;
+  size_ += end - begin;
+
+  const Event *head_end = begin;
+  if (!chunks_.empty() && *begin < *(chunks_.back().end - 1)) {
+    // the events from here on that are before the end of the list, and the events in the list after
+    // the first one from here, are merged into a chunk of their own
+    head_end = std::upper_bound(begin, end, *(chunks_.back().end - 1));
+    std::vector<Event> tail_events;
+    while (!chunks_.empty()) {
+      Chunk &chunk = chunks_.back();
+      const Event *cut = std::upper_bound(chunk.begin, chunk.end, *begin);
+      tail_events.insert(tail_events.begin(), cut, chunk.end);
+      if (cut != chunk.begin) {
+        chunk.end = cut;
+        break;
       }
+      chunks_.pop_back();
     }
-    return false;  // No segments need loading
-  };
 
-  // Try forward loading, then reverse if necessary
-  if (!tryLoadSegment(cur, end)) {
-    tryLoadSegment(std::make_reverse_iterator(cur), std::make_reverse_iterator(begin));
+    auto &merged = merged_.emplace_back();
+    merged.reserve(tail_events.size() + (head_end - begin));
+    std::merge(tail_events.begin(), tail_events.end(), begin, head_end, std::back_inserter(merged));
+    chunks_.push_back({merged.data(), merged.data() + merged.size(), nullptr, nullptr});
+  }
+  if (head_end != end) {
+    chunks_.push_back({head_end, end, events.data(), index});
   }
 }
+
+EventList::const_iterator EventList::upperBound(uint64_t mono_time, cereal::Event::Which which) const {
+  const Event key(which, mono_time, {});
+  auto chunk = std::partition_point(chunks_.begin(), chunks_.end(), [&](const Chunk &c) { return !(key < *(c.end - 1)); });
+  if (chunk == chunks_.end()) return end();
+
+  const Event *event;
+  if (chunk->index) {
+    event = std::clamp(chunk->base + chunk->index->upperBound(mono_time, which), chunk->begin, chunk->end);
+  } else {
+    event = std::upper_bound(chunk->begin, chunk->end, key);
+  }
+  return const_iterator(&*chunk, chunks_.data() + chunks_.size(), event);
+}
+
+EventList::const_iterator EventList::begin() const {
+  const Chunk *last = chunks_.data() + chunks_.size();
+  return chunks_.empty() ? end() : const_iterator(chunks_.data(), last, chunks_.front().begin);
+}
+
+EventList::const_iterator EventList::end() const {
+  const Chunk *last = chunks_.data() + chunks_.size();
+  return const_iterator(last, last, chunks_.empty() ? nullptr : chunks_.back().end);
+}
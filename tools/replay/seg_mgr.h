@@ -1,6 +1,7 @@
 #pragma once
 
 #include <condition_variable>
+#include <iterator>
 #include <map>
 #include <mutex>
 #include <set>
@@ -9,13 +10,68 @@
 #include "tools/replay/route.h"
 
 constexpr int MIN_SEGMENTS_CACHE = 5;
+constexpr int MAX_PARALLEL_SEGMENT_LOADS = 3;
 
 using SegmentMap = std::map<int, std::shared_ptr<Segment>>;
 
+// Sorted events of consecutive segments as a list of chunks that point into the segments' own events.
+// Only where neighbouring segments overlap in time are the events merged into a small chunk of their own,
+// so appending a segment doesn't copy it.
+class EventList {
+public:
+  struct Chunk {
+    const Event *begin, *end;
+    const Event *base;          // start of the events the index refers to
+    const EventIndex *index;    // nullptr for merged chunks
+  };
+
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Event;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Event *;
+    using reference = const Event &;
+
+    const Event &operator*() const { return *event_; }
+    const Event *operator->() const { return event_; }
+    const_iterator &operator++() {
+      if (++event_ == chunk_->end && ++chunk_ != last_) event_ = chunk_->begin;
+      return *this;
+    }
+    bool operator==(const const_iterator &other) const { return chunk_ == other.chunk_ && event_ == other.event_; }
+    bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+  private:
+    friend class EventList;
+    const_iterator(const Chunk *chunk, const Chunk *last, const Event *event) : chunk_(chunk), last_(last), event_(event) {}
+    const Chunk *chunk_, *last_;
+    const Event *event_;
+  };
+
+  EventList() = default;
+  EventList(const EventList &) = delete;
+  EventList &operator=(const EventList &) = delete;
+
+  // appends events[first:] of the next segment, the index is that of the whole events
+  void append(const std::vector<Event> &events, size_t first, const EventIndex *index);
+  // first event after (mono_time, which)
+  const_iterator upperBound(uint64_t mono_time, cereal::Event::Which which) const;
+  const_iterator begin() const;
+  const_iterator end() const;
+  bool empty() const { return chunks_.empty(); }
+  size_t size() const { return size_; }
+
+private:
+  std::vector<Chunk> chunks_;
+  std::vector<std::vector<Event>> merged_;  // events of the overlaps
+  size_t size_ = 0;
+};
+
 class SegmentManager {
 public:
   struct EventData {
-    std::vector<Event> events;  //  Events extracted from the segments
+    EventList events;           // Events of the segments, merged
     SegmentMap segments;        // Associated segments that contributed to these events
     bool isSegmentLoaded(int n) const { return segments.find(n) != segments.end(); }
   };
@@ -27,13 +83,15 @@ public:
   bool load();
   void setCurrentSegment(int seg_num);
   void setCallback(const std::function<void()> &callback) { onSegmentMergedCallback_ = callback; }
-  void setBenchmarkCallback(const std::function<void(int, const std::string&)> &callback) { onBenchmarkEvent_ = callback; }
+  // (seg_num, event, seconds the event took if it's timed)
+  void setBenchmarkCallback(const std::function<void(int, const std::string&, double)> &callback) { onBenchmarkEvent_ = callback; }
   void setFilters(const std::vector<bool> &filters) { filters_ = filters; }
   const std::shared_ptr<EventData> getEventData() const { return std::atomic_load(&event_data_); }
   bool hasSegment(int n) const { return segments_.find(n) != segments_.end(); }
 
   Route route_;
   int segment_cache_limit_ = MIN_SEGMENTS_CACHE;
+  size_t prefetch_memory_limit_ = 0;  // bytes of segments in memory before prefetching stops, 0 for no limit
 
 private:
   void manageSegmentCache();
@@ -53,6 +111,6 @@ private:
   SegmentMap segments_;
   std::shared_ptr<EventData> event_data_;
   std::function<void()> onSegmentMergedCallback_ = nullptr;
-  std::function<void(int, const std::string&)> onBenchmarkEvent_ = nullptr;
+  std::function<void(int, const std::string&, double)> onBenchmarkEvent_ = nullptr;
   std::set<int> merged_segments_;
 };
@@ -0,0 +1,80 @@
+// Decodes frames of a video through FrameReader and reports frames per second: for each software decoder
+// threading mode, and for sequential, random and reverse order with and without the decoded-frame cache.
+// usage: tests/bench_framereader <fcamera.hevc or qcamera.ts> [frames]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "common/timing.h"
+#include "tools/replay/framereader.h"
+
+static double run(FrameReader &fr, VisionBuf &buf, const std::vector<int> &order) {
+  fr.prev_idx = -2;  // start from a seek
+  double start = millis_since_boot();
+  for (int idx : order) {
+    if (!fr.get(idx, &buf)) {
+      fprintf(stderr, "failed to get frame %d\n", idx);
+      exit(1);
+    }
+  }
+  return order.size() / ((millis_since_boot() - start) / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <fcamera.hevc or qcamera.ts> [frames]\n", argv[0]);
+    return 1;
+  }
+
+  FrameReader fr;
+  if (!fr.loadFromFile(RoadCam, argv[1], true)) {
+    fprintf(stderr, "failed to load %s\n", argv[1]);
+    return 1;
+  }
+  const int frame_count = std::min<int>(fr.getFrameCount(), argc > 2 ? atoi(argv[2]) : 200);
+  VisionBuf buf;
+  buf.allocate(fr.width * fr.height * 3 / 2);
+  buf.init_yuv(fr.width, fr.height, fr.width, fr.width * fr.height);
+
+  std::vector<int> sequential, reverse, random;
+  for (int i = 0; i < frame_count; ++i) {
+    sequential.push_back(i);
+    reverse.push_back(frame_count - 1 - i);
+  }
+  random = sequential;
+  std::shuffle(random.begin(), random.end(), std::mt19937(0));
+
+  printf("%s: %dx%d, %d frames\n", argv[1], fr.width, fr.height, frame_count);
+
+  const std::tuple<const char *, DecoderThreadType, int> threading[] = {
+    {"1 thread", DecoderThreadType::Frame, 1},
+    {"frame threads", DecoderThreadType::Frame, 0},
+    {"slice threads", DecoderThreadType::Slice, 0},
+  };
+  printf("%-16s %16s\n", "threading", "sequential fps");
+  for (const auto &[name, type, threads] : threading) {
+    // readers loaded after this get a decoder with the new threading
+    setDecoderThreading(type, threads);
+    FrameReader reader;
+    if (!reader.loadFromFile(RoadCam, argv[1], true)) return 1;
+    reader.frame_cache.setMaxBytes(0);
+    printf("%-16s %16.1f\n", name, run(reader, buf, sequential));
+  }
+  setDecoderThreading(DecoderThreadType::Slice, 0);
+
+  printf("\n%-12s %14s %14s\n", "order", "no cache fps", "cache fps");
+  for (const auto &[name, order] : {std::pair{"sequential", &sequential}, {"reverse", &reverse}, {"random", &random}}) {
+    fr.frame_cache.setMaxBytes(0);
+    double uncached = run(fr, buf, *order);
+    fr.frame_cache.setMaxBytes(FRAME_CACHE_BYTES);
+    double cached = run(fr, buf, *order);
+    fr.frame_cache.setMaxBytes(0);  // start the next order from an empty cache
+    printf("%-12s %14.1f %14.1f\n", name, uncached, cached);
+  }
+  buf.free();
+  return 0;
+}
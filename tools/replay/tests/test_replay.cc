@@ -1,5 +1,14 @@
 #define CATCH_CONFIG_MAIN
+#include <bzlib.h>
+#include <fcntl.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 #include "catch2/catch.hpp"
+#include "common/util.h"
 #include "tools/replay/filereader.h"
 #include "tools/replay/replay.h"
 
@@ -16,3 +25,322 @@ TEST_CASE("LogReader") {
     REQUIRE(log.events.size() > 0);
   }
 }
+
+static std::string build_log(int event_cnt) {
+  std::string log;
+  for (int i = 0; i < event_cnt; ++i) {
+    MessageBuilder msg;
+    auto can = msg.initEvent().initCan(8);
+    for (int j = 0; j < can.size(); ++j) {
+      can[j].setAddress(i * 8 + j);
+      can[j].setDat(kj::heapArray<capnp::byte>(8));
+    }
+    auto bytes = msg.toBytes();
+    log.append((const char *)bytes.begin(), bytes.size());
+  }
+  return log;
+}
+
+TEST_CASE("LogReader event index") {
+  // services logged in time order, interleaved slightly out of order
+  std::string raw;
+  for (int i = 0; i < 3000; ++i) {
+    MessageBuilder msg;
+    auto event = msg.initEvent();
+    switch (i % 3) {
+      case 0: event.initCan(1); break;
+      case 1: event.initSendcan(1); break;
+      default: event.initCarState(); break;
+    }
+    event.setLogMonoTime(1e9 + (i / 3) * 1e7 + (i % 3) * 4e6 - (i % 5) * 3e6);
+    auto bytes = msg.toBytes();
+    raw.append((const char *)bytes.begin(), bytes.size());
+  }
+  LogReader log;
+  REQUIRE(log.load(raw.data(), raw.size()));
+  const auto &events = log.events;
+  REQUIRE(events.size() == 3000);
+  REQUIRE(std::is_sorted(events.begin(), events.end()));
+
+  for (auto which : {cereal::Event::Which::CAN, cereal::Event::Which::SENDCAN, cereal::Event::Which::CAR_STATE}) {
+    const auto &positions = log.index.service(which);
+    REQUIRE(positions.size() == 1000);
+    REQUIRE(std::all_of(positions.begin(), positions.end(), [&](uint32_t i) { return events[i].which == which; }));
+    REQUIRE(std::is_sorted(positions.begin(), positions.end()));
+
+    for (size_t i = 0; i < events.size(); i += 7) {
+      uint64_t t = events[i].mono_time - (i % 2);
+      size_t expected = std::upper_bound(events.begin(), events.end(), Event(which, t, {})) - events.begin();
+      REQUIRE(log.index.upperBound(t, which) == expected);
+      auto next = std::find_if(events.begin() + expected, events.end(), [&](auto &e) { return e.which == which && e.mono_time > t; });
+      REQUIRE(log.index.nextOf(which, t) == (next == events.end() ? -1 : next - events.begin()));
+    }
+  }
+  REQUIRE(log.index.service(cereal::Event::Which::INIT_DATA).empty());
+}
+
+TEST_CASE("EventList merges overlapping segments") {
+  // each segment starts with initData, and its first events are before the end of the previous segment
+  std::vector<std::unique_ptr<LogReader>> logs;
+  std::vector<Event> expected;
+  for (int n = 0; n < 4; ++n) {
+    std::string raw;
+    for (int i = -1; i < 1000; ++i) {
+      MessageBuilder msg;
+      auto event = msg.initEvent();
+      if (i == -1) {
+        event.initInitData();
+      } else {
+        i % 2 ? (void)event.initCan(1) : (void)event.initCarState();
+      }
+      event.setLogMonoTime(1e9 + n * 1e9 + i * 1.05e6);
+      auto bytes = msg.toBytes();
+      raw.append((const char *)bytes.begin(), bytes.size());
+    }
+    auto &log = logs.emplace_back(std::make_unique<LogReader>());
+    REQUIRE(log->load(raw.data(), raw.size()));
+    REQUIRE(log->events.front().which == cereal::Event::Which::INIT_DATA);
+    expected.insert(expected.end(), log->events.begin() + 1, log->events.end());
+  }
+  std::stable_sort(expected.begin(), expected.end());
+
+  EventList list;
+  for (auto &log : logs) {
+    list.append(log->events, 1, &log->index);
+  }
+  REQUIRE(list.size() == expected.size());
+  REQUIRE(std::equal(list.begin(), list.end(), expected.begin(), expected.end(), [](const Event &a, const Event &b) {
+    return a.mono_time == b.mono_time && a.which == b.which && a.data.begin() == b.data.begin();
+  }));
+
+  for (size_t i = 0; i < expected.size(); i += 13) {
+    auto which = i % 3 ? cereal::Event::Which::CAN : cereal::Event::Which::CAR_STATE;
+    uint64_t t = expected[i].mono_time - (i % 2);
+    size_t pos = std::upper_bound(expected.begin(), expected.end(), Event(which, t, {})) - expected.begin();
+    REQUIRE((size_t)std::distance(list.begin(), list.upperBound(t, which)) == pos);
+  }
+  REQUIRE(list.upperBound(expected.back().mono_time, cereal::Event::Which::CAR_STATE) == list.end());
+}
+
+static std::string compress_log(const std::string &raw, bool bz2) {
+  std::string compressed;
+  if (bz2) {
+    unsigned int size = raw.size() + raw.size() / 100 + 600;
+    compressed.resize(size);
+    REQUIRE(BZ2_bzBuffToBuffCompress(compressed.data(), &size, (char *)raw.data(), raw.size(), 9, 0, 0) == BZ_OK);
+    compressed.resize(size);
+  } else {
+    compressed.resize(ZSTD_compressBound(raw.size()));
+    size_t size = ZSTD_compress(compressed.data(), compressed.size(), raw.data(), raw.size(), 10);
+    REQUIRE(!ZSTD_isError(size));
+    compressed.resize(size);
+  }
+  return compressed;
+}
+
+// independent frames, followed by the logMonoTime index if there are mono_times, and the seek table of the seekable format
+static std::string compress_frames_seekable(const std::vector<std::string> &frames, const std::vector<uint64_t> &mono_times = {}) {
+  std::string compressed;
+  std::vector<uint32_t> table;
+  for (const std::string &raw : frames) {
+    std::string frame(ZSTD_compressBound(raw.size()), '\0');
+    size_t ret = ZSTD_compress(frame.data(), frame.size(), raw.data(), raw.size(), 10);
+    REQUIRE(!ZSTD_isError(ret));
+    compressed.append(frame.data(), ret);
+    table.insert(table.end(), {uint32_t(ret), uint32_t(raw.size())});
+  }
+  if (!mono_times.empty()) {
+    const uint32_t header[] = {0x184D2A5D, uint32_t(mono_times.size() * 8)};
+    compressed.append((const char *)header, sizeof(header));
+    compressed.append((const char *)mono_times.data(), mono_times.size() * 8);
+    table.insert(table.end(), {uint32_t(sizeof(header) + mono_times.size() * 8), 0});
+  }
+  const uint32_t num_frames = table.size() / 2;
+  table.insert(table.begin(), {0x184D2A5E, uint32_t(table.size() * 4 + 9)});
+  compressed.append((const char *)table.data(), table.size() * 4);
+  compressed.append((const char *)&num_frames, 4);
+  compressed.push_back(0);
+  const uint32_t magic = 0x8F92EAB1;
+  compressed.append((const char *)&magic, 4);
+  return compressed;
+}
+
+// frames of about frame_size bytes each
+static std::string compress_log_seekable(const std::string &raw, size_t frame_size) {
+  std::vector<std::string> frames;
+  for (size_t pos = 0; pos < raw.size(); pos += frame_size) {
+    frames.push_back(raw.substr(pos, frame_size));
+  }
+  return compress_frames_seekable(frames);
+}
+
+static void require_same_events(const LogReader &log, const LogReader &expected) {
+  REQUIRE(log.events.size() == expected.events.size());
+  for (size_t i = 0; i < log.events.size(); ++i) {
+    const Event &a = log.events[i], &b = expected.events[i];
+    REQUIRE(a.mono_time == b.mono_time);
+    REQUIRE(a.which == b.which);
+    REQUIRE(a.data.asBytes() == b.data.asBytes());
+  }
+}
+
+TEST_CASE("LogReader streams compressed logs") {
+  const bool bz2 = GENERATE(false, true);
+  const std::string raw = build_log(50000);
+  LogReader expected;
+  REQUIRE(expected.load(raw.data(), raw.size()));
+  std::string compressed = compress_log(raw, bz2);
+
+  SECTION("whole log") {
+    const std::string path = bz2 ? "/tmp/test_replay_stream.bz2" : "/tmp/test_replay_stream.zst";
+    REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    LogReader log;
+    REQUIRE(log.load(path));
+    REQUIRE(log.decompressed_size() == raw.size());
+    require_same_events(log, expected);
+    WARN((bz2 ? "bz2" : "zst") << ": first event after " << log.first_event_seconds() * 1000
+         << " ms, all events after " << log.parse_seconds() * 1000 << " ms");
+  }
+  SECTION("truncated log") {
+    const std::string path = bz2 ? "/tmp/test_replay_truncated.bz2" : "/tmp/test_replay_truncated.zst";
+    compressed.resize(compressed.size() / 2);
+    REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    LogReader log;
+    REQUIRE(log.load(path));
+    REQUIRE(log.events.size() > 0);
+    REQUIRE(log.events.size() < expected.events.size());
+  }
+}
+
+TEST_CASE("LogReader decompresses seekable zst logs in parallel") {
+  const std::string raw = build_log(50000);
+  LogReader expected;
+  REQUIRE(expected.load(raw.data(), raw.size()));
+  // frames that split messages, and a single frame that falls back to streaming
+  const size_t frame_size = GENERATE(100000, 1000003, 100000000);
+  std::string compressed = compress_log_seekable(raw, frame_size);
+
+  std::string out;
+  size_t in_pos = 0;
+  REQUIRE(decompressZSTStream((const std::byte *)compressed.data(), compressed.size(), [&](const char *data, size_t size, size_t pos) {
+    out.append(data, size);
+    REQUIRE(pos >= in_pos);
+    in_pos = pos;
+    return true;
+  }));
+  REQUIRE(out == raw);
+
+  const std::string path = "/tmp/test_replay_seekable.zst";
+  REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+  LogReader log;
+  REQUIRE(log.load(path));
+  require_same_events(log, expected);
+
+  SECTION("corrupt frame") {
+    auto frames = zstdSeekTable((const std::byte *)compressed.data(), compressed.size());
+    if (frames.size() > 2) {
+      compressed[frames[1].compressed_offset] ^= 0x55;
+      out.clear();
+      REQUIRE(!decompressZSTStream((const std::byte *)compressed.data(), compressed.size(), [&](const char *data, size_t size, size_t) {
+        out.append(data, size);
+        return true;
+      }));
+      REQUIRE(out == raw.substr(0, frames[0].decompressed_size));
+    }
+  }
+}
+
+TEST_CASE("LogReader loads a time range of seekable zst logs") {
+  // 10 frames of 1000 events, 1ms apart
+  std::vector<std::string> frames(10);
+  std::vector<uint64_t> mono_times;
+  for (size_t f = 0; f < frames.size(); ++f) {
+    mono_times.push_back((f + 1) * 1000000000ull);
+    for (int i = 0; i < 1000; ++i) {
+      MessageBuilder msg;
+      auto event = msg.initEvent();
+      event.initCan(1);
+      event.setLogMonoTime(mono_times.back() + i * 1000000ull);
+      auto bytes = msg.toBytes();
+      frames[f].append((const char *)bytes.begin(), bytes.size());
+    }
+  }
+  const std::string path = "/tmp/test_replay_time_range.zst";
+
+  SECTION("with the logMonoTime index") {
+    std::string compressed = compress_frames_seekable(frames, mono_times);
+    auto table = zstdSeekTable((const std::byte *)compressed.data(), compressed.size());
+    REQUIRE(table.size() == frames.size());
+    for (size_t f = 0; f < table.size(); ++f) {
+      REQUIRE(table[f].mono_time == mono_times[f]);
+    }
+
+    REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    // from the middle of the third frame to the middle of the fifth
+    LogReader log;
+    log.setTimeRange(3500000000ull, 5500000000ull);
+    REQUIRE(log.load(path));
+    REQUIRE(log.events.size() == 3000);
+    REQUIRE(log.events.front().mono_time == mono_times[2]);
+    REQUIRE(log.events.back().mono_time == mono_times[4] + 999 * 1000000ull);
+  }
+  SECTION("without the index") {
+    std::string compressed = compress_frames_seekable(frames);
+    REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    LogReader log;
+    log.setTimeRange(3500000000ull, 5500000000ull);
+    REQUIRE(log.load(path));
+    REQUIRE(log.events.size() == 10000);
+  }
+}
+
+TEST_CASE("LogReader decompressed log cache") {
+  const std::string cache_root = "/tmp/test_replay_log_cache";
+  REQUIRE(system(("rm " + cache_root + " -rf").c_str()) == 0);
+  setenv("COMMA_CACHE", cache_root.c_str(), 1);
+  setenv("REPLAY_LOG_CACHE_MB", "64", 1);
+
+  const std::string raw = build_log(20000);
+  LogReader expected;
+  REQUIRE(expected.load(raw.data(), raw.size()));
+  const std::string path = "/tmp/test_replay_log_cache.zst";
+  std::string compressed = compress_log(raw, false);
+  REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+
+  LogReader first;
+  REQUIRE(first.load(path));
+  REQUIRE(first.compressed_size() == compressed.size());
+
+  // served from the cache, without reading or decompressing the file
+  LogReader cached;
+  REQUIRE(cached.load(path));
+  REQUIRE(cached.compressed_size() == 0);
+  REQUIRE(cached.decompressed_size() == raw.size());
+  require_same_events(cached, expected);
+
+  SECTION("rewriting the file invalidates its entry") {
+    const std::string raw2 = build_log(100);
+    compressed = compress_log(raw2, false);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(util::write_file(path.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    LogReader log;
+    REQUIRE(log.load(path));
+    REQUIRE(log.compressed_size() == compressed.size());
+    REQUIRE(log.events.size() == 100);
+  }
+  SECTION("least recently used entries are evicted") {
+    // room for one and a half entries
+    const size_t budget_mb = (raw.size() * 3 / 2) / (1024 * 1024) + 1;
+    REQUIRE(budget_mb * 1024 * 1024 < raw.size() * 2);
+    setenv("REPLAY_LOG_CACHE_MB", std::to_string(budget_mb).c_str(), 1);
+    const std::string path2 = "/tmp/test_replay_log_cache2.zst";
+    REQUIRE(util::write_file(path2.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    LogReader log;
+    REQUIRE(log.load(path2));
+    REQUIRE(LogCache::open(path) == nullptr);
+    REQUIRE(LogCache::open(path2) != nullptr);
+  }
+
+  unsetenv("REPLAY_LOG_CACHE_MB");
+  unsetenv("COMMA_CACHE");
+}
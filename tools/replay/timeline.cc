@@ -59,16 +59,17 @@ void Timeline::buildTimeline(const Route &route, uint64_t route_start_ts, bool l
       continue;  // Skip if log loading fails or no events
     }
 
-    for (const Event &e : log->events) {
+    for (uint32_t i : log->index.service(cereal::Event::Which::SELFDRIVE_STATE)) {
+      const Event &e = log->events[i];
       double seconds = (e.mono_time - route_start_ts) / 1e9;
-      if (e.which == cereal::Event::Which::SELFDRIVE_STATE) {
-        capnp::FlatArrayMessageReader reader(e.data);
-        auto cs = reader.getRoot<cereal::Event>().getSelfdriveState();
-        updateEngagementStatus(cs, current_engaged_idx, seconds);
-        updateAlertStatus(cs, current_alert_idx, seconds);
-      } else if (e.which == cereal::Event::Which::USER_BOOKMARK) {
-        staging_entries_.emplace_back(Entry{seconds, seconds, TimelineType::UserBookmark});
-      }
+      capnp::FlatArrayMessageReader reader(e.data);
+      auto cs = reader.getRoot<cereal::Event>().getSelfdriveState();
+      updateEngagementStatus(cs, current_engaged_idx, seconds);
+      updateAlertStatus(cs, current_alert_idx, seconds);
+    }
+    for (uint32_t i : log->index.service(cereal::Event::Which::USER_BOOKMARK)) {
+      double seconds = (log->events[i].mono_time - route_start_ts) / 1e9;
+      staging_entries_.emplace_back(Entry{seconds, seconds, TimelineType::UserBookmark});
     }
 
     // Sort and finalize the timeline entries
@@ -2,11 +2,15 @@
 
 #include <bzlib.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstring>
 #include <iostream>
 #include <mutex>
+#include <thread>
 #include <zstd.h>
 
 #include "common/timing.h"
@@ -99,10 +103,101 @@ std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool>
   return {};
 }
 
+bool decompressBZ2Stream(const std::byte *in, size_t in_size, const DecompressCallback &output, std::atomic<bool> *abort) {
+  bz_stream strm = {};
+  int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
+  assert(bzerror == BZ_OK);
+
+  strm.next_in = (char *)in;
+  strm.avail_in = in_size;
+  std::vector<char> buf(1024 * 1024);
+  bool complete = false;
+  do {
+    strm.next_out = buf.data();
+    strm.avail_out = buf.size();
+    bzerror = BZ2_bzDecompress(&strm);
+    const size_t produced = buf.size() - strm.avail_out;
+    if ((bzerror != BZ_OK && bzerror != BZ_STREAM_END) || (bzerror == BZ_OK && produced == 0)) {
+      // corrupt, or truncated: the input ran out before the end of the stream
+      rWarning("decompressBZ2 error: content is corrupt");
+      break;
+    }
+    if (!output(buf.data(), produced, in_size - strm.avail_in)) break;
+    complete = bzerror == BZ_STREAM_END;
+  } while (bzerror == BZ_OK && !(abort && *abort));
+
+  BZ2_bzDecompressEnd(&strm);
+  return complete && !(abort && *abort);
+}
+
 std::string decompressZST(const std::string &in, std::atomic<bool> *abort) {
   return decompressZST((std::byte *)in.data(), in.size(), abort);
 }
 
+template <typename T>
+static T read_le(const std::byte *p) {
+  T v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+std::vector<ZstdFrame> zstdSeekTable(const std::byte *in, size_t in_size) {
+  // from the seekable format, see ZSTD_SEEKABLE_MAGIC in system/loggerd/zstd_writer.h
+  constexpr uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+  constexpr uint32_t SEEK_TABLE_MAGIC = 0x184D2A5E;
+  constexpr uint32_t MONO_TIME_INDEX_MAGIC = 0x184D2A5D;
+  constexpr size_t FRAME_HEADER_SIZE = 8, FOOTER_SIZE = 9;
+
+  if (in_size < FRAME_HEADER_SIZE + FOOTER_SIZE || read_le<uint32_t>(in + in_size - 4) != SEEKABLE_MAGIC) return {};
+  const size_t num_frames = read_le<uint32_t>(in + in_size - FOOTER_SIZE);
+  const size_t entry_size = ((uint8_t)in[in_size - 5] & 0x80) ? 12 : 8;  // with checksums
+  const size_t table_size = FRAME_HEADER_SIZE + num_frames * entry_size + FOOTER_SIZE;
+  if (table_size > in_size || read_le<uint32_t>(in + in_size - table_size) != SEEK_TABLE_MAGIC) return {};
+
+  std::vector<ZstdFrame> frames;
+  const std::byte *mono_time_index = nullptr;
+  size_t mono_time_index_size = 0, compressed_offset = 0;
+  const std::byte *entry = in + in_size - table_size + FRAME_HEADER_SIZE;
+  for (size_t i = 0; i < num_frames; ++i, entry += entry_size) {
+    const size_t compressed_size = read_le<uint32_t>(entry), decompressed_size = read_le<uint32_t>(entry + 4);
+    if (compressed_offset + compressed_size > in_size - table_size) return {};
+
+    // skippable frames decompress to nothing
+    if (decompressed_size > 0) {
+      frames.push_back({compressed_offset, compressed_size, decompressed_size});
+    } else if (compressed_size >= FRAME_HEADER_SIZE && read_le<uint32_t>(in + compressed_offset) == MONO_TIME_INDEX_MAGIC) {
+      mono_time_index = in + compressed_offset;
+      mono_time_index_size = compressed_size;
+    }
+    compressed_offset += compressed_size;
+  }
+  if (compressed_offset != in_size - table_size) return {};
+
+  // one logMonoTime per frame, ignored if it doesn't match the frames
+  const size_t index_size = frames.size() * sizeof(uint64_t);
+  if (mono_time_index && mono_time_index_size == FRAME_HEADER_SIZE + index_size &&
+      read_le<uint32_t>(mono_time_index + 4) == index_size) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      frames[i].mono_time = read_le<uint64_t>(mono_time_index + FRAME_HEADER_SIZE + i * sizeof(uint64_t));
+    }
+  }
+  return frames;
+}
+
+std::vector<ZstdFrame> zstdFramesInRange(const std::vector<ZstdFrame> &frames, uint64_t begin, uint64_t end) {
+  // the last frame is only at time 0 without the index
+  if (frames.empty() || frames.back().mono_time == 0) return frames;
+
+  // a frame holds the events from its time up to the next frame's
+  std::vector<ZstdFrame> in_range;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i].mono_time < end && (i + 1 == frames.size() || frames[i + 1].mono_time > begin)) {
+      in_range.push_back(frames[i]);
+    }
+  }
+  return in_range;
+}
+
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort) {
   ZSTD_DCtx *dctx = ZSTD_createDCtx();
   assert(dctx != nullptr);
@@ -142,6 +237,118 @@ std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool>
   return {};
 }
 
+// The frames of a seekable file decompress independently, so worker threads decompress the next few
+// frames in parallel while this thread hands the finished ones to output in order. Only the frames
+// in the window are held in memory.
+bool decompressZSTFrames(const std::byte *in, size_t in_size, const std::vector<ZstdFrame> &frames,
+                         const DecompressCallback &output, std::atomic<bool> *abort) {
+  if (frames.empty()) return true;
+
+  enum class State { PENDING, DONE, FAILED };
+  struct Frame {
+    State state = State::PENDING;
+    std::vector<char> data;
+  };
+  const size_t num_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::min<size_t>(frames.size(), 4));
+  const size_t window = num_threads + 1;
+  std::vector<Frame> out(frames.size());
+  std::mutex lock;
+  std::condition_variable cv;
+  size_t next_frame = 0, delivered = 0;
+  bool stop = false;
+
+  auto decompress = [&]() {
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    assert(dctx != nullptr);
+    std::unique_lock lk(lock);
+    while (true) {
+      cv.wait(lk, [&]() { return stop || next_frame == frames.size() || next_frame < delivered + window || (abort && *abort); });
+      if (stop || next_frame == frames.size() || (abort && *abort)) break;
+
+      const size_t i = next_frame++;
+      lk.unlock();
+      const ZstdFrame &f = frames[i];
+      std::vector<char> data(f.decompressed_size);
+      size_t ret = ZSTD_decompressDCtx(dctx, data.data(), data.size(), in + f.compressed_offset, f.compressed_size);
+      lk.lock();
+      out[i].state = ZSTD_isError(ret) || ret != f.decompressed_size ? State::FAILED : State::DONE;
+      out[i].data = std::move(data);
+      cv.notify_all();
+    }
+    lk.unlock();
+    ZSTD_freeDCtx(dctx);
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(decompress);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < frames.size() && ok && !(abort && *abort); ++i) {
+    std::vector<char> data;
+    {
+      std::unique_lock lk(lock);
+      // workers don't wait on abort, so wake up now and then to check it
+      while (out[i].state == State::PENDING && !(abort && *abort)) {
+        cv.wait_for(lk, std::chrono::milliseconds(50));
+      }
+      if (out[i].state != State::DONE) {
+        if (out[i].state == State::FAILED) rWarning("decompressZST error: content is corrupt");
+        ok = false;
+        break;
+      }
+      data = std::move(out[i].data);
+      delivered = i + 1;
+      cv.notify_all();
+    }
+    // the seek table at the end is consumed with the last frame
+    const size_t in_pos = i + 1 == frames.size() ? in_size : frames[i].compressed_offset + frames[i].compressed_size;
+    ok = output(data.data(), data.size(), in_pos);
+  }
+
+  {
+    std::lock_guard lk(lock);
+    stop = true;
+  }
+  cv.notify_all();
+  for (auto &t : threads) t.join();
+  return ok && !(abort && *abort);
+}
+
+bool decompressZSTStream(const std::byte *in, size_t in_size, const DecompressCallback &output, std::atomic<bool> *abort) {
+  if (auto frames = zstdSeekTable(in, in_size); frames.size() > 1) {
+    return decompressZSTFrames(in, in_size, frames, output, abort);
+  }
+
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  assert(dctx != nullptr);
+
+  ZSTD_inBuffer input = {in, in_size, 0};
+  std::vector<char> buf(ZSTD_DStreamOutSize());
+  bool output_full = false, ok = true;
+  size_t result = 0;
+  // a full output buffer may leave decompressed data behind after the last input is consumed
+  while ((input.pos < input.size || output_full) && !(abort && *abort)) {
+    ZSTD_outBuffer out = {buf.data(), buf.size(), 0};
+    result = ZSTD_decompressStream(dctx, &out, &input);
+    if (ZSTD_isError(result)) {
+      rWarning("decompressZST error: content is corrupt");
+      ok = false;
+      break;
+    }
+    output_full = out.pos == out.size;
+    if (out.pos > 0 && !output(buf.data(), out.pos, input.pos)) {
+      ok = false;
+      break;
+    }
+  }
+
+  ZSTD_freeDCtx(dctx);
+  // a non-zero result means the last frame was cut short
+  return ok && result == 0 && !(abort && *abort);
+}
+
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &interrupt_requested) {
   struct timespec req, rem;
   req.tv_sec = nanoseconds / 1000000000;
@@ -51,6 +51,27 @@ std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = null
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
+// streaming versions, output is called with each decompressed block and the number of input bytes
+// consumed so far. returning false from output stops decompression.
+// returns true if the whole input was decompressed.
+using DecompressCallback = std::function<bool(const char *data, size_t size, size_t in_pos)>;
+bool decompressBZ2Stream(const std::byte *in, size_t in_size, const DecompressCallback &output, std::atomic<bool> *abort = nullptr);
+bool decompressZSTStream(const std::byte *in, size_t in_size, const DecompressCallback &output, std::atomic<bool> *abort = nullptr);
+
+// a frame of a seekable zstd rlog (see system/loggerd/zstd_writer.h)
+struct ZstdFrame {
+  size_t compressed_offset, compressed_size;
+  size_t decompressed_size;
+  uint64_t mono_time = 0;  // logMonoTime of the first event, from the index. 0 without one
+};
+// the frames listed in the seek table, empty if in isn't seekable. decompressZSTStream() decompresses
+// the frames of seekable files in parallel.
+std::vector<ZstdFrame> zstdSeekTable(const std::byte *in, size_t in_size);
+// the frames with events in [begin, end) logMonoTime, or all of them if the file has no logMonoTime index
+std::vector<ZstdFrame> zstdFramesInRange(const std::vector<ZstdFrame> &frames, uint64_t begin, uint64_t end);
+// decompresses the given frames of a seekable file in parallel, and hands them to output in order
+bool decompressZSTFrames(const std::byte *in, size_t in_size, const std::vector<ZstdFrame> &frames,
+                         const DecompressCallback &output, std::atomic<bool> *abort = nullptr);
 std::string getUrlWithoutQuery(const std::string &url);
 std::string formattedDataSize(size_t size);
 std::string extractFileName(const std::string& file);